@@ -0,0 +1,519 @@
+/***********************************************************************
+ *
+ * Módulo: Banco de pruebas de los núcleos de bmp/. Genera imágenes
+ *         sintéticas de 1, 4, 8, 16, 24 y 32 BPP, mide cada núcleo por separado
+ *         (con calentamiento y repeticiones) y deja los resultados en
+ *         JSON, una línea por medición, para comparar versiones.
+ *         Uso: bench [-t ANCHOxALTO]... [-p 1,4,8,16,24,32] [-r REPETICIONES]
+ *                    [-c CALENTAMIENTO] [-j HILOS] [-k NUCLEO] [-o SALIDA]
+ *                    [-H]
+ *         Ej.: bench -t 4000x3000 -p 24 -k rotar -o antes.json
+ * Autor:  Martín Aguilar
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../headers/bmp.h"
+#include "../headers/bmp_interno.h"
+#include "../headers/pool.h"
+#include "../headers/reserva.h"
+#include "../headers/medicion.h"
+
+/* Tamaños por defecto, si no se pasa ningún -t */
+#define TAMANIOS_DEFECTO 2
+
+/* Máximo de tamaños distintos en una corrida */
+#define MAX_TAMANIOS 16
+
+/* Radio del blur que se mide */
+#define RADIO_BLUR 5
+
+/* BPP que se pueden pedir con -p, en el orden en que se miden */
+static const uint16_t profundidades[] = { 1, 4, 8, 16, 24, 32 };
+
+/*
+ * Una imágen sintética: el archivo generado, sus filas tal como están
+ * en el archivo, las mismas filas decodificadas a colores y a índices,
+ * y un buffer de una fila para los codificadores. "imagen" es la que
+ * usan los núcleos; los que la modifican reciben una recién cargada.
+ */
+typedef struct
+{
+    char        archivo[64];
+    bmp_t      *imagen;
+    uint8_t    *crudo;
+    bmpcolor_t *colores;
+    uint8_t    *indices;
+    uint8_t    *fila;
+    uint32_t    fila_archivo;
+    int32_t     ancho;
+    int32_t     alto;
+    uint16_t    bpp;
+} caso_bench;
+
+/*
+ * Un núcleo a medir. Si "modifica", cada repetición trabaja sobre la
+ * imágen recién cargada del archivo (la carga no se mide).
+ */
+typedef struct
+{
+    const char *nombre;
+    bool        modifica;
+    bool        solo_indexadas;
+    void ( *correr )( caso_bench *caso );
+} nucleo_bench;
+
+// ENCABEZADOS FUNCIONES
+
+uint32_t aleatorio( uint32_t *estado );
+
+bool generar_caso( caso_bench *caso, const char *directorio, int32_t ancho, int32_t alto, uint16_t bpp );
+
+void liberar_caso( caso_bench *caso );
+
+void correr_leer_pixels( caso_bench *caso );
+
+void correr_grabar_pixels( caso_bench *caso );
+
+void correr_leer_indices( caso_bench *caso );
+
+void correr_grabar_indices( caso_bench *caso );
+
+void correr_rotar( caso_bench *caso );
+
+void correr_flip( caso_bench *caso );
+
+void correr_negativo( caso_bench *caso );
+
+void correr_blur( caso_bench *caso );
+
+void correr_doble( caso_bench *caso );
+
+void correr_mitad( caso_bench *caso );
+
+void correr_bilineal( caso_bench *caso );
+
+void correr_lanczos( caso_bench *caso );
+
+void correr_lineas_h( caso_bench *caso );
+
+void correr_lineas_v( caso_bench *caso );
+
+int comparar_tiempos( const void *a, const void *b );
+
+bool medir( const nucleo_bench *nucleo, caso_bench *caso,
+            uint32_t calentamiento, uint32_t repeticiones, uint64_t *tiempos );
+
+// FIN ENCABEZADOS
+
+
+static const nucleo_bench nucleos[] =
+{
+    { "leer_pixels",   false, false, correr_leer_pixels },
+    { "grabar_pixels", false, false, correr_grabar_pixels },
+    { "leer_indices",  false, true,  correr_leer_indices },
+    { "grabar_indices", false, true, correr_grabar_indices },
+    { "rotar",         true,  false, correr_rotar },
+    { "flip",          true,  false, correr_flip },
+    { "negativo",      true,  false, correr_negativo },
+    { "blur",          true,  false, correr_blur },
+    { "doble",         true,  false, correr_doble },
+    { "mitad",         true,  false, correr_mitad },
+    { "bilineal",      true,  false, correr_bilineal },
+    { "lanczos",       true,  false, correr_lanczos },
+    { "lineas_h",      true,  false, correr_lineas_h },
+    { "lineas_v",      true,  false, correr_lineas_v },
+};
+
+#define CANT_NUCLEOS ( sizeof( nucleos ) / sizeof( nucleos[0] ) )
+
+/*
+ * xorshift32: las imágenes son siempre las mismas para cada tamaño.
+ */
+uint32_t aleatorio( uint32_t *estado )
+{
+    uint32_t x = *estado;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *estado = x;
+}
+
+/*
+ * Genera el archivo de la imágen sintética, con una paleta en escala de
+ * grises si tiene, lo carga, y prepara las filas que usan los núcleos
+ * de lectura y de grabación.
+ */
+bool generar_caso( caso_bench *caso, const char *directorio, int32_t ancho, int32_t alto, uint16_t bpp )
+{
+    bitmapfileheader fileheader;
+    bitmapinfoheader infoheader;
+    decodificador_fila decodificar;
+    decodificador_indices decodificar_indices;
+    bmpcolor_t color;
+    uint16_t magic = 0x4d42;
+    uint32_t i, ncolores, estado = 0x9E3779B9u ^ ( ancho * 31 + alto * 7 + bpp );
+    size_t total;
+    int32_t y;
+    FILE *f;
+    bool ok;
+
+    memset( caso, 0, sizeof( caso_bench ) );
+    caso->ancho = ancho;
+    caso->alto = alto;
+    caso->bpp = bpp;
+    caso->fila_archivo = calcular_fila_alineada( ancho, bpp );
+    ncolores = bpp > 8 ? 0 : 1U << bpp;
+    total = ( size_t ) caso->fila_archivo * alto;
+
+    snprintf( caso->archivo, sizeof( caso->archivo ), "%s/%dx%d_%u.bmp", directorio, ancho, alto, bpp );
+    caso->crudo = ( uint8_t * ) malloc( total );
+    caso->colores = ( bmpcolor_t * ) malloc( sizeof( bmpcolor_t ) * ancho * alto );
+    caso->indices = ( uint8_t * ) malloc( ( size_t ) ancho * alto );
+    caso->fila = ( uint8_t * ) calloc( caso->fila_archivo, 1 );
+    if ( caso->crudo == NULL || caso->colores == NULL || caso->indices == NULL || caso->fila == NULL )
+    {
+        fprintf( stderr, "Error alocando memoria para %s\n", caso->archivo );
+        liberar_caso( caso );
+        return false;
+    }
+    for ( i = 0; i < total; i++ )
+        caso->crudo[i] = aleatorio( &estado );
+
+    memset( &infoheader, 0, sizeof( infoheader ) );
+    infoheader.header_sz = sizeof( bitmapinfoheader );
+    infoheader.width = ancho;
+    infoheader.height = alto;
+    infoheader.nplanes = 1;
+    infoheader.bitspp = bpp;
+    infoheader.bmp_bytesz = total;
+    infoheader.hres = infoheader.vres = 2835;
+    infoheader.ncolores = infoheader.n_colores_imp = ncolores;
+    fileheader.reserved = 0;
+    fileheader.bmp_offset = 14 + sizeof( bitmapinfoheader ) + ncolores * 4;
+    fileheader.filesz = fileheader.bmp_offset + total;
+
+    if ( ( f = fopen( caso->archivo, "w" ) ) == NULL )
+    {
+        fprintf( stderr, "Error al abrir %s para escribir\n", caso->archivo );
+        liberar_caso( caso );
+        return false;
+    }
+    ok = fwrite( &magic, sizeof( magic ), 1, f ) == 1 &&
+         fwrite( &fileheader, sizeof( fileheader ), 1, f ) == 1 &&
+         fwrite( &infoheader, sizeof( infoheader ), 1, f ) == 1;
+    for ( i = 0; ok && i < ncolores; i++ )
+    {
+        color.red = color.green = color.blue = i * 255 / ( ncolores - 1 );
+        color.alpha = 0;
+        ok = fwrite( &color, sizeof( color ), 1, f ) == 1;
+    }
+    ok = ok && fwrite( caso->crudo, 1, total, f ) == total;
+    if ( fclose( f ) || !ok )
+    {
+        fprintf( stderr, "Error grabando %s\n", caso->archivo );
+        liberar_caso( caso );
+        return false;
+    }
+
+    if ( ( caso->imagen = crear_imagen_archivo( caso->archivo ) ) == NULL )
+    {
+        liberar_caso( caso );
+        return false;
+    }
+
+    /* las filas del archivo van de abajo hacia arriba, como al leerlo */
+    decodificar = decodificador_de( caso->imagen );
+    decodificar_indices = decodificador_indices_de( caso->imagen );
+    for ( y = 0; y < alto; y++ )
+    {
+        decodificar( caso->imagen, caso->crudo + ( size_t ) ( alto - 1 - y ) * caso->fila_archivo,
+                     caso->colores + ( size_t ) y * ancho );
+        if ( decodificar_indices != NULL )
+            decodificar_indices( caso->imagen, caso->crudo + ( size_t ) ( alto - 1 - y ) * caso->fila_archivo,
+                                 caso->indices + ( size_t ) y * ancho );
+    }
+
+    return true;
+}
+
+void liberar_caso( caso_bench *caso )
+{
+    if ( caso->imagen != NULL )
+        destruir_bmp( caso->imagen );
+    if ( caso->archivo[0] )
+        unlink( caso->archivo );
+    free( caso->crudo );
+    free( caso->colores );
+    free( caso->indices );
+    free( caso->fila );
+    memset( caso, 0, sizeof( caso_bench ) );
+}
+
+void correr_leer_pixels( caso_bench *caso )
+{
+    decodificador_fila decodificar = decodificador_de( caso->imagen );
+    int32_t y;
+
+    for ( y = 0; y < caso->alto; y++ )
+        decodificar( caso->imagen, caso->crudo + ( size_t ) y * caso->fila_archivo,
+                     caso->colores + ( size_t ) y * caso->ancho );
+}
+
+void correr_grabar_pixels( caso_bench *caso )
+{
+    codificador_fila codificar = codificador_de( caso->imagen );
+    int32_t y;
+
+    for ( y = 0; y < caso->alto; y++ )
+        codificar( caso->imagen, caso->colores + ( size_t ) y * caso->ancho, caso->fila );
+}
+
+void correr_leer_indices( caso_bench *caso )
+{
+    decodificador_indices decodificar = decodificador_indices_de( caso->imagen );
+    int32_t y;
+
+    for ( y = 0; y < caso->alto; y++ )
+        decodificar( caso->imagen, caso->crudo + ( size_t ) y * caso->fila_archivo,
+                     caso->indices + ( size_t ) y * caso->ancho );
+}
+
+void correr_grabar_indices( caso_bench *caso )
+{
+    codificador_indices codificar = codificador_indices_de( caso->imagen );
+    int32_t y;
+
+    for ( y = 0; y < caso->alto; y++ )
+        codificar( caso->imagen, caso->indices + ( size_t ) y * caso->ancho, caso->fila );
+}
+
+void correr_rotar( caso_bench *caso )
+{
+    rotar( 1, caso->imagen );
+}
+
+void correr_flip( caso_bench *caso )
+{
+    flip_vertical( caso->imagen );
+}
+
+void correr_negativo( caso_bench *caso )
+{
+    negativo( caso->imagen );
+}
+
+void correr_blur( caso_bench *caso )
+{
+    blur( RADIO_BLUR, caso->imagen );
+}
+
+void correr_doble( caso_bench *caso )
+{
+    redimensionar2x( caso->imagen );
+}
+
+void correr_mitad( caso_bench *caso )
+{
+    redimensionar1_2x( caso->imagen );
+}
+
+void correr_bilineal( caso_bench *caso )
+{
+    redimensionar( caso->imagen, caso->ancho * 3 / 4, caso->alto * 3 / 4, FILTRO_BILINEAL );
+}
+
+void correr_lanczos( caso_bench *caso )
+{
+    redimensionar( caso->imagen, caso->ancho * 3 / 4, caso->alto * 3 / 4, FILTRO_LANCZOS );
+}
+
+void correr_lineas_h( caso_bench *caso )
+{
+    bmpcolor_t rojo = { 0, 0, 255, 0 };
+
+    addlineash( 2, 8, rojo, caso->imagen );
+}
+
+void correr_lineas_v( caso_bench *caso )
+{
+    bmpcolor_t rojo = { 0, 0, 255, 0 };
+
+    addlineasv( 2, 8, rojo, caso->imagen );
+}
+
+int comparar_tiempos( const void *a, const void *b )
+{
+    uint64_t x = *( const uint64_t * ) a, y = *( const uint64_t * ) b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Corre el núcleo "calentamiento" veces sin medir y "repeticiones"
+ * veces midiendo, y deja los tiempos ordenados en "tiempos".
+ */
+bool medir( const nucleo_bench *nucleo, caso_bench *caso,
+            uint32_t calentamiento, uint32_t repeticiones, uint64_t *tiempos )
+{
+    bmp_t *original = caso->imagen;
+    uint64_t inicio;
+    uint32_t i;
+
+    for ( i = 0; i < calentamiento + repeticiones; i++ )
+    {
+        if ( nucleo->modifica && ( caso->imagen = crear_imagen_archivo( caso->archivo ) ) == NULL )
+        {
+            caso->imagen = original;
+            return false;
+        }
+
+        inicio = reloj_ns( CLOCK_MONOTONIC );
+        nucleo->correr( caso );
+        if ( i >= calentamiento )
+            tiempos[i - calentamiento] = reloj_ns( CLOCK_MONOTONIC ) - inicio;
+
+        if ( nucleo->modifica )
+        {
+            destruir_bmp( caso->imagen );
+            caso->imagen = original;
+        }
+    }
+
+    qsort( tiempos, repeticiones, sizeof( uint64_t ), comparar_tiempos );
+    return true;
+}
+
+int main( int argc, char *argv[] )
+{
+    int32_t anchos[MAX_TAMANIOS] = { 1024, 4000 }, altos[MAX_TAMANIOS] = { 768, 3000 };
+    uint32_t ntamanios = 0, repeticiones = 5, calentamiento = 1, hilos = 0;
+    uint32_t t, b, k, r, primero = 1;
+    bool bpps[33] = { false }, hay_bpp = false, ok = true;
+    const char *nucleo = NULL, *salida = NULL;
+    char directorio[] = "/tmp/bench.XXXXXX", *p;
+    uint16_t bpp_caso;
+    uint64_t *tiempos, suma;
+    double pixels, mediana;
+    caso_bench caso;
+    FILE *json = stdout;
+    int i;
+
+    for ( i = 1; i < argc; i++ )
+    {
+        if ( strcmp( argv[i], "-t" ) == 0 && i + 1 < argc && ntamanios < MAX_TAMANIOS &&
+                sscanf( argv[i + 1], "%dx%d", &anchos[ntamanios], &altos[ntamanios] ) == 2 &&
+                anchos[ntamanios] > 0 && altos[ntamanios] > 0 )
+            ntamanios++, i++;
+        else if ( strcmp( argv[i], "-p" ) == 0 && i + 1 < argc )
+        {
+            for ( p = strtok( argv[++i], "," ); p != NULL; p = strtok( NULL, "," ) )
+                if ( atoi( p ) == 1 || atoi( p ) == 4 || atoi( p ) == 8 ||
+                        atoi( p ) == 16 || atoi( p ) == 24 || atoi( p ) == 32 )
+                    bpps[atoi( p )] = hay_bpp = true;
+        }
+        else if ( strcmp( argv[i], "-r" ) == 0 && i + 1 < argc && atoi( argv[i + 1] ) > 0 )
+            repeticiones = atoi( argv[++i] );
+        else if ( strcmp( argv[i], "-c" ) == 0 && i + 1 < argc && atoi( argv[i + 1] ) >= 0 )
+            calentamiento = atoi( argv[++i] );
+        else if ( strcmp( argv[i], "-j" ) == 0 && i + 1 < argc && atoi( argv[i + 1] ) > 0 )
+            hilos = atoi( argv[++i] );
+        else if ( strcmp( argv[i], "-k" ) == 0 && i + 1 < argc )
+            nucleo = argv[++i];
+        else if ( strcmp( argv[i], "-o" ) == 0 && i + 1 < argc )
+            salida = argv[++i];
+        else if ( strcmp( argv[i], "-H" ) == 0 )
+            usar_paginas_grandes( true );
+        else
+        {
+            fprintf( stderr, "Uso: %s [-t ANCHOxALTO]... [-p 1,4,8,16,24,32] [-r REPETICIONES] "
+                     "[-c CALENTAMIENTO] [-j HILOS] [-k NUCLEO] [-o SALIDA] [-H]\n", argv[0] );
+            return EXIT_FAILURE;
+        }
+    }
+    if ( ntamanios == 0 )
+        ntamanios = TAMANIOS_DEFECTO;
+    if ( !hay_bpp )
+        bpps[1] = bpps[8] = bpps[24] = true;
+
+    if ( salida != NULL && ( json = fopen( salida, "w" ) ) == NULL )
+    {
+        fprintf( stderr, "Error al abrir %s para escribir\n", salida );
+        return EXIT_FAILURE;
+    }
+    if ( ( tiempos = ( uint64_t * ) malloc( sizeof( uint64_t ) * repeticiones ) ) == NULL ||
+            mkdtemp( directorio ) == NULL || !pool_iniciar( hilos ) )
+    {
+        fprintf( stderr, "Error preparando el banco de pruebas\n" );
+        return EXIT_FAILURE;
+    }
+
+    fprintf( json, "{\n  \"hilos\": %u,\n  \"repeticiones\": %u,\n  \"calentamiento\": %u,\n"
+             "  \"resultados\": [", pool_hilos(), repeticiones, calentamiento );
+    fprintf( stderr, "%-15s %4s %11s %12s %10s %10s\n",
+             "nucleo", "bpp", "tamanio", "mediana ms", "ns/pixel", "MP/s" );
+
+    for ( t = 0; ok && t < ntamanios; t++ )
+    {
+        for ( b = 0; ok && b < sizeof( profundidades ) / sizeof( profundidades[0] ); b++ )
+        {
+            bpp_caso = profundidades[b];
+            if ( !bpps[bpp_caso] )
+                continue;
+            if ( !generar_caso( &caso, directorio, anchos[t], altos[t], bpp_caso ) )
+            {
+                ok = false;
+                break;
+            }
+            pixels = ( double ) caso.ancho * caso.alto;
+
+            for ( k = 0; k < CANT_NUCLEOS; k++ )
+            {
+                if ( nucleo != NULL && strcmp( nucleo, nucleos[k].nombre ) )
+                    continue;
+                if ( nucleos[k].solo_indexadas && bpp_caso > 8 )
+                    continue;
+                if ( !medir( &nucleos[k], &caso, calentamiento, repeticiones, tiempos ) )
+                {
+                    ok = false;
+                    break;
+                }
+
+                for ( r = 0, suma = 0; r < repeticiones; r++ )
+                    suma += tiempos[r];
+                mediana = repeticiones % 2 ? tiempos[repeticiones / 2]
+                          : ( tiempos[repeticiones / 2 - 1] + tiempos[repeticiones / 2] ) / 2.0;
+
+                fprintf( json, "%s\n    { \"nucleo\": \"%s\", \"bpp\": %u, \"ancho\": %d, \"alto\": %d, "
+                         "\"min_ns\": %llu, \"mediana_ns\": %.0f, \"media_ns\": %.0f, "
+                         "\"ns_pixel\": %.3f, \"mpix_s\": %.2f }",
+                         primero ? "" : ",", nucleos[k].nombre, bpp_caso, caso.ancho, caso.alto,
+                         ( unsigned long long ) tiempos[0], mediana, ( double ) suma / repeticiones,
+                         mediana / pixels, pixels / mediana * 1000.0 );
+                fprintf( stderr, "%-15s %4u %5dx%-5d %12.3f %10.3f %10.2f\n",
+                         nucleos[k].nombre, bpp_caso, caso.ancho, caso.alto,
+                         mediana / 1e6, mediana / pixels, pixels / mediana * 1000.0 );
+                primero = 0;
+            }
+            liberar_caso( &caso );
+        }
+    }
+
+    fprintf( json, "\n  ]\n}\n" );
+    if ( salida != NULL && fclose( json ) )
+    {
+        fprintf( stderr, "Error grabando %s\n", salida );
+        ok = false;
+    }
+
+    rmdir( directorio );
+    free( tiempos );
+    pool_destruir();
+    vaciar_reserva();
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
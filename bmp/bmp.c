@@ -12,486 +12,1083 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include "../headers/bmp.h"
+#include "../headers/bmp_interno.h"
+#include "../headers/pool.h"
+#include "../headers/simd.h"
+#include "../headers/reserva.h"
+#include "../headers/salida.h"
+#include "../headers/errores.h"
 #include <stdbool.h>
-#include <math.h>
 
 
 /*
- * Tipo para la paleta de colores, conteniendo una lista de colores
- * y la cantidad que son.
+ * Contexto del blur que comparten las bandas: la imágen original, la
+ * matriz destino, el radio y cuántos bytes de cada píxel se promedian
+ * (3, o 4 si la imágen tiene alpha).
  */
 typedef struct
 {
-    uint64_t cant;
-    bmpcolor_t *colores;
-} paleta_color;
+    const bmp_t  *imagen;
+    bmpcolor_t  **destino;
+    int64_t       rate;
+    uint32_t      canales;
+} contexto_blur;
 
+/*
+ * Lado de las teselas en que se divide la imágen para rotarla (en
+ * píxeles): una tesela de origen y su destino entran juntas en la caché
+ * L1. Dentro de cada tesela se mueven bloques de MICRO_ROTAR x
+ * MICRO_ROTAR píxeles, que el compilador mantiene en registros.
+ */
+#define TESELA_ROTAR 64
+#define MICRO_ROTAR  4
 
 /*
- * Tipo del Bitmap File Header, el MagicNumber está separado, para
- * que la estructura esté alineada y se pueda usar para leer
- * directamente y no campo a campo.
+ * Contexto de la rotación que comparten las bandas: la imágen original,
+ * la matriz destino (de colores o de índices, según la imágen) y
+ * cuántas veces se rota 90 grados.
  */
 typedef struct
 {
-    uint32_t filesz;
-    uint32_t reserved;
-    uint32_t bmp_offset;
-} bitmapfileheader;
+    const bmp_t  *imagen;
+    bmpcolor_t  **destino;
+    uint8_t     **destino_indices;
+    uint32_t      veces;
+} contexto_rotar;
 
 /*
- * Tipo para el Bitmap Info Header, contiene los datos con la
- * información del encabezado
+ * Contexto de las redimensiones y de la expansión a colores que
+ * comparten las bandas: la imágen original y la matriz destino.
  */
 typedef struct
 {
-    uint32_t header_sz;
-    int32_t width;
-    int32_t height;
-    uint16_t nplanes;
-    uint16_t bitspp;
-    uint32_t tipo_compres;
-    uint32_t bmp_bytesz;
-    int32_t hres;
-    int32_t vres;
-    uint32_t ncolores;
-    uint32_t n_colores_imp;
-} bitmapinfoheader;
+    const bmp_t  *imagen;
+    bmpcolor_t  **destino;
+    int32_t       ancho;
+} contexto_filas;
 
 /*
- * Tipo BMP. De esta forma se representa la imágen completa en la
- * memoria. Incluye un File header, un Info header, una paleta y
- * una matriz de colores. También se incluye el MagicNumber.
+ * Filas por banda en las operaciones en que todas las filas cuestan lo
+ * mismo: bandas chicas reparten mejor el trabajo entre los hilos.
  */
-struct bmp
-{
-    uint16_t magic;
-    bitmapfileheader fileheader;
-    bitmapinfoheader infoheader;
-    paleta_color      paleta;
-    bmpcolor_t         **pixels;
-};
+#define FILAS_BANDA 32
+
+/*
+ * Bytes de filas que se codifican antes de cada escritura al grabar una
+ * imágen desde la memoria.
+ */
+#define BLOQUE_SALIDA ( 4 << 20 )
 
 // ENCABEZADOS FUNCIONES
 
-uint8_t coloresde_paleta( const bmp_t *imagen, const bmpcolor_t color );
+bool tamanio_matriz_valido( const int32_t width, const int32_t height, size_t bytes_pixel );
 
-bool pintar_pixel( const bmp_t *const imagen,
-                   const uint32_t x,
-                   const uint32_t y,
-                   const uint8_t r,
-                   const uint8_t g,
-                   const uint8_t b );
+void grabar_pixels_1bpp( const bmp_t *imagen, const bmpcolor_t *origen, uint8_t *destino );
+
+void grabar_pixels_4bpp( const bmp_t *imagen, const bmpcolor_t *origen, uint8_t *destino );
+
+void grabar_pixels_8bpp( const bmp_t *imagen, const bmpcolor_t *origen, uint8_t *destino );
+
+void grabar_pixels_16bpp( const bmp_t *imagen, const bmpcolor_t *origen, uint8_t *destino );
+
+void grabar_pixels_24bpp( const bmp_t *imagen, const bmpcolor_t *origen, uint8_t *destino );
+
+void grabar_pixels_32bpp( const bmp_t *imagen, const bmpcolor_t *origen, uint8_t *destino );
+
+void leer_pixels_1bpp( const bmp_t *imagen, const uint8_t *origen, bmpcolor_t *destino );
+
+void leer_pixels_4bpp( const bmp_t *imagen, const uint8_t *origen, bmpcolor_t *destino );
+
+void leer_pixels_8bpp( const bmp_t *imagen, const uint8_t *origen, bmpcolor_t *destino );
+
+void leer_pixels_24bpp( const bmp_t *imagen, const uint8_t *origen, bmpcolor_t *destino );
+
+void leer_pixels_32bpp( const bmp_t *imagen, const uint8_t *origen, bmpcolor_t *destino );
 
-bool pintar_pixelcolor( const bmp_t *imagen,
-                        const uint32_t x,
-                        const uint32_t y,
-                        const bmpcolor_t color );
+void leer_pixels_mascaras( const bmp_t *imagen, const uint8_t *origen, bmpcolor_t *destino );
 
-bmpcolor_t promediopixels( bmpcolor_t **pixels,
-                           const int32_t ancho,
-                           const int32_t alto,
-                           const int32_t x,
-                           const int32_t y,
-                           const int32_t radio );
+void medir_mascara( uint32_t mascara, uint32_t *desplazamiento, uint32_t *bits );
 
-bool grabar_paleta( FILE *fbmp, const bmp_t *imagen );
+uint8_t extraer_canal( uint32_t pixel, uint32_t mascara, uint32_t desplazamiento, uint32_t bits );
 
-void liberar_pixels( const bmp_t *imagen );
+uint32_t guardar_canal( uint8_t valor, uint32_t desplazamiento, uint32_t bits );
 
-bool grabar_file_header( FILE *fbmp, bmp_t *imagen );
+bool mascaras_nativas( const bmp_t *imagen );
 
-bool grabar_info_header( FILE *fbmp, bmp_t *imagen );
+bool necesita_mascaras( const bmp_t *imagen );
 
-bool grabar_pixels_1bpp( bmp_t *imagen, FILE *fbmp, uint32_t alineada );
+bool leer_mascaras( fuente_bmp *fuente, bmp_t *imagen, uint32_t *leidos );
 
-bool grabar_pixels_8bpp( bmp_t *imagen, FILE *fbmp, uint32_t alineada );
+void leer_indices_1bpp( const bmp_t *imagen, const uint8_t *origen, uint8_t *destino );
 
-bool grabar_pixels_24bpp( bmp_t *imagen, FILE *fbmp, uint32_t alineada );
+void leer_indices_4bpp( const bmp_t *imagen, const uint8_t *origen, uint8_t *destino );
 
-bool leer_pixels_8bpp(   FILE *fbmp, bmp_t *imagen,
-                         const uint32_t fila_alineada );
+void leer_indices_8bpp( const bmp_t *imagen, const uint8_t *origen, uint8_t *destino );
 
-bool leer_pixels_24bpp(  FILE *fbmp,
-                         bmp_t *imagen,
-                         const uint32_t fila_alineada );
+void grabar_indices_1bpp( const bmp_t *imagen, const uint8_t *origen, uint8_t *destino );
 
-bmpcolor_t **crear_matriz_pixels(   const int32_t width,
-                                    const int32_t height );
+void grabar_indices_4bpp( const bmp_t *imagen, const uint8_t *origen, uint8_t *destino );
 
-bool leer_pixels(FILE *fbmp, bmp_t *imagen );
+void grabar_indices_8bpp( const bmp_t *imagen, const uint8_t *origen, uint8_t *destino );
+
+void intercambiar_filas( uint8_t *a, uint8_t *b, size_t bytes );
+
+void rotar_tesela_indices( const contexto_rotar *c,
+                           const int32_t i0, const int32_t i1,
+                           const int32_t j0, const int32_t j1 );
+
+void sumar_fila_horizontal( const bmpcolor_t *fila,
+                            const int64_t ancho,
+                            const int64_t rate,
+                            const uint32_t canales,
+                            uint32_t *sumas );
+
+void blur_banda( void *ctx, uint32_t desde, uint32_t hasta );
+
+void rotar_bloque( const contexto_rotar *c, const int32_t i, const int32_t j );
+
+void rotar_tesela( const contexto_rotar *c,
+                   const int32_t i0, const int32_t i1,
+                   const int32_t j0, const int32_t j1 );
+
+void rotar_banda( void *ctx, uint32_t desde, uint32_t hasta );
+
+void rotar180_banda( void *ctx, uint32_t desde, uint32_t hasta );
+
+void expandir_banda( void *ctx, uint32_t desde, uint32_t hasta );
+
+bool en_linea( const uint32_t pos, const uint32_t ancho, const uint32_t espacio );
+
+void negativo_fila( const bmp_t *const imagen, bmpcolor_t *fila );
+
+void lineasv_fila( uint32_t ancho,
+                   uint32_t espacio,
+                   bmpcolor_t color,
+                   const bmp_t *const imagen,
+                   bmpcolor_t *fila );
+
+void lineash_fila( uint32_t ancho,
+                   uint32_t espacio,
+                   bmpcolor_t color,
+                   const bmp_t *const imagen,
+                   const uint32_t y,
+                   bmpcolor_t *fila );
+
+void lineasv_indices( uint32_t ancho,
+                      uint32_t espacio,
+                      uint8_t indice,
+                      const bmp_t *const imagen,
+                      uint8_t *fila );
+
+void lineash_indices( uint32_t ancho,
+                      uint32_t espacio,
+                      uint8_t indice,
+                      const bmp_t *const imagen,
+                      const uint32_t y,
+                      uint8_t *fila );
+
+bool leer_pixels( fuente_bmp *fuente, bmp_t *imagen );
 
 // FIN ENCABEZADOS
 
 /*
- * Lee los píxeles de una imágen de 1BPP, y los guarda en la matriz
- * en memoria. Recibe el tamaño de cada fila de la imágen alineada
- * (incluyendo el padding)
+ * Decodifica una fila de una imágen de 1BPP (un bit por píxel, índice
+ * de la paleta) y la guarda como colores en destino.
  */
-bool leer_pixels_1bpp(   FILE *fbmp,
-                         bmp_t *imagen,
-                         uint32_t fila_alineada ) {
-    int i;
-    long x, y;
-    uint8_t *ptmp;
-    uint8_t  ctmp;
-    long   nshift;
-    int32_t contador, alto, ancho;
+void leer_pixels_1bpp( const bmp_t *imagen, const uint8_t *origen, bmpcolor_t *destino )
+{
+    long x, nshift;
+    int32_t ancho;
+    uint8_t ctmp;
 
-    uint8_t bufferfila[fila_alineada];
+    ancho = imagen->infoheader.width;
+    ctmp = *origen++;
 
-    alto = imagen->infoheader.height;
-    ancho  = imagen->infoheader.width;
-    contador  = alto;
+    for ( x = 0L, nshift = 8L; x < ancho; x++ ) /* COLUMNAS - ANCHO */
+    {
+        if ( !nshift )
+        {
+            nshift = 8L;
+            ctmp = *origen++;
+        }
 
-    i = -1;
-    y = ( alto - 1 );
+        destino[x] = imagen->paleta.colores[ ( ctmp >> --nshift ) & 1 ];
+    }
+}
 
-    for ( ; contador--; y += i )
+/*
+ * Decodifica una fila de una imágen de 4BPP (dos píxeles por byte, el
+ * primero en los bits altos) y la guarda como colores en destino. Los
+ * índices fuera de la paleta se toman como el primer color.
+ */
+void leer_pixels_4bpp( const bmp_t *imagen, const uint8_t *origen, bmpcolor_t *destino )
+{
+    int32_t x, ancho = imagen->infoheader.width;
+    uint8_t indice;
+
+    for ( x = 0; x < ancho; x++ )
     {
+        indice = ( origen[x >> 1] >> ( x & 1 ? 0 : 4 ) ) & 0x0F;
+        destino[x] = imagen->paleta.colores[indice < imagen->paleta.cant ? indice : 0];
+    }
+}
 
-        if ( fread( bufferfila, sizeof( uint8_t ), fila_alineada, fbmp ) != fila_alineada )
-        {
-            fprintf( stderr, "Error leyendo fila de pixeles.\n" );
-            return false;
-        }
+/*
+ * Decodifica una fila de una imágen de 8BPP (un byte por píxel, índice
+ * de la paleta) y la guarda como colores en destino.
+ */
+void leer_pixels_8bpp( const bmp_t *imagen, const uint8_t *origen, bmpcolor_t *destino )
+{
+    long x;
+    int32_t ancho = imagen->infoheader.width;
 
-        ptmp = bufferfila;
-        ctmp = *ptmp++;
+    for ( x = 0L; x < ancho; x++ )
+        destino[x] = imagen->paleta.colores[ *origen++ ];
+}
 
-        for ( x = 0L, nshift = 8L; x < ancho; x++ ) /* COLUMNAS - ANCHO */
-        {
-            if ( !nshift )
-            {
-                nshift = 8L;
-                ctmp = *ptmp++;
-            }
 
-            imagen->pixels[y][x] = imagen->paleta.colores[ ( ctmp >> --nshift ) & 1 ];
-        }
+/*
+ * Decodifica una fila de una imágen de 24BPP (azul, verde y rojo) y la
+ * guarda como colores en destino.
+ */
+void leer_pixels_24bpp( const bmp_t *imagen, const uint8_t *origen, bmpcolor_t *destino )
+{
+    expandir_bgr( origen, destino, imagen->infoheader.width );
+}
+
+/*
+ * Una fila de 32BPP con las máscaras de bmpcolor_t ya está en el formato
+ * de la matriz: se copia tal cual, con el alpha.
+ */
+void leer_pixels_32bpp( const bmp_t *imagen, const uint8_t *origen, bmpcolor_t *destino )
+{
+    memcpy( destino, origen, sizeof( bmpcolor_t ) * imagen->infoheader.width );
+}
+
+/*
+ * Calcula dónde empieza una máscara y cuántos bits tiene. Una máscara
+ * en 0 tiene 0 bits.
+ */
+void medir_mascara( uint32_t mascara, uint32_t *desplazamiento, uint32_t *bits )
+{
+    *desplazamiento = *bits = 0;
+    if ( !mascara )
+        return;
+
+    while ( !( mascara & 1 ) )
+    {
+        mascara >>= 1;
+        ( *desplazamiento )++;
+    }
+    while ( mascara & 1 )
+    {
+        mascara >>= 1;
+        ( *bits )++;
     }
+}
 
-    return true;
+/*
+ * Saca un canal del píxel con su máscara y lo lleva a 8 bits: si tiene
+ * más se descartan los de abajo, y si tiene menos se escala redondeando.
+ */
+uint8_t extraer_canal( uint32_t pixel, uint32_t mascara, uint32_t desplazamiento, uint32_t bits )
+{
+    uint32_t valor, maximo;
+
+    if ( !bits )
+        return 0;
+
+    valor = ( pixel & mascara ) >> desplazamiento;
+    if ( bits >= 8 )
+        return valor >> ( bits - 8 );
+
+    maximo = ( 1u << bits ) - 1;
+    return ( valor * 255 + maximo / 2 ) / maximo;
 }
 
 /*
- * Lee los píxeles de una imágen de 8BPP, y los guarda en la matriz
- * en memoria. Recibe el tamaño de cada fila de la imágen alineada
- * (incluyendo el padding)
+ * Lo contrario de extraer_canal: lleva un canal de 8 bits a los bits de
+ * su máscara, redondeando, y lo pone en su lugar.
  */
-bool leer_pixels_8bpp(   FILE *fbmp, bmp_t *imagen,
-                         const uint32_t fila_alineada ) {
-    int32_t i;
-    long x, y;
-    int32_t height, width, contador;
-    uint8_t *ptmp;
+uint32_t guardar_canal( uint8_t valor, uint32_t desplazamiento, uint32_t bits )
+{
+    uint32_t maximo;
 
-    uint8_t bufferfila[fila_alineada];
+    if ( !bits )
+        return 0;
+    if ( bits >= 8 )
+        return ( uint32_t ) valor << ( bits - 8 ) << desplazamiento;
+
+    maximo = ( 1u << bits ) - 1;
+    return ( ( valor * maximo + 127 ) / 255 ) << desplazamiento;
+}
+
+/*
+ * Decodifica una fila de 16 o 32BPP con máscaras cualquiera (las de
+ * BI_BITFIELDS, o RGB555 en 16BPP), canal por canal.
+ */
+void leer_pixels_mascaras( const bmp_t *imagen, const uint8_t *origen, bmpcolor_t *destino )
+{
+    uint32_t desplazamiento[4], bits[4], pixel, c, bytes;
+    const uint32_t *m = imagen->mascaras;
+    int32_t x, ancho = imagen->infoheader.width;
 
-    height = imagen->infoheader.height;
-    width  = imagen->infoheader.width;
-    contador  = height;
+    for ( c = 0; c < 4; c++ )
+        medir_mascara( m[c], &desplazamiento[c], &bits[c] );
 
-    i = -1;
-    y = ( height - 1 );
-    for ( ; contador--; y += i ) /* bucle para las filas */
+    bytes = imagen->infoheader.bitspp / 8;
+    for ( x = 0; x < ancho; x++, origen += bytes )
     {
-        /* leer la fila */
-        if ( fread( bufferfila, sizeof( uint8_t ), fila_alineada, fbmp ) != fila_alineada )
-        {
-            fprintf( stderr, "Error leyendo fila de pixeles.\n" );
-            return false;
-            /*liberar matriz*/
-        }
-        ptmp = bufferfila;
+        pixel = 0;
+        memcpy( &pixel, origen, bytes );
+        destino[x].red   = extraer_canal( pixel, m[0], desplazamiento[0], bits[0] );
+        destino[x].green = extraer_canal( pixel, m[1], desplazamiento[1], bits[1] );
+        destino[x].blue  = extraer_canal( pixel, m[2], desplazamiento[2], bits[2] );
+        destino[x].alpha = extraer_canal( pixel, m[3], desplazamiento[3], bits[3] );
+    }
+}
 
-        for ( x = 0L; x < width; x++ )
-        {
-            imagen->pixels[y][x] = imagen->paleta.colores[ *ptmp++ ];
-        }
+/*
+ * Devuelve true si las máscaras de la imágen son las de bmpcolor_t, con
+ * o sin alpha: los píxeles se pueden copiar sin convertir.
+ */
+bool mascaras_nativas( const bmp_t *imagen )
+{
+    return imagen->mascaras[0] == MASCARA_ROJO &&
+           imagen->mascaras[1] == MASCARA_VERDE &&
+           imagen->mascaras[2] == MASCARA_AZUL &&
+           ( imagen->mascaras[3] == 0 || imagen->mascaras[3] == MASCARA_ALFA );
+}
 
+/*
+ * Devuelve true si las máscaras tienen que ir en el archivo: 32BPP con
+ * alpha, o 16BPP con otras que no sean RGB555.
+ */
+bool necesita_mascaras( const bmp_t *imagen )
+{
+    if ( tiene_alfa( imagen ) )
+        return true;
+    return imagen->infoheader.bitspp == 16 &&
+           ( imagen->mascaras[0] != MASCARA_ROJO_555 ||
+             imagen->mascaras[1] != MASCARA_VERDE_555 ||
+             imagen->mascaras[2] != MASCARA_AZUL_16 );
+}
+
+/*
+ * Devuelve la función que decodifica una fila según los BPP de la
+ * imágen, o NULL si no está soportada.
+ */
+decodificador_fila decodificador_de( const bmp_t *imagen )
+{
+    switch ( imagen->infoheader.bitspp )
+    {
+    case 1:
+        return leer_pixels_1bpp;
+    case 4:
+        return leer_pixels_4bpp;
+    case 8:
+        return leer_pixels_8bpp;
+    case 16:
+        return leer_pixels_mascaras;
+    case 24:
+        return leer_pixels_24bpp;
+    case 32:
+        return mascaras_nativas( imagen ) ? leer_pixels_32bpp : leer_pixels_mascaras;
     }
+    return NULL;
+}
 
-    return true;
+/*
+ * Pasa una fila de una imágen de 1BPP a un byte por píxel.
+ */
+void leer_indices_1bpp( const bmp_t *imagen, const uint8_t *origen, uint8_t *destino )
+{
+    int32_t x, ancho = imagen->infoheader.width;
+
+    for ( x = 0; x < ancho; x++ )
+        destino[x] = ( origen[x >> 3] >> ( 7 - ( x & 7 ) ) ) & 1;
 }
 
+/*
+ * Pasa una fila de una imágen de 4BPP a un byte por píxel.
+ */
+void leer_indices_4bpp( const bmp_t *imagen, const uint8_t *origen, uint8_t *destino )
+{
+    int32_t x, ancho = imagen->infoheader.width;
+
+    for ( x = 0; x + 1 < ancho; x += 2, origen++ )
+    {
+        destino[x] = *origen >> 4;
+        destino[x + 1] = *origen & 0x0F;
+    }
+    if ( x < ancho )
+        destino[x] = *origen >> 4;
+}
 
 /*
- * Lee los píxeles de una imágen de 24BPP, y los guarda en la matriz
- * en memoria. Recibe el tamaño de cada fila de la imágen alineada
- * (incluyendo el padding)
+ * Una fila de 8BPP ya tiene un byte por píxel.
  */
-bool leer_pixels_24bpp(  FILE *fbmp,
-                         bmp_t *imagen,
-                         const uint32_t fila_alineada ) {
-    int32_t i;
-    long x, y;
-    int32_t contador, height, width;
-    uint8_t *ptmp;
+void leer_indices_8bpp( const bmp_t *imagen, const uint8_t *origen, uint8_t *destino )
+{
+    memcpy( destino, origen, imagen->infoheader.width );
+}
 
-    uint8_t bufferfila[fila_alineada];
+/*
+ * Devuelve la función que pasa una fila del archivo a índices, o NULL
+ * si la imágen no tiene paleta.
+ */
+decodificador_indices decodificador_indices_de( const bmp_t *imagen )
+{
+    switch ( imagen->infoheader.bitspp )
+    {
+    case 1:
+        return leer_indices_1bpp;
+    case 4:
+        return leer_indices_4bpp;
+    case 8:
+        return leer_indices_8bpp;
+    }
+    return NULL;
+}
+
+bool es_indexada( const bmp_t *imagen )
+{
+    return imagen->indices != NULL;
+}
 
-    height = imagen->infoheader.height;
-    width  = imagen->infoheader.width;
-    contador  = height;
+bool tiene_alfa( const bmp_t *imagen )
+{
+    return ( imagen->infoheader.bitspp == 16 || imagen->infoheader.bitspp == 32 ) &&
+           imagen->mascaras[3] != 0;
+}
 
-    i = -1;
-    y = ( height - 1 );
+/*
+ * Devuelve el tamaño en bytes de una fila en el archivo, con el
+ * padding a múltiplo de 4 bytes.
+ */
+uint32_t calcular_fila_alineada( const int32_t width, const uint16_t bitspp )
+{
+    uint64_t bitsxfila;
 
-    for ( ; contador--; y += i ) /* bucle para las filas */
+    //Cantidad de bits por fila que va a tener el bmp
+    bitsxfila = ( uint64_t ) width * bitspp;
+    //Se redondea a múltiplo de 32
+    if ( bitsxfila % 32 )
     {
-        /* leer la fila */
-        if ( fread( bufferfila, sizeof( uint8_t ), fila_alineada, fbmp ) != fila_alineada )
-        {
-            fprintf( stderr, "Error leyendo fila de pixeles.\n" );
-            return false;
-            /* liberar matriz */
-        }
+        bitsxfila += 32 - ( bitsxfila % 32 );
+    }
+    /* expresar el tamaño en BYTES */
+    return bitsxfila / 8UL;
+}
 
-        ptmp = bufferfila;
-        bmpcolor_t color;
-        for ( x = 0L; x < width; x++ )
-        {
-            color.blue  = *ptmp++;
-            color.green = *ptmp++;
-            color.red   = *ptmp++;
-            color.alpha = 0;
+/*
+ * Controla el tamaño de una matriz antes de alocarla: ni el ancho ni el
+ * alto pueden ser negativos, y las filas (redondeadas a la alineación)
+ * por el alto tienen que entrar en un size_t.
+ */
+bool tamanio_matriz_valido( const int32_t width, const int32_t height, size_t bytes_pixel )
+{
+    size_t bytesfila;
 
-            imagen->pixels[y][x] = color;
-        }
+    if ( width < 0 || height < 0 )
+    {
+        fprintf( salida_errores(), "Error: tamaño de imagen incorrecto (%dx%d)\n", width, height );
+        return false;
     }
 
+    bytesfila = ( size_t ) width * bytes_pixel + ALINEACION_PIXELS;
+    if ( height && bytesfila > SIZE_MAX / ( size_t ) height )
+    {
+        fprintf( salida_errores(), "Error: la imagen de %dx%d no entra en memoria\n", width, height );
+        return false;
+    }
     return true;
 }
 
 /*
  * Aloca memoria para la matriz de píxeles de la imágen en memoria.
- * Recibe el alto y el ancho que debe tener dicha matriz.
+ * Recibe el alto y el ancho que debe tener dicha matriz. Se hace una
+ * sola alocación alineada a línea de caché para todos los píxeles, y
+ * otra para la vista de punteros a filas.
  */
-bmpcolor_t **crear_matriz_pixels(   const int32_t width,
-                                    const int32_t height ) {
-    bmpcolor_t **pixels = NULL;
-    int i;
+bool crear_matriz_pixels( matriz_pixels *matriz,
+                          const int32_t width,
+                          const int32_t height ) {
+    size_t bytesfila, total;
+    int32_t i;
+
+    if ( !tamanio_matriz_valido( width, height, sizeof( bmpcolor_t ) ) )
+        return false;
+
+    /* redondear cada fila a múltiplo de la línea de caché */
+    bytesfila = ( size_t ) width * sizeof( bmpcolor_t );
+    if ( bytesfila % ALINEACION_PIXELS )
+        bytesfila += ALINEACION_PIXELS - ( bytesfila % ALINEACION_PIXELS );
+
+    total = bytesfila * ( size_t ) height;
+    if ( !total )
+        total = ALINEACION_PIXELS;
 
-    /* alocar memoria para el arreglo de filas */
-    pixels = ( bmpcolor_t ** ) malloc( sizeof( bmpcolor_t * ) * height );
-    if ( pixels == NULL )
+    /* el bloque se toma de la reserva, si quedó uno de otra matriz */
+    matriz->stride = bytesfila / sizeof( bmpcolor_t );
+    matriz->datos = ( bmpcolor_t * ) reservar_bloque( total );
+    if ( matriz->datos == NULL )
     {
-        fprintf( stderr, "Error alocando memoria para el arreglo de filas\n" );
-        return NULL;
+        fprintf( salida_errores(), "Error alocando memoria para los pixels\n" );
+        return false;
     }
 
-    /* alocar memoria para cada fila */
-    for ( i = 0; i <  height; i++ )
+    /* alocar memoria para la vista de filas */
+    matriz->pixels = ( bmpcolor_t ** ) malloc( sizeof( bmpcolor_t * ) * ( height ? height : 1 ) );
+    if ( matriz->pixels == NULL )
     {
-        pixels[i] = ( bmpcolor_t * ) malloc( sizeof( bmpcolor_t ) *  width );
-        if ( pixels[i] == NULL )
-            break;
+        devolver_bloque( matriz->datos );
+        matriz->datos = NULL;
+        fprintf( salida_errores(), "Error alocando memoria para el arreglo de filas\n" );
+        return false;
     }
 
-    /* si salimos de alocar filas por error de memoria, debemos liberar */
-    if ( i < height )
-    {
-        while ( i )
-        {
-            free( pixels[--i] );
-        }
+    for ( i = 0; i < height; i++ )
+        matriz->pixels[i] = matriz->datos + ( size_t ) i * matriz->stride;
 
-        free( pixels );
-        fprintf( stderr, "Error alocando memoria para las filas\n" );
+    return true;
+}
 
-        return NULL;
+/*
+ * Libera una matriz de píxeles creada con crear_matriz_pixels.
+ */
+void liberar_matriz( matriz_pixels *matriz )
+{
+    free( matriz->pixels );
+    devolver_bloque( matriz->datos );
+    matriz->pixels = NULL;
+    matriz->datos = NULL;
+}
+
+/*
+ * Libera la matriz actual de la imágen y la reemplaza por la recibida,
+ * actualizando el ancho y el alto.
+ */
+void reemplazar_pixels( bmp_t *imagen,
+                        matriz_pixels *matriz,
+                        const int32_t width,
+                        const int32_t height )
+{
+    liberar_pixels( imagen );
+
+    imagen->datos  = matriz->datos;
+    imagen->pixels = matriz->pixels;
+    imagen->stride = matriz->stride;
+    imagen->infoheader.width  = width;
+    imagen->infoheader.height = height;
+}
+
+/*
+ * Aloca una matriz de índices, un byte por píxel, con las filas
+ * alineadas igual que en crear_matriz_pixels.
+ */
+bool crear_matriz_indices( matriz_indices *matriz,
+                           const int32_t width,
+                           const int32_t height )
+{
+    size_t bytesfila, total;
+    int32_t i;
+
+    if ( !tamanio_matriz_valido( width, height, 1 ) )
+        return false;
+
+    bytesfila = ( size_t ) width;
+    if ( bytesfila % ALINEACION_PIXELS )
+        bytesfila += ALINEACION_PIXELS - ( bytesfila % ALINEACION_PIXELS );
+
+    total = bytesfila * ( size_t ) height;
+    if ( !total )
+        total = ALINEACION_PIXELS;
+
+    matriz->stride = bytesfila;
+    matriz->datos = ( uint8_t * ) reservar_bloque( total );
+    if ( matriz->datos == NULL )
+    {
+        fprintf( salida_errores(), "Error alocando memoria para los pixels\n" );
+        return false;
+    }
+
+    matriz->filas = ( uint8_t ** ) malloc( sizeof( uint8_t * ) * ( height ? height : 1 ) );
+    if ( matriz->filas == NULL )
+    {
+        devolver_bloque( matriz->datos );
+        matriz->datos = NULL;
+        fprintf( salida_errores(), "Error alocando memoria para el arreglo de filas\n" );
+        return false;
     }
 
-    return pixels;
+    for ( i = 0; i < height; i++ )
+        matriz->filas[i] = matriz->datos + ( size_t ) i * matriz->stride;
+
+    return true;
 }
 
-/*Operaciones necesarias antes de leer los pixels, como el cálculo del
- * tamaño de la fila alineada, el llamado a la alocación de memoria para
- * la matriz, y luego el switch de
- * 1, 8 o 24 bits por pixels, dependiendo la imágen.
-*/
-bool leer_pixels(FILE *fbmp, bmp_t *imagen ) {
-    long fila_alineada;
-    long bitsxfila;
+/*
+ * Libera una matriz creada con crear_matriz_indices.
+ */
+void liberar_matriz_indices( matriz_indices *matriz )
+{
+    free( matriz->filas );
+    devolver_bloque( matriz->datos );
+    matriz->filas = NULL;
+    matriz->datos = NULL;
+}
 
-    //Cantidad de bits por fila que va a tener el bmp
-    bitsxfila = imagen->infoheader.width * imagen->infoheader.bitspp;
-    //Se redondea a múltiplo de 32
-    if ( bitsxfila % 32 )
+/*
+ * Igual que reemplazar_pixels, para una imágen indexada.
+ */
+void reemplazar_indices( bmp_t *imagen,
+                         matriz_indices *matriz,
+                         const int32_t width,
+                         const int32_t height )
+{
+    liberar_pixels( imagen );
+
+    imagen->indices = matriz->datos;
+    imagen->filas   = matriz->filas;
+    imagen->stride_indices = matriz->stride;
+    imagen->infoheader.width  = width;
+    imagen->infoheader.height = height;
+}
+
+/*
+ * Pasa una imágen indexada a colores. Los índices fuera de la paleta
+ * se toman como el primer color.
+ */
+void expandir_banda( void *ctx, uint32_t desde, uint32_t hasta )
+{
+    const contexto_filas *c = ( const contexto_filas * ) ctx;
+    const bmp_t *imagen = c->imagen;
+    int32_t x;
+    uint32_t y;
+    const uint8_t *fila;
+    bmpcolor_t *colores;
+
+    for ( y = desde; y < hasta; y++ )
     {
-        bitsxfila += 32 - ( bitsxfila % 32 );
+        fila = imagen->filas[y];
+        colores = c->destino[y];
+        for ( x = 0; x < c->ancho; x++ )
+            colores[x] = imagen->paleta.colores[fila[x] < imagen->paleta.cant ? fila[x] : 0];
     }
-    /* expresar el tamaño en BYTES */
-    fila_alineada = bitsxfila / 8UL;
+}
+
+bool expandir_a_colores( bmp_t *imagen )
+{
+    int32_t ancho, alto;
+    contexto_filas ctx;
+
+    if ( !es_indexada( imagen ) )
+        return true;
+
+    ancho = imagen->infoheader.width;
+    alto  = imagen->infoheader.height;
+
+    matriz_pixels matriz;
+    if ( !crear_matriz_pixels( &matriz, ancho, alto ) )
+        return false;
+
+    ctx.imagen  = imagen;
+    ctx.destino = matriz.pixels;
+    ctx.ancho   = ancho;
+    pool_paralelo( alto, FILAS_BANDA, expandir_banda, &ctx );
+
+    reemplazar_pixels( imagen, &matriz, ancho, alto );
+    return true;
+}
 
+/*Operaciones necesarias antes de leer los pixels, como el cálculo del
+ * tamaño de la fila alineada y el llamado a la alocación de memoria
+ * para la matriz. Luego se decodifica cada fila del archivo con la
+ * función que corresponda a los bits por pixel de la imágen.
+*/
+bool leer_pixels(fuente_bmp *fuente, bmp_t *imagen ) {
+    uint32_t fila_alineada;
+    int32_t y;
+    const uint8_t *bufferfila;
+    decodificador_fila decodificar = decodificador_de( imagen );
 
+    /* las comprimidas no tienen filas de tamaño fijo */
+    if ( !legible_por_filas( imagen ) )
+        return leer_rle( fuente, imagen );
+
+    fila_alineada = calcular_fila_alineada( imagen->infoheader.width,
+                                            imagen->infoheader.bitspp );
 
     // Controlar
-    if ( imagen->infoheader.bmp_bytesz != ( bitsxfila * imagen->infoheader.height ) / 8UL )
+    if ( imagen->infoheader.bmp_bytesz != ( uint64_t ) fila_alineada * imagen->infoheader.height )
     {
         /* se debe comparar esto con la información guardada en el info-header */
-        fprintf( stderr, "El tamaño del arreglo de pixeles no coincide\n" );
+        fprintf( salida_errores(), "El tamaño del arreglo de pixeles no coincide\n" );
         return false;
     }
 
-    /* alocar memoria para el arreglo de filas */
-    imagen->pixels = crear_matriz_pixels( imagen->infoheader.width, imagen->infoheader.height );
-    if ( imagen->pixels == NULL )
+    /* las imágenes con paleta se guardan como índices */
+    decodificador_indices decodificar_indices = decodificador_indices_de( imagen );
+    if ( decodificar_indices != NULL )
     {
-        fprintf( stderr, "Error alocando memoria para el arreglo de filas\n" );
-        return false;
-    }
-
-    switch(imagen->infoheader.bitspp) {
-    case 1: {
-        if(!leer_pixels_1bpp(fbmp, imagen, fila_alineada )) {
-            fprintf( stderr, "Error leyendo los pixels del archivo \n");
+        matriz_indices indices;
+        if ( !crear_matriz_indices( &indices, imagen->infoheader.width, imagen->infoheader.height ) )
             return false;
+        imagen->indices = indices.datos;
+        imagen->filas   = indices.filas;
+        imagen->stride_indices = indices.stride;
+
+        for ( y = imagen->infoheader.height - 1; y >= 0; y-- )
+        {
+            if ( ( bufferfila = leer_fuente( fuente, fila_alineada ) ) == NULL )
+            {
+                fprintf( salida_errores(), "Error leyendo fila de pixeles.\n" );
+                return false;
+            }
+
+            decodificar_indices( imagen, bufferfila, imagen->filas[y] );
         }
-        break;
+        return true;
     }
-    case 8: {
-        if(!leer_pixels_8bpp(fbmp, imagen, fila_alineada )) {
-            fprintf( stderr, "Error leyendo los pixels del archivo \n");
-            return false;
-        }
-        break;
+
+    /* alocar memoria para la matriz */
+    matriz_pixels matriz;
+    if ( !crear_matriz_pixels( &matriz, imagen->infoheader.width, imagen->infoheader.height ) )
+    {
+        fprintf( salida_errores(), "Error alocando memoria para el arreglo de filas\n" );
+        return false;
     }
-    case 24: {
-        if(!leer_pixels_24bpp(fbmp, imagen, fila_alineada )) {
-            fprintf( stderr, "Error leyendo los pixels del archivo \n");
+    imagen->datos  = matriz.datos;
+    imagen->pixels = matriz.pixels;
+    imagen->stride = matriz.stride;
+
+    /* las filas están guardadas de abajo hacia arriba */
+    for ( y = imagen->infoheader.height - 1; y >= 0; y-- )
+    {
+        if ( ( bufferfila = leer_fuente( fuente, fila_alineada ) ) == NULL )
+        {
+            fprintf( salida_errores(), "Error leyendo fila de pixeles.\n" );
             return false;
         }
-        break;
+
+        decodificar( imagen, bufferfila, imagen->pixels[y] );
     }
-    } // switch
+
     return true;
 } // end leer pixels general
 
 
-
-/* Crea un bmp_t en la memoria a partir de un archivo .bmp, recibido
- * como parámetro bajo el nombre de filename.
-*/
-bmp_t *crear_imagen_archivo( const char *filename )
+/*
+ * Lee el magic number, los headers y la paleta desde la fuente, y
+ * devuelve la imágen sin píxeles, con la fuente posicionada al
+ * comienzo del arreglo de píxeles.
+ */
+/*
+ * Lee lo que queda del info header, si es más largo que el de 40 bytes,
+ * y en 32 BPP deja en la imágen las máscaras de los canales: las de
+ * bmpcolor_t sin alpha si es BI_RGB, las del header si es de 52 bytes o
+ * más, o si no las que vienen después del header. Suma a "leidos" los
+ * bytes que consume de la fuente.
+ */
+bool leer_mascaras( fuente_bmp *fuente, bmp_t *imagen, uint32_t *leidos )
 {
-    FILE *fbmp;
-    if( (fbmp = fopen (filename, "r")) == NULL) {
-        fprintf( stderr, "Error al abrir el archivo\n");
-        return NULL;
+    const bitmapinfoheader *bih = &imagen->infoheader;
+    const uint8_t *resto = NULL;
+    uint32_t extra, cant;
+
+    extra = bih->header_sz - sizeof( bitmapinfoheader );
+    if ( extra && ( resto = leer_fuente( fuente, extra ) ) == NULL )
+    {
+        fprintf( salida_errores(), "Error al leer el bitmap info header\n" );
+        return false;
     }
+    *leidos += extra;
+
+    if ( bih->bitspp != 16 && bih->bitspp != 32 )
+        return true;
+
+    if ( bih->tipo_compres == BI_RGB && bih->bitspp == 16 )
+    {
+        imagen->mascaras[0] = MASCARA_ROJO_555;
+        imagen->mascaras[1] = MASCARA_VERDE_555;
+        imagen->mascaras[2] = MASCARA_AZUL_16;
+        imagen->mascaras[3] = 0;
+        return true;
+    }
+    if ( bih->tipo_compres == BI_RGB )
+    {
+        imagen->mascaras[0] = MASCARA_ROJO;
+        imagen->mascaras[1] = MASCARA_VERDE;
+        imagen->mascaras[2] = MASCARA_AZUL;
+        imagen->mascaras[3] = 0;
+        return true;
+    }
+
+    /* rojo, verde y azul; el alpha sólo con BI_ALPHABITFIELDS o en el header */
+    cant = bih->tipo_compres == BI_ALPHABITFIELDS ? 4 : 3;
+    if ( extra >= 3 * sizeof( uint32_t ) )
+        memcpy( imagen->mascaras, resto,
+                extra >= 4 * sizeof( uint32_t ) ? 4 * sizeof( uint32_t ) : 3 * sizeof( uint32_t ) );
+    else
+    {
+        if ( !copiar_fuente( fuente, imagen->mascaras, cant * sizeof( uint32_t ) ) )
+        {
+            fprintf( salida_errores(), "Error al leer las mascaras de color\n" );
+            return false;
+        }
+        *leidos += cant * sizeof( uint32_t );
+    }
+
+    if ( !imagen->mascaras[0] || !imagen->mascaras[1] || !imagen->mascaras[2] ||
+            ( bih->bitspp == 16 && ( ( imagen->mascaras[0] | imagen->mascaras[1] |
+                                       imagen->mascaras[2] | imagen->mascaras[3] ) >> 16 ) ) )
+    {
+        fprintf( salida_errores(), "Error: mascaras de color invalidas\n" );
+        return false;
+    }
+    return true;
+}
 
+bmp_t *leer_encabezados( fuente_bmp *fuente, const char *filename )
+{
     // Lectura MAGIC NUMBER del BMP
     uint16_t magic;
+    uint32_t leidos;
 
-    if ( fread( &magic, sizeof( uint16_t ), 1, fbmp ) != 1  )
+    if ( !copiar_fuente( fuente, &magic, sizeof( uint16_t ) ) )
     {
-        fprintf( stderr, "No se pudo leer el magic number de %s\n", filename );
-        fclose(fbmp); // Se cierra el archivo
+        fprintf( salida_errores(), "No se pudo leer el magic number de %s\n", filename );
         return NULL;
     }
 
     // Si no es un BMP, no se sigue procesando.
     if ( magic != 0x4d42 )
     {
-        fprintf( stderr, "El archivo %s NO es un BMP\n", filename );
-        fclose(fbmp); // Se cierra el archivo
+        fprintf( salida_errores(), "El archivo %s NO es un BMP\n", filename );
         return NULL;
     }
 
     // Lectura bit map file header
     bitmapfileheader bfh;
-    if ( fread ( &bfh, sizeof ( bfh ), 1, fbmp) != 1)
+    if ( !copiar_fuente( fuente, &bfh, sizeof ( bfh ) ) )
     {
-        fprintf( stderr, "Error al leer el bitmap file header de %s\n", filename);
-        fclose(fbmp); // Se cierra el archivo
+        fprintf( salida_errores(), "Error al leer el bitmap file header de %s\n", filename);
         return NULL;
     }
 
     // Lecutra bit map info header
     bitmapinfoheader bih;
-    if ( fread ( &bih, sizeof ( bih ), 1, fbmp) != 1)
+    if ( !copiar_fuente( fuente, &bih, sizeof ( bih ) ) )
     {
-        fprintf( stderr, "Error al leer el bitmap info header de %s\n",
+        fprintf( salida_errores(), "Error al leer el bitmap info header de %s\n",
                  filename);
-        fclose(fbmp);
         return NULL;
     }
 
-    // Verificar que sea de 1, 8 o 24 bpp
-    if (bih.bitspp != 1 && bih.bitspp != 8 && bih.bitspp != 24)
+    // Verificar que sea de 1, 4, 8, 16, 24 o 32 bpp
+    if (bih.bitspp != 1 && bih.bitspp != 4 && bih.bitspp != 8 && bih.bitspp != 16 &&
+            bih.bitspp != 24 && bih.bitspp != 32)
+    {
+        fprintf( salida_errores(), "Error: imagen no soportada, BPP invalido" );
+        return NULL;
+    }
+
+    // Sin compresión, salvo las máscaras de 16 y 32 bpp y RLE en 8 y 4 bpp
+    if ( bih.tipo_compres != BI_RGB &&
+            !( bih.bitspp == 8 && bih.tipo_compres == BI_RLE8 ) &&
+            !( bih.bitspp == 4 && bih.tipo_compres == BI_RLE4 ) &&
+            !( ( bih.bitspp == 16 || bih.bitspp == 32 ) &&
+               ( bih.tipo_compres == BI_BITFIELDS || bih.tipo_compres == BI_ALPHABITFIELDS ) ) )
+    {
+        fprintf( salida_errores(), "Error: imagen no soportada, compresion %u\n", bih.tipo_compres );
+        return NULL;
+    }
+
+    if ( bih.header_sz < sizeof( bih ) )
     {
-        fprintf( stderr, "Error: imagen no soportada, BPP invalido" );
-        fclose(fbmp);
+        fprintf( salida_errores(), "Error: imagen no soportada, info header de %u bytes\n", bih.header_sz );
         return NULL;
     }
 
     // Creo la variable bmp, ya que el archivo es válido
     bmp_t *imagen;
-    imagen = ( bmp_t* ) malloc ( sizeof ( bmp_t) );
+    imagen = ( bmp_t* ) calloc ( 1, sizeof ( bmp_t) );
     if ( imagen == NULL ) {
-        fprintf( stderr, "Error al alocar memoria para la imagen");
-        fclose(fbmp);
+        fprintf( salida_errores(), "Error al alocar memoria para la imagen");
         return NULL;
     }
     imagen->magic = magic;
     imagen->infoheader = bih;
     imagen->fileheader = bfh;
+    imagen->rle = bih.tipo_compres == BI_RLE8 || bih.tipo_compres == BI_RLE4;
+
+    leidos = sizeof( magic ) + sizeof( bfh ) + sizeof( bih );
+    if ( !leer_mascaras( fuente, imagen, &leidos ) )
+    {
+        free( imagen );
+        return NULL;
+    }
 
-    // Si es de 1 o 8 bpp, hay que leer la paleta
-    if ( bih.bitspp  == 1 || bih.bitspp == 8 )
+    // Si es de 1, 4 u 8 bpp, hay que leer la paleta
+    if ( bih.bitspp <= 8 )
     {
         uint32_t ncolores;
         if ( bih.ncolores ) // Si el info header tiene la cantidad de colores, la usamos, si no, se calcula por el else
             ncolores = bih.ncolores;
         else
             ncolores = 1 << bih.bitspp; // Igual a 2^BPP
+        // Un índice más grande no entraría en los bits de cada píxel
+        if ( ncolores > 1u << bih.bitspp )
+        {
+            fprintf( salida_errores(), "Error: la paleta tiene %u colores\n", ncolores );
+            free( imagen );
+            return NULL;
+        }
         imagen->paleta.colores = ( bmpcolor_t * ) malloc( sizeof( bmpcolor_t ) * ncolores );
         if ( imagen->paleta.colores == NULL ) {
-            fprintf( stderr, "Error al alocar memoria para la paleta de colores");
-            fclose(fbmp); // Se cierra el archivo
+            fprintf( salida_errores(), "Error al alocar memoria para la paleta de colores");
+            free( imagen );
             return NULL;
         }
 
         // Leo la paleta y la guardo donde aloqué la memoria
-        if ( fread( imagen->paleta.colores, sizeof( bmpcolor_t ), ncolores, fbmp ) != ncolores  )
+        if ( !copiar_fuente( fuente, imagen->paleta.colores, sizeof( bmpcolor_t ) * ncolores ) )
         {
             // Si falla al leer, liberamos lo alocado
-            fprintf( stderr, "Error al leer la paleta");
+            fprintf( salida_errores(), "Error al leer la paleta");
             free( imagen->paleta.colores );
-            imagen->paleta.colores = NULL;
-            fclose(fbmp); // Se cierra el archivo
+            free( imagen );
             return NULL;
         }
         imagen->paleta.cant = ncolores;
+        leidos += sizeof( bmpcolor_t ) * ncolores;
+
+        // Índice inverso para volver de color a índice al grabar
+        imagen->indice = crear_indice_paleta( imagen->paleta.colores, ncolores );
+        if ( imagen->indice == NULL ) {
+            fprintf( salida_errores(), "Error al alocar memoria para el indice de la paleta");
+            free( imagen->paleta.colores );
+            free( imagen );
+            return NULL;
+        }
 
     } // Termina leer paleta
-    // Lectura pixels --->
 
-    if ( !leer_pixels( fbmp, imagen ) )
+    // Los píxeles empiezan en bmp_offset: puede haber un hueco antes
+    if ( bfh.bmp_offset > leidos &&
+            leer_fuente( fuente, bfh.bmp_offset - leidos ) == NULL )
     {
-        fprintf( stderr, "Error leyendo los pixels del archivo %s\n", filename );
-        fclose( fbmp );
-
-        if ( imagen->paleta.cant && imagen->paleta.colores )
-            free( imagen->paleta.colores );
+        fprintf( salida_errores(), "Error al buscar los pixeles de %s\n", filename );
+        free( imagen->paleta.colores );
+        destruir_indice_paleta( imagen->indice );
         free( imagen );
         return NULL;
     }
 
-// endIF del leer de archivo
-    fclose(fbmp); // Se cierra el archivo
     return imagen;
 }
 
 /*
- * Imprime en stdout el header de la imágen en memoria, recibida por
+ * Abre un archivo .bmp y lee sólo los headers y la paleta. El archivo
+ * queda abierto en la imágen, para luego leer los píxeles con
+ * cargar_pixels o de a una fila con procesar_por_filas.
+ */
+bmp_t *abrir_imagen_archivo( const char *filename )
+{
+    fuente_bmp fuente;
+    bmp_t *imagen;
+
+    if( !abrir_fuente( &fuente, filename ) ) {
+        fprintf( salida_errores(), "Error al abrir el archivo\n");
+        return NULL;
+    }
+
+    if ( ( imagen = leer_encabezados( &fuente, filename ) ) == NULL )
+    {
+        cerrar_fuente( &fuente ); // Se cierra el archivo
+        return NULL;
+    }
+
+    imagen->fuente = fuente;
+    return imagen;
+}
+
+bool legible_por_filas( const bmp_t *imagen )
+{
+    return imagen->infoheader.tipo_compres != BI_RLE8 &&
+           imagen->infoheader.tipo_compres != BI_RLE4;
+}
+
+void usar_rle( bmp_t *imagen, bool usar )
+{
+    imagen->rle = usar;
+}
+
+/*
+ * Lee los headers y la paleta con una fuente que no mapea el archivo,
+ * y la cierra enseguida: la imágen queda sin fuente y sin píxeles.
+ */
+bmp_t *leer_header_archivo( const char *filename )
+{
+    fuente_bmp fuente;
+    bmp_t *imagen;
+
+    if ( !abrir_fuente_encabezados( &fuente, filename ) )
+    {
+        fprintf( salida_errores(), "Error al abrir el archivo %s\n", filename );
+        return NULL;
+    }
+
+    imagen = leer_encabezados( &fuente, filename );
+    cerrar_fuente( &fuente );
+    return imagen;
+}
+
+/*
+ * Lee los píxeles de una imágen abierta con abrir_imagen_archivo, y
+ * cierra el archivo.
+ */
+bool cargar_pixels( bmp_t *imagen )
+{
+    bool ok = leer_pixels( &imagen->fuente, imagen );
+
+    cerrar_fuente( &imagen->fuente ); // Se cierra el archivo
+    if ( !ok )
+        liberar_pixels( imagen );
+
+    return ok;
+}
+
+/* Crea un bmp_t en la memoria a partir de un archivo .bmp, recibido
+ * como parámetro bajo el nombre de filename. Si es un archivo regular
+ * se lee mapeado en memoria; si no (un pipe, por ejemplo), con stdio.
+*/
+bmp_t *crear_imagen_archivo( const char *filename )
+{
+    bmp_t *imagen;
+
+    if ( ( imagen = abrir_imagen_archivo( filename ) ) == NULL )
+        return NULL;
+
+    // Lectura pixels --->
+    if ( !cargar_pixels( imagen ) )
+    {
+        fprintf( salida_errores(), "Error leyendo los pixels del archivo %s\n", filename );
+        destruir_bmp( imagen );
+        return NULL;
+    }
+
+    return imagen;
+}
+
+/*
+ * Imprime en "salida" el header de la imágen en memoria, recibida por
  * parámetro.
  */
-void mostrar_header( bmp_t *imagen )
+void mostrar_header( bmp_t *imagen, FILE *salida )
 {
-    fprintf( stdout, "\nBitmap fileheader\n\n"
+    fprintf( salida, "\nBitmap fileheader\n\n"
              "\tSignature:        %X\n"
              "\tFile size:        %d\n"
              "\tReserved:         %d\n"
@@ -502,7 +1099,7 @@ void mostrar_header( bmp_t *imagen )
              imagen->fileheader.reserved,
              imagen->fileheader.bmp_offset );
 
-    fprintf( stdout, "\nBitmap info header\n\n"
+    fprintf( salida, "\nBitmap info header\n\n"
              "\tHeader size:      %d\n"
              "\tWidth:            %d\n"
              "\tHeight:           %d\n"
@@ -527,124 +1124,367 @@ void mostrar_header( bmp_t *imagen )
              imagen->infoheader.ncolores,
              imagen->infoheader.n_colores_imp );
 
-    fprintf( stdout, "\nPaleta de colores:\n\n" );
+    if ( imagen->infoheader.bitspp == 16 || imagen->infoheader.bitspp == 32 )
+        fprintf( salida, "\nMascaras (R, G, B, A): %08X %08X %08X %08X\n",
+                 imagen->mascaras[0], imagen->mascaras[1],
+                 imagen->mascaras[2], imagen->mascaras[3] );
 
-    if ( imagen->infoheader.bitspp  == 1 || imagen->infoheader.bitspp == 8 )
+    fprintf( salida, "\nPaleta de colores:\n\n" );
+
+    if ( imagen->infoheader.bitspp <= 8 )
     {
-        fprintf( stdout, "\t%-10s%-10s%-10s%-10s\n", "Id", "Blue", "Green", "Red" );
+        fprintf( salida, "\t%-10s%-10s%-10s%-10s\n", "Id", "Blue", "Green", "Red" );
         int i;
         bmpcolor_t color;
         for ( i = 0; i < ( int ) imagen->paleta.cant; i++ )
         {
             color = imagen->paleta.colores[i];
-            fprintf( stdout, "\t%-10d%-10d%-10d%-10d\n", i, color.blue, color.green, color.red );
+            fprintf( salida, "\t%-10d%-10d%-10d%-10d\n", i, color.blue, color.green, color.red );
         }
     }
     else
     {
-        fprintf( stdout, "\tNo tiene\n" );
+        fprintf( salida, "\tNo tiene\n" );
+    }
+}
+
+void resumir_header( const bmp_t *imagen, resumen_header *resumen )
+{
+    resumen->ancho = imagen->infoheader.width;
+    resumen->alto = imagen->infoheader.height;
+    resumen->bpp = imagen->infoheader.bitspp;
+    resumen->compresion = imagen->infoheader.tipo_compres;
+    resumen->colores = imagen->paleta.cant;
+    resumen->offset = imagen->fileheader.bmp_offset;
+    resumen->tam_header = imagen->infoheader.header_sz;
+    resumen->tam_archivo = imagen->fileheader.filesz;
+}
+
+/* Bytes intercambiados por vez en el flip vertical */
+#define TRAMO_FLIP 256
+
+/*
+ * Intercambia el contenido de dos filas de "bytes" bytes, por tramos,
+ * usando un buffer chico en el stack.
+ */
+void intercambiar_filas( uint8_t *a, uint8_t *b, size_t bytes )
+{
+    uint8_t tmp[TRAMO_FLIP];
+    size_t x, n;
+
+    for ( x = 0; x < bytes; x += n )
+    {
+        n = bytes - x < TRAMO_FLIP ? bytes - x : TRAMO_FLIP;
+        memcpy( tmp, a + x, n );
+        memcpy( a + x, b + x, n );
+        memcpy( b + x, tmp, n );
     }
 }
 
 /*
  * Realiza un "flip vertical" de la imágen. Es decir, la da vuelta.
+ * Se intercambia el contenido de las filas (y no los punteros) para que
+ * el bloque de píxeles siga recorriéndose de arriba hacia abajo. En
+ * las imágenes indexadas se mueven los índices.
  */
 void flip_vertical( const bmp_t *const imagen )
 {
-    bmpcolor_t **ppio, **final;
-    bmpcolor_t *tmp;
+    uint8_t *ppio, *final;
+    size_t bytes, stride;
 
-    ppio = imagen->pixels;
-    final = ppio + ( imagen->infoheader.height - 1 );
+    if ( es_indexada( imagen ) )
+    {
+        ppio   = imagen->indices;
+        bytes  = imagen->infoheader.width;
+        stride = imagen->stride_indices;
+    }
+    else
+    {
+        ppio   = ( uint8_t * ) imagen->datos;
+        bytes  = imagen->infoheader.width * sizeof( bmpcolor_t );
+        stride = imagen->stride * sizeof( bmpcolor_t );
+    }
+    final = ppio + ( size_t ) ( imagen->infoheader.height - 1 ) * stride;
 
     while ( ppio < final )
     {
-        tmp = *ppio;
-        *ppio = *final;
-        *final = tmp;
-
-        final--;
-        ppio++;
+        intercambiar_filas( ppio, final, bytes );
+        final -= stride;
+        ppio  += stride;
     }
 
     return;
 }
 
 /*
- * Rota la imágen 90 grados.
+ * Rota un bloque de MICRO_ROTAR x MICRO_ROTAR píxeles que empieza en la
+ * fila i, columna j del origen. Se lee el bloque entero y se escribe
+ * de a filas contiguas del destino.
  */
-void rotar( bmp_t *const imagen )
+void rotar_bloque( const contexto_rotar *c, const int32_t i, const int32_t j )
 {
-    int32_t i, j, ancho, alto;
-    uint32_t res;
+    bmpcolor_t a[MICRO_ROTAR][MICRO_ROTAR], *d;
+    bmpcolor_t **origen = c->imagen->pixels;
+    int32_t ancho = c->imagen->infoheader.width;
+    int32_t alto  = c->imagen->infoheader.height;
+    int32_t f, k;
+
+    for ( f = 0; f < MICRO_ROTAR; f++ )
+        for ( k = 0; k < MICRO_ROTAR; k++ )
+            a[f][k] = origen[i + f][j + k];
+
+    for ( k = 0; k < MICRO_ROTAR; k++ )
+    {
+        if ( c->veces == 1 )
+        {
+            d = &c->destino[ancho - 1 - ( j + k )][i];
+            for ( f = 0; f < MICRO_ROTAR; f++ )
+                d[f] = a[f][k];
+        }
+        else
+        {
+            d = &c->destino[j + k][alto - MICRO_ROTAR - i];
+            for ( f = 0; f < MICRO_ROTAR; f++ )
+                d[f] = a[MICRO_ROTAR - 1 - f][k];
+        }
+    }
+}
+
+/*
+ * Rota las filas [i0, i1) y columnas [j0, j1) del origen. Los bloques
+ * completos van por rotar_bloque, y los bordes de a un píxel.
+ */
+void rotar_tesela( const contexto_rotar *c,
+                   const int32_t i0, const int32_t i1,
+                   const int32_t j0, const int32_t j1 )
+{
+    bmpcolor_t **origen = c->imagen->pixels;
+    int32_t ancho = c->imagen->infoheader.width;
+    int32_t alto  = c->imagen->infoheader.height;
+    int32_t i, j, f, k;
+
+    for ( i = i0; i < i1; i += MICRO_ROTAR )
+    {
+        for ( j = j0; j < j1; j += MICRO_ROTAR )
+        {
+            if ( i + MICRO_ROTAR <= i1 && j + MICRO_ROTAR <= j1 )
+            {
+                rotar_bloque( c, i, j );
+                continue;
+            }
+
+            for ( f = i; f < i + MICRO_ROTAR && f < i1; f++ )
+            {
+                for ( k = j; k < j + MICRO_ROTAR && k < j1; k++ )
+                {
+                    if ( c->veces == 1 )
+                        c->destino[ancho - 1 - k][f] = origen[f][k];
+                    else
+                        c->destino[k][alto - 1 - f] = origen[f][k];
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Igual que rotar_tesela, para una imágen indexada. Con un byte por
+ * píxel la tesela entera ya entra en la caché, y se copia de a uno.
+ */
+void rotar_tesela_indices( const contexto_rotar *c,
+                           const int32_t i0, const int32_t i1,
+                           const int32_t j0, const int32_t j1 )
+{
+    uint8_t **origen = c->imagen->filas;
+    int32_t ancho = c->imagen->infoheader.width;
+    int32_t alto  = c->imagen->infoheader.height;
+    int32_t i, j;
 
-    /* intercambiar ancho y alto */
-    alto = imagen->infoheader.width;
-    ancho  = imagen->infoheader.height;
+    for ( j = j0; j < j1; j++ )
+    {
+        if ( c->veces == 1 )
+        {
+            uint8_t *d = c->destino_indices[ancho - 1 - j];
+            for ( i = i0; i < i1; i++ )
+                d[i] = origen[i][j];
+        }
+        else
+        {
+            uint8_t *d = c->destino_indices[j] + alto - 1;
+            for ( i = i0; i < i1; i++ )
+                *( d - i ) = origen[i][j];
+        }
+    }
+}
 
-    /* intercambiar resolucion vert y horiz */
-    res = imagen->infoheader.vres;
-    imagen->infoheader.vres = imagen->infoheader.hres;
-    imagen->infoheader.hres = res;
+/*
+ * Rota 90 o 270 grados las bandas [desde, hasta) de teselas del origen,
+ * contadas de a TESELA_ROTAR filas.
+ */
+void rotar_banda( void *ctx, uint32_t desde, uint32_t hasta )
+{
+    const contexto_rotar *c = ( const contexto_rotar * ) ctx;
+    int32_t ancho = c->imagen->infoheader.width;
+    int32_t alto  = c->imagen->infoheader.height;
+    int32_t i0, i1, j0, j1;
+    uint32_t banda;
 
-    /* bmp_bytesz se calcula al guardar */
+    for ( banda = desde; banda < hasta; banda++ )
+    {
+        i0 = banda * TESELA_ROTAR;
+        i1 = i0 + TESELA_ROTAR < alto ? i0 + TESELA_ROTAR : alto;
+        for ( j0 = 0; j0 < ancho; j0 += TESELA_ROTAR )
+        {
+            j1 = j0 + TESELA_ROTAR < ancho ? j0 + TESELA_ROTAR : ancho;
+            if ( c->destino_indices != NULL )
+                rotar_tesela_indices( c, i0, i1, j0, j1 );
+            else
+                rotar_tesela( c, i0, i1, j0, j1 );
+        }
+    }
+}
 
-    bmpcolor_t **pixels = crear_matriz_pixels( ancho, alto );
-    if ( pixels == NULL )
+/*
+ * Rota 180 grados las filas [desde, hasta) del origen: cada una se
+ * copia al revés en la fila opuesta del destino.
+ */
+void rotar180_banda( void *ctx, uint32_t desde, uint32_t hasta )
+{
+    const contexto_rotar *c = ( const contexto_rotar * ) ctx;
+    int32_t ancho = c->imagen->infoheader.width;
+    int32_t alto  = c->imagen->infoheader.height;
+    const bmpcolor_t *o;
+    bmpcolor_t *d;
+    uint32_t i;
+    int32_t j;
+
+    if ( c->destino_indices != NULL )
     {
-        fprintf( stderr, "Error alocando para pixels\n" );
+        for ( i = desde; i < hasta; i++ )
+        {
+            const uint8_t *oi = c->imagen->filas[i];
+            uint8_t *di = c->destino_indices[alto - 1 - i] + ancho - 1;
+            for ( j = 0; j < ancho; j++ )
+                *( di - j ) = oi[j];
+        }
         return;
     }
 
-    /* Roto la matriz*/
-    for ( i = 0; i <  imagen->infoheader.height; i++ )
+    for ( i = desde; i < hasta; i++ )
     {
-        for ( j = 0; j < imagen->infoheader.width; j++ )
-            pixels[alto - ( j + 1 )][i] = imagen->pixels[i][j];
+        o = c->imagen->pixels[i];
+        d = c->destino[alto - 1 - i] + ancho - 1;
+        for ( j = 0; j < ancho; j++ )
+            *( d - j ) = o[j];
     }
+}
 
-    /* Libero original */
-    liberar_pixels( imagen );
+/*
+ * Rota la imágen "veces" x 90 grados. La imágen se recorre por teselas,
+ * para que tanto la lectura como la escritura queden en la caché, y las
+ * bandas de teselas se reparten en el pool de hilos.
+ */
+void rotar( const uint32_t veces, bmp_t *const imagen )
+{
+    int32_t ancho, alto, nuevo_ancho, nuevo_alto;
+    uint32_t res;
+    contexto_rotar ctx;
+    matriz_pixels matriz;
+    matriz_indices indices;
+
+    ctx.veces = veces % 4;
+    if ( ctx.veces == 0 )
+        return;
+
+    ancho = imagen->infoheader.width;
+    alto  = imagen->infoheader.height;
+
+    /* con 90 o 270 grados se intercambian ancho y alto */
+    nuevo_ancho = ctx.veces == 2 ? ancho : alto;
+    nuevo_alto  = ctx.veces == 2 ? alto : ancho;
+
+    ctx.imagen  = imagen;
+    ctx.destino = NULL;
+    ctx.destino_indices = NULL;
+    if ( es_indexada( imagen ) )
+    {
+        if ( !crear_matriz_indices( &indices, nuevo_ancho, nuevo_alto ) )
+            return;
+        ctx.destino_indices = indices.filas;
+    }
+    else
+    {
+        if ( !crear_matriz_pixels( &matriz, nuevo_ancho, nuevo_alto ) )
+        {
+            fprintf( salida_errores(), "Error alocando para pixels\n" );
+            return;
+        }
+        ctx.destino = matriz.pixels;
+    }
+
+    if ( ctx.veces == 2 )
+        pool_paralelo( alto, TESELA_ROTAR, rotar180_banda, &ctx );
+    else
+    {
+        pool_paralelo( ( alto + TESELA_ROTAR - 1 ) / TESELA_ROTAR, 1, rotar_banda, &ctx );
+
+        /* intercambiar resolucion vert y horiz */
+        res = imagen->infoheader.vres;
+        imagen->infoheader.vres = imagen->infoheader.hres;
+        imagen->infoheader.hres = res;
+    }
 
-    /* Actualizo */
-    imagen->pixels = pixels;
-    imagen->infoheader.height = alto;
-    imagen->infoheader.width = ancho;
+    /* bmp_bytesz se calcula al guardar. Libero original y actualizo */
+    if ( ctx.destino_indices != NULL )
+        reemplazar_indices( imagen, &indices, nuevo_ancho, nuevo_alto );
+    else
+        reemplazar_pixels( imagen, &matriz, nuevo_ancho, nuevo_alto );
 
     return;
 }
 
 
 /*
- * Produce el "negativo" de la imágen.
+ * Produce el "negativo" de una fila de la imágen. En las imágenes de
+ * 1BPP se intercambian los dos colores de la paleta.
  */
-void negativo( const bmp_t *const imagen )
+void negativo_fila( const bmp_t *const imagen, bmpcolor_t *fila )
 {
-    uint32_t i, j;
+    int32_t x, ancho = imagen->infoheader.width;
 
     if ( imagen->infoheader.bitspp == 1 )
     {
-        int indice = 0;
-        for ( i = 0; i < ( uint32_t ) imagen->infoheader.height; i++ )
-        {
-            for ( j = 0; j < ( uint32_t ) imagen->infoheader.width; j++ )
-            {
-                indice = coloresde_paleta( imagen, imagen->pixels[i][j] );
-                imagen->pixels[i][j] = imagen->paleta.colores[!indice];
-            }
-        }
+        for ( x = 0; x < ancho; x++ )
+            fila[x] = imagen->paleta.colores[!coloresde_paleta( imagen, fila[x] )];
     }
     else
+        negar_pixels( fila, ancho );
+}
+
+/*
+ * Produce el "negativo" de la imágen. Si está indexada alcanza con
+ * cambiar la paleta.
+ */
+void negativo( bmp_t *const imagen )
+{
+    int32_t i;
+
+    if ( es_indexada( imagen ) )
     {
-        for ( i = 0; i < ( uint32_t ) imagen->infoheader.height; i++ )
-        {
-            for ( j = 0; j < ( uint32_t ) imagen->infoheader.width; j++ )
-            {
-                imagen->pixels[i][j].red   = 255 - imagen->pixels[i][j].red;
-                imagen->pixels[i][j].green = 255 - imagen->pixels[i][j].green;
-                imagen->pixels[i][j].blue  = 255 - imagen->pixels[i][j].blue;
-            }
-        }
+        negar_paleta( imagen );
+        return;
+    }
+
+    if ( imagen->infoheader.bitspp == 1 )
+    {
+        for ( i = 0; i < imagen->infoheader.height; i++ )
+            negativo_fila( imagen, imagen->pixels[i] );
+    }
+    else
+    {
+        /* se recorre el bloque entero, incluido el relleno de las filas */
+        negar_pixels( imagen->datos,
+                      ( size_t ) imagen->stride * imagen->infoheader.height );
     }
 
     return;
@@ -652,160 +1492,271 @@ void negativo( const bmp_t *const imagen )
 
 /*
  * Devuelve el indice de un color desde la paleta, o el que más
- * se le parezca.
+ * se le parezca. Usa el índice inverso de la paleta, armado una sola
+ * vez al cargarla, en lugar de recorrer toda la paleta cada vez.
  */
 uint8_t coloresde_paleta( const bmp_t *imagen, const bmpcolor_t color )
 {
-    int i, color_cercano = 0, temp = 0, distancia = 250000;
+    return buscar_en_paleta( imagen->indice, color );
+}
+
+/*
+ * Pasada horizontal del blur: deja en "sumas" ("canales" por píxel, en
+ * el orden de los bytes de bmpcolor_t) la suma de la ventana
+ * [x - rate, x + rate) de la fila, recortada a los bordes, usando una
+ * suma corrida.
+ */
+void sumar_fila_horizontal( const bmpcolor_t *fila,
+                            const int64_t ancho,
+                            const int64_t rate,
+                            const uint32_t canales,
+                            uint32_t *sumas )
+{
+    const uint8_t *bytes = ( const uint8_t * ) fila;
+    uint32_t ventana[4] = { 0, 0, 0, 0 }, c;
+    int64_t x, entra, sale;
+
+    /* ventana del primer píxel: [0, min(rate, ancho)) */
+    for ( x = 0; x < rate && x < ancho; x++ )
+        for ( c = 0; c < canales; c++ )
+            ventana[c] += bytes[4 * x + c];
+
+    for ( x = 0; x < ancho; x++ )
+    {
+        for ( c = 0; c < canales; c++ )
+            sumas[canales * x + c] = ventana[c];
+
+        /* pasar a la ventana de x + 1 */
+        entra = x + rate;
+        sale  = x - rate;
+        if ( entra < ancho )
+            for ( c = 0; c < canales; c++ )
+                ventana[c] += bytes[4 * entra + c];
+        if ( sale >= 0 )
+            for ( c = 0; c < canales; c++ )
+                ventana[c] -= bytes[4 * sale + c];
+    }
+}
+
+/*
+ * Aplica el blur a las filas [desde, hasta). Para cada fila de la
+ * ventana vertical se hace la pasada horizontal, y los resultados se
+ * acumulan por columna; al bajar una fila se suma la que entra a la
+ * ventana y se resta la que sale. Así las dos pasadas recorren la
+ * memoria fila por fila, y cada banda sólo necesita O(ancho) memoria.
+ */
+void blur_banda( void *ctx, uint32_t desde, uint32_t hasta )
+{
+    const contexto_blur *c = ( const contexto_blur * ) ctx;
+    const bmp_t *imagen = c->imagen;
+    int64_t ancho, alto, rate, x, y, fila, x0, x1, y0, y1, n;
+    uint64_t *columnas, cont;
+    uint32_t *sumas, k;
+    uint8_t *salida;
+
+    ancho = imagen->infoheader.width;
+    alto  = imagen->infoheader.height;
+    rate  = c->rate;
+    n     = c->canales * ancho;
+
+    columnas = ( uint64_t * ) calloc( n, sizeof( uint64_t ) );
+    sumas    = ( uint32_t * ) malloc( n * sizeof( uint32_t ) );
+    if ( columnas == NULL || sumas == NULL )
+    {
+        fprintf( salida_errores(), "Error alocando memoria para el blur\n" );
+        free( columnas );
+        free( sumas );
+        return;
+    }
+
+    /* ventana vertical de la primer fila de la banda */
+    y0 = ( int64_t ) desde - rate < 0 ? 0 : ( int64_t ) desde - rate;
+    y1 = ( int64_t ) desde + rate > alto ? alto : ( int64_t ) desde + rate;
+    for ( fila = y0; fila < y1; fila++ )
+    {
+        sumar_fila_horizontal( imagen->pixels[fila], ancho, rate, c->canales, sumas );
+        for ( x = 0; x < n; x++ )
+            columnas[x] += sumas[x];
+    }
 
-    for ( i = 0; i < ( int ) imagen->paleta.cant; ++i )
+    for ( y = desde; y < hasta; y++ )
     {
-        bmpcolor_t c = imagen->paleta.colores[i];
-        temp = ( int ) pow( c.red   - color.red,   2.0 ) +
-               ( int ) pow( c.green - color.green, 2.0 ) +
-               ( int ) pow( c.blue  - color.blue,  2.0 );
+        salida = ( uint8_t * ) c->destino[y];
 
-        if ( temp < 1 )
+        for ( x = 0; x < ancho; x++ )
         {
-            color_cercano = i;
-            break;
+            x0 = x - rate < 0 ? 0 : x - rate;
+            x1 = x + rate > ancho ? ancho : x + rate;
+            cont = ( uint64_t ) ( x1 - x0 ) * ( y1 - y0 );
+
+            /* sin alpha, el cuarto byte queda en 0 */
+            for ( k = 0; k < 4; k++ )
+                salida[4 * x + k] = k < c->canales ? columnas[c->canales * x + k] / cont : 0;
+        }
+
+        /* pasar a la ventana de y + 1 */
+        if ( y + 1 + rate <= alto )
+        {
+            sumar_fila_horizontal( imagen->pixels[y + rate], ancho, rate, c->canales, sumas );
+            for ( x = 0; x < n; x++ )
+                columnas[x] += sumas[x];
+            y1++;
         }
-        else if ( temp < distancia )
+        if ( y + 1 - rate > 0 )
         {
-            color_cercano = i;
-            distancia = temp;
+            sumar_fila_horizontal( imagen->pixels[y - rate], ancho, rate, c->canales, sumas );
+            for ( x = 0; x < n; x++ )
+                columnas[x] -= sumas[x];
+            y0++;
         }
     }
 
-    return color_cercano;
+    free( columnas );
+    free( sumas );
 }
 
 /*
- * Redimensiona la imágen al doble de tamaño.
+ * Produce el efecto 'blur' en la imágen, con el valor que rate
+ * lo indique. Cada píxel es el promedio de la ventana
+ * [x - rate, x + rate) x [y - rate, y + rate), recortada a los bordes
+ * de la imágen. Se separa en una pasada horizontal y otra vertical con
+ * sumas corridas, por lo que el costo no depende del rate, y las
+ * bandas de filas se reparten en el pool de hilos. Como las sumas son
+ * exactas, el resultado es el mismo para cualquier cantidad de hilos.
  */
-void redimensionar2x( bmp_t *const imagen )
-{
-    int32_t j, k, ancho, alto;
-
-    /* cambiar ancho y alto */
-    ancho = imagen->infoheader.width * 2;
-    alto = imagen->infoheader.height * 2;
+void blur( const uint32_t rate, bmp_t *const imagen )
 
-    /* Duplicar resolucion */
-    /* el tamaño se va a cambiar al guardar el archivo */
-    imagen->infoheader.vres = imagen->infoheader.vres * 2;
-    imagen->infoheader.hres = imagen->infoheader.hres * 2;
+{
+    int32_t ancho, alto;
+    uint32_t nbandas;
+    contexto_blur ctx;
 
+    /* los promedios crean colores nuevos */
+    if ( !expandir_a_colores( imagen ) )
+        return;
 
-    bmpcolor_t **pixels = crear_matriz_pixels( ancho, alto );
+    ancho = imagen->infoheader.width;
+    alto = imagen->infoheader.height;
 
-    if ( pixels == NULL )
+    matriz_pixels matriz;
+    if ( !crear_matriz_pixels( &matriz, ancho, alto ) )
     {
-        fprintf( stderr, "Error alocando memoria para los pixels\n" );
+        fprintf( salida_errores(), "Error alocando pixels\n" );
         return;
     }
 
-    /* duplicar la matriz */
-    for ( j = 0; j <  alto; j++ )
-    {
-        for ( k = 0; k < ancho; k++ )
-            pixels[j][k] = promediopixels( imagen->pixels,
-                                           imagen->infoheader.width,
-                                           imagen->infoheader.height,
-                                           k / 2U, j / 2U, 1 );
-    }
-
-    liberar_pixels( imagen ); // Se libera la original
+    ctx.imagen  = imagen;
+    ctx.destino = matriz.pixels;
+    ctx.rate    = rate;
+    ctx.canales = tiene_alfa( imagen ) ? 4 : 3;
 
-    //Se guarda el nuevo
-    imagen->pixels = pixels;
-    imagen->infoheader.height = alto;
-    imagen->infoheader.width = ancho;
+    /*
+     * Cada banda arranca sumando su ventana vertical completa, por eso
+     * se usan pocas bandas grandes: una por hilo.
+     */
+    nbandas = pool_hilos();
+    pool_paralelo( alto, ( alto + nbandas - 1 ) / nbandas, blur_banda, &ctx );
 
+    /* Libero la original y actualizo */
+    reemplazar_pixels( imagen, &matriz, ancho, alto );
     return;
 }
 
 /*
- * Redimensiona la imágen a la mitad del tamaño.
+ * Devuelve true si la fila (o columna) "pos" cae sobre una línea, cuando
+ * se pintan líneas de "ancho" píxeles separadas por "espacio" píxeles,
+ * empezando desde 0.
  */
-void redimensionar1_2x( bmp_t *const imagen )
+bool en_linea( const uint32_t pos, const uint32_t ancho, const uint32_t espacio )
 {
-    int32_t j, k, ancho, alto;
+    uint64_t periodo = ( uint64_t ) ancho + espacio;
 
-    /* cambiar ancho y alto */
-    ancho = imagen->infoheader.width / 2;
-    alto = imagen->infoheader.height / 2;
+    if ( !periodo )
+        return false;
 
-    /* Duplicar resolucion */
-    /* el tamaño se va a cambiar al guardar el archivo */
-    imagen->infoheader.vres = imagen->infoheader.vres / 2;
-    imagen->infoheader.hres = imagen->infoheader.hres / 2;
+    return pos % periodo < ancho;
+}
 
+/*
+ * Pinta en una fila de la imágen los píxeles que caen sobre las líneas
+ * verticales.
+ */
+void lineasv_fila( uint32_t ancho,
+                   uint32_t espacio,
+                   bmpcolor_t color,
+                   const bmp_t *const imagen,
+                   bmpcolor_t *fila )
+{
+    uint64_t a, c, w, periodo;
 
-    bmpcolor_t **pixels = crear_matriz_pixels( ancho, alto );
+    w = imagen->infoheader.width;
+    periodo = ( uint64_t ) ancho + espacio;
+    color.alpha = tiene_alfa( imagen ) ? 0xFF : 0;
 
-    if ( pixels == NULL )
-    {
-        fprintf( stderr, "Error alocando memoria para los pixels\n" );
+    if ( !ancho )
         return;
-    }
 
-    /* duplicar la matriz */
-    for ( j = 0; j <  alto; j++ )
+    for ( a = 0; a < w; a += periodo )
     {
-        for ( k = 0; k < ancho; k++ )
-            pixels[j][k] = promediopixels( imagen->pixels,
-                                           imagen->infoheader.width,
-                                           imagen->infoheader.height,
-                                           k * 2U, j * 2U, 1 );
+        for ( c = a; c < a + ancho && c < w; c++ )
+            fila[c] = color;
     }
+}
 
-    liberar_pixels( imagen ); // Se libera la original
+/*
+ * Pinta la fila "y" de la imágen si cae sobre una línea horizontal.
+ */
+void lineash_fila( uint32_t ancho,
+                   uint32_t espacio,
+                   bmpcolor_t color,
+                   const bmp_t *const imagen,
+                   const uint32_t y,
+                   bmpcolor_t *fila )
+{
+    int32_t x, w;
 
-    //Se guarda el nuevo
-    imagen->pixels = pixels;
-    imagen->infoheader.height = alto;
-    imagen->infoheader.width = ancho;
+    if ( !en_linea( y, ancho, espacio ) )
+        return;
 
-    return;
+    w = imagen->infoheader.width;
+    color.alpha = tiene_alfa( imagen ) ? 0xFF : 0;
+    for ( x = 0; x < w; x++ )
+        fila[x] = color;
 }
 
 /*
- * Produce el efecto 'blur' en la imágen, con el valor que rate
- * lo indique.
+ * Igual que lineasv_fila, sobre una fila de índices.
  */
-void blur( const uint32_t rate, bmp_t *const imagen )
-
+void lineasv_indices( uint32_t ancho,
+                      uint32_t espacio,
+                      uint8_t indice,
+                      const bmp_t *const imagen,
+                      uint8_t *fila )
 {
-    int32_t i, j, ancho, alto;
-
-    /* cambiar ancho y alto */
-    ancho = imagen->infoheader.width;
-    alto = imagen->infoheader.height;
+    uint64_t a, w, periodo;
 
-    bmpcolor_t **pixels = crear_matriz_pixels( ancho, alto );
+    w = imagen->infoheader.width;
+    periodo = ( uint64_t ) ancho + espacio;
 
-    if ( pixels == NULL )
-    {
-        fprintf( stderr, "Error alocando pixels\n" );
+    if ( !ancho )
         return;
-    }
-
-    for ( i = 0; i <  alto; i++ )
-    {
-        for ( j = 0; j < ancho; j++ )
-            pixels[i][j] = promediopixels( imagen->pixels,
-                                           ancho,
-                                           alto,
-                                           j, i, rate );
-    }
 
-    /* Libero la original */
-    liberar_pixels( imagen );
+    for ( a = 0; a < w; a += periodo )
+        memset( fila + a, indice, a + ancho < w ? ancho : w - a );
+}
 
-    /* Actualizo */
-    imagen->pixels = pixels;
-    return;
+/*
+ * Igual que lineash_fila, sobre una fila de índices.
+ */
+void lineash_indices( uint32_t ancho,
+                      uint32_t espacio,
+                      uint8_t indice,
+                      const bmp_t *const imagen,
+                      const uint32_t y,
+                      uint8_t *fila )
+{
+    if ( en_linea( y, ancho, espacio ) )
+        memset( fila, indice, imagen->infoheader.width );
 }
 
 /*
@@ -819,156 +1770,213 @@ void addlineasv( uint32_t ancho,
                  const bmp_t *const imagen )
 
 {
-    int a, b;
-    unsigned c;
-    int w, h;
-    w = imagen->infoheader.width;
-    h = imagen->infoheader.height;
+    int32_t b;
 
-    for ( b = 0; b < h; b++ )
+    if ( es_indexada( imagen ) )
     {
-        for ( a = 0; a < w; a += espacio )
-        {
-            for ( c = 0; c < ancho && a < w; c++, a++ )
-                if(!pintar_pixelcolor( imagen, a, b, color ))
-                    fprintf(stderr, "Error pintando lineas\n");
-        }
+        uint8_t indice = coloresde_paleta( imagen, color );
+        for ( b = 0; b < imagen->infoheader.height; b++ )
+            lineasv_indices( ancho, espacio, indice, imagen, imagen->filas[b] );
+        return;
     }
-}
 
+    for ( b = 0; b < imagen->infoheader.height; b++ )
+        lineasv_fila( ancho, espacio, color, imagen, imagen->pixels[b] );
+}
 
 /*
- * Pinta un píxel ubicado en [X][Y] del color RGB. Todos los datos son
- * recibidos como parámetros.
+ * Agrega líneas horizontales a la imágen, el ancho de las líneas, el
+ * espacio que hay entre ellas, y el color de las mismas, son recibidos
+ * como parámetros.
  */
-bool pintar_pixel( const bmp_t *const imagen,
-                   const uint32_t x,
-                   const uint32_t y,
-                   const uint8_t r,
-                   const uint8_t g,
-                   const uint8_t b )
+void addlineash( uint32_t ancho,
+                 uint32_t espacio,
+                 bmpcolor_t color,
+                 const bmp_t *const imagen )
 {
-    if ( x > ( u_int32_t )imagen->infoheader.width ||
-            y > ( u_int32_t )imagen->infoheader.height )
+    int32_t y;
+
+    if ( es_indexada( imagen ) )
     {
-        return false;
+        uint8_t indice = coloresde_paleta( imagen, color );
+        for ( y = 0; y < imagen->infoheader.height; y++ )
+            lineash_indices( ancho, espacio, indice, imagen, y, imagen->filas[y] );
+        return;
     }
 
-    bmpcolor_t color = { b, g, r, 0 };
-    imagen->pixels[y][x] = color;
-
-    return true;
+    for ( y = 0; y < imagen->infoheader.height; y++ )
+        lineash_fila( ancho, espacio, color, imagen, y, imagen->pixels[y] );
 }
 
 /*
- * Pintar pixel general, llama a pintar pixel color, luego de "desarmar"
- * el color en rojo, azul, y verde.
+ * Aplica una operación por filas a la fila "fila", que está en la
+ * posición *y de la imágen. Un flip no toca la fila, sólo cambia su
+ * posición.
  */
-bool pintar_pixelcolor( const bmp_t *imagen,
-                        const uint32_t x,
-                        const uint32_t y,
-                        const bmpcolor_t color )
+void aplicar_op_fila( const bmp_t *const imagen,
+                      const op_fila *op,
+                      int32_t *y,
+                      bmpcolor_t *fila )
 {
-    return pintar_pixel( imagen, x, y, color.red, color.green, color.blue );
+    switch ( op->tipo )
+    {
+    case FILA_NEGATIVO:
+        negativo_fila( imagen, fila );
+        break;
+    case FILA_LINEAS_H:
+        lineash_fila( op->ancho, op->espacio, op->color, imagen, *y, fila );
+        break;
+    case FILA_LINEAS_V:
+        lineasv_fila( op->ancho, op->espacio, op->color, imagen, fila );
+        break;
+    case FILA_FLIP:
+        *y = imagen->infoheader.height - 1 - *y;
+        break;
+    }
 }
 
 /*
- * Agrega líneas horizontales a la imágen, el ancho de las líneas, el
- * espacio que hay entre ellas, y el color de las mismas, son recibidos
- * como parámetros.
+ * Igual que aplicar_op_fila, sobre una fila de índices. Los negativos
+ * ya se aplicaron a la paleta en preparar_ops_indices.
  */
-void addlineash( uint32_t ancho,
-                 uint32_t espacio,
-                 bmpcolor_t color,
-                 const bmp_t *const imagen )
+void aplicar_op_indices( const bmp_t *const imagen,
+                         const op_fila *op,
+                         int32_t *y,
+                         uint8_t *fila )
 {
-    unsigned x, y;
-    unsigned f;
-    unsigned an, al;
-    an = imagen->infoheader.width;
-    al = imagen->infoheader.height;
-
-    for ( y = 0; y < al; y += espacio )
+    switch ( op->tipo )
     {
-        for ( f = 0; f < ancho && y < al; f++, y++ )
-            for ( x = 0; x < an; x++ )
-                if(!pintar_pixelcolor( imagen, x, y, color ))
-                    fprintf(stderr, "Error pintando lineas\n");
+    case FILA_NEGATIVO:
+        break;
+    case FILA_LINEAS_H:
+        lineash_indices( op->ancho, op->espacio, op->indice, imagen, *y, fila );
+        break;
+    case FILA_LINEAS_V:
+        lineasv_indices( op->ancho, op->espacio, op->indice, imagen, fila );
+        break;
+    case FILA_FLIP:
+        *y = imagen->infoheader.height - 1 - *y;
+        break;
     }
 }
 
 /*
- * Devuelve el color promedio de los píxeles ubicados en un radio de
- * RADIO desde el pixel ubicado en [X][Y]
+ * Negativo sobre la paleta. En 1BPP se intercambian los dos colores,
+ * que es lo que hacía el negativo píxel a píxel; en el resto se
+ * invierte cada color de la paleta.
  */
-bmpcolor_t promediopixels( bmpcolor_t **pixels,
-                           const int32_t ancho,
-                           const int32_t alto,
-                           const int32_t x,
-                           const int32_t y,
-                           const int32_t radio )
+bool negar_paleta( bmp_t *imagen )
 {
-    uint32_t xx, yy, maxy, maxx, cont, r, g, b;
-    bmpcolor_t retornar;
+    bmpcolor_t *colores = imagen->paleta.colores, tmp;
+    indice_paleta *indice;
 
-    xx = x - radio < 0 ? 0 : x - radio;
-    yy = y - radio < 0 ? 0 : y - radio;
-    maxx = x + radio > ancho  ? ancho  : x + radio;
-    maxy = y + radio > alto ? alto : y + radio;
-
-    r = g = b = cont = 0;
-
-    for ( ; yy < maxy; yy++ )
+    if ( imagen->infoheader.bitspp == 1 )
     {
-        for ( ; xx < maxx; xx++ )
+        if ( imagen->paleta.cant >= 2 )
         {
-            r += pixels[yy][xx].red;
-            g += pixels[yy][xx].green;
-            b += pixels[yy][xx].blue;
-
-            cont++;
+            tmp = colores[0];
+            colores[0] = colores[1];
+            colores[1] = tmp;
         }
     }
+    else
+        negar_pixels( colores, imagen->paleta.cant );
 
-    retornar.red   = r / cont;
-    retornar.green = g / cont;
-    retornar.blue  = b / cont;
-    retornar.alpha = 0;
-
-    return retornar;
+    /* el índice inverso quedó desactualizado */
+    indice = crear_indice_paleta( colores, imagen->paleta.cant );
+    if ( indice == NULL )
+    {
+        fprintf( salida_errores(), "Error al alocar memoria para el indice de la paleta\n" );
+        return false;
+    }
+    destruir_indice_paleta( imagen->indice );
+    imagen->indice = indice;
+    return true;
 }
 
+bool preparar_ops_indices( bmp_t *imagen, op_fila *ops, const uint32_t nops )
+{
+    uint32_t k;
+
+    for ( k = 0; k < nops; k++ )
+    {
+        switch ( ops[k].tipo )
+        {
+        case FILA_NEGATIVO:
+            if ( !negar_paleta( imagen ) )
+                return false;
+            break;
+        case FILA_LINEAS_H:
+        case FILA_LINEAS_V:
+            ops[k].indice = coloresde_paleta( imagen, ops[k].color );
+            break;
+        case FILA_FLIP:
+            break;
+        }
+    }
+    return true;
+}
 
 /*
- * Graba el archivo que estaba en la memoria en un .bmp, cuyo nombre se
- * recibe como parámetro a la función.
+ * Aplica varias operaciones por filas (sin flips) recorriendo la imágen
+ * una sola vez: cada fila pasa por todas las operaciones mientras
+ * todavía está en la caché.
  */
-bool grabar_archivo( bmp_t *imagen, const char *salida )
+void aplicar_ops_filas( bmp_t *const imagen,
+                        const op_fila *ops,
+                        const uint32_t nops )
 {
-    FILE *fbmp;
+    int32_t y, yy;
+    uint32_t k;
 
-    uint32_t offset, fila_alineada, tamanioimagen;
-
-    /* verificar puntero no nulo */
-    if ( !imagen )
+    if ( es_indexada( imagen ) )
     {
-        fprintf( stderr, "No hay BMP en memoria\n" );
-        return false;
+        op_fila *preparadas = ( op_fila * ) malloc( sizeof( op_fila ) * ( nops ? nops : 1 ) );
+        if ( preparadas == NULL )
+        {
+            fprintf( salida_errores(), "Error alocando memoria para las operaciones\n" );
+            return;
+        }
+        memcpy( preparadas, ops, sizeof( op_fila ) * nops );
+        if ( preparar_ops_indices( imagen, preparadas, nops ) )
+        {
+            for ( y = 0; y < imagen->infoheader.height; y++ )
+            {
+                for ( k = 0; k < nops; k++ )
+                {
+                    yy = y;
+                    aplicar_op_indices( imagen, &preparadas[k], &yy, imagen->filas[y] );
+                }
+            }
+        }
+        free( preparadas );
+        return;
     }
 
-    /* verificar NOMBRE del archivo*/
-    if ( !salida )
+    for ( y = 0; y < imagen->infoheader.height; y++ )
     {
-        fprintf( stderr, "Error con el nombre para guardar\
-                            del archivo\n" );
-        return false;
+        for ( k = 0; k < nops; k++ )
+        {
+            yy = y;
+            aplicar_op_fila( imagen, &ops[k], &yy, imagen->pixels[y] );
+        }
     }
+}
+
+/*
+ * Completa los campos del header que dependen del tamaño de la imágen,
+ * antes de grabarla. Devuelve el tamaño de cada fila en el archivo, o
+ * 0 si la imágen no se puede grabar.
+ */
+uint32_t preparar_encabezados( bmp_t *imagen )
+{
+    uint32_t offset, fila_alineada;
 
     /* Control datos correctos */
     if ( !imagen->infoheader.width || !imagen->infoheader.height )
     {
-        fprintf( stderr, "El BMP debe tener un ancho y alto mayor que cero pixel\n" );
-        return false;
+        fprintf( salida_errores(), "El BMP debe tener un ancho y alto mayor que cero pixel\n" );
+        return 0;
     }
 
     /* SETTEAR algunos campos */
@@ -978,104 +1986,221 @@ bool grabar_archivo( bmp_t *imagen, const char *salida )
     imagen->infoheader.ncolores = imagen->paleta.cant;
     imagen->infoheader.n_colores_imp = imagen->infoheader.ncolores;
 
+    /*
+     * 32 BPP con alpha y 16 BPP que no es RGB555 llevan el header V4,
+     * que tiene las máscaras; todo lo demás, el de 40 bytes sin
+     * compresión.
+     */
+    if ( necesita_mascaras( imagen ) )
+    {
+        imagen->infoheader.header_sz = HEADER_V4;
+        imagen->infoheader.tipo_compres = BI_BITFIELDS;
+    }
+    else
+    {
+        imagen->infoheader.header_sz = sizeof( bitmapinfoheader );
+        imagen->infoheader.tipo_compres = BI_RGB;
+    }
+
     /* Offset al arreglo de pixeles --->
      * File header, 14 bytes
      * Size del info header
      * Mas el tamaño de la paleta (4 bytes para cada color, rgba)
     */
-    offset = 14 + sizeof( bitmapinfoheader )
+    offset = 14 + imagen->infoheader.header_sz
              + imagen->paleta.cant * 4UL;
 
-    /* tamño del arreglo de pixeles */
+    /* Tamaño de cada fila, y fila x altura = tamaño total */
+    fila_alineada = calcular_fila_alineada( imagen->infoheader.width,
+                                            imagen->infoheader.bitspp );
+    imagen->infoheader.bmp_bytesz = imagen->infoheader.height * fila_alineada;
+
+    imagen->fileheader.bmp_offset = offset;
+    imagen->fileheader.filesz = offset + imagen->infoheader.bmp_bytesz;
+
+    return fila_alineada;
+}
+
+/*
+ * Arma en un solo buffer el file header, el info header y la paleta,
+ * tal como van al principio del archivo: son bmp_offset bytes. Se
+ * libera con free.
+ */
+uint8_t *armar_encabezados( const bmp_t *imagen )
+{
+    const uint32_t mascaras[4] = { MASCARA_ROJO, MASCARA_VERDE, MASCARA_AZUL, MASCARA_ALFA };
+    const uint32_t espacio_srgb = 0x73524742; /* 'sRGB' */
+    uint8_t *encabezados, *p;
+    uint32_t extra;
 
-    /* Tamaño de cada fila */
-    fila_alineada = imagen->infoheader.width * imagen->infoheader.bitspp;
-    if ( fila_alineada % 32 )
+    if ( imagen->infoheader.bitspp <= 8 && ( !imagen->paleta.cant || !imagen->paleta.colores ) )
     {
-        fila_alineada += 32 - ( fila_alineada % 32 );
+        fprintf( salida_errores(), "Error escribiendo la plateta de colores del BMP\n" );
+        return NULL;
     }
 
-    /* Fila x altura = tamaño total en bits*/
-    tamanioimagen = imagen->infoheader.height * fila_alineada;
-    imagen->infoheader.bmp_bytesz = tamanioimagen / 8U;
-
-    imagen->fileheader.bmp_offset = offset;
-    imagen->fileheader.filesz = offset + tamanioimagen / 8U;
+    if ( ( encabezados = ( uint8_t * ) malloc( imagen->fileheader.bmp_offset ) ) == NULL )
+    {
+        fprintf( salida_errores(), "Error alocando memoria para los encabezados\n" );
+        return NULL;
+    }
 
-    /* abrir el archivo para escritura */
-    if ( ( fbmp = fopen( salida, "w" ) ) == NULL )
+    /* el magic va suelto para que el file header quede alineado */
+    p = encabezados;
+    memcpy( p, &imagen->magic, sizeof( imagen->magic ) );
+    p += sizeof( imagen->magic );
+    memcpy( p, &imagen->fileheader, sizeof( bitmapfileheader ) );
+    p += sizeof( bitmapfileheader );
+    memcpy( p, &imagen->infoheader, sizeof( bitmapinfoheader ) );
+    p += sizeof( bitmapinfoheader );
+
+    /*
+     * en el header V4: las máscaras, el espacio de color y el resto en
+     * 0. En 32 BPP la matriz se graba tal cual, con las de bmpcolor_t.
+     */
+    extra = imagen->infoheader.header_sz - sizeof( bitmapinfoheader );
+    if ( extra )
     {
-        fprintf( stderr, "Error al abrir %s para escribir\n", salida );
-        return false;
+        memset( p, 0, extra );
+        memcpy( p, imagen->infoheader.bitspp == 16 ? imagen->mascaras : mascaras, sizeof( mascaras ) );
+        memcpy( p + sizeof( mascaras ), &espacio_srgb, sizeof( espacio_srgb ) );
+        p += extra;
     }
 
-    if ( !grabar_file_header( fbmp, imagen ) )
+    if ( imagen->paleta.cant )
+        memcpy( p, imagen->paleta.colores, sizeof( bmpcolor_t ) * imagen->paleta.cant );
+
+    return encabezados;
+}
+
+/*
+ * Graba el archivo que estaba en la memoria en un .bmp, cuyo nombre se
+ * recibe como parámetro a la función.
+ */
+bool grabar_archivo( bmp_t *imagen, const char *salida )
+{
+    salida_bmp archivo;
+    struct iovec *partes, bloques[2];
+    uint32_t fila_alineada, filas_bloque, k, n;
+    int32_t y, alto;
+    uint8_t *encabezados, *bloque;
+    codificador_fila codificar;
+    codificador_indices codificar_indices;
+    bool ok;
+
+    /* verificar puntero no nulo */
+    if ( !imagen )
     {
-        fprintf( stderr, "Error escribiendo el encabezado del archivo BMP\n" );
-        fclose( fbmp );
+        fprintf( salida_errores(), "No hay BMP en memoria\n" );
         return false;
     }
 
-    if ( !grabar_info_header( fbmp, imagen ) )
+    /* verificar NOMBRE del archivo*/
+    if ( !salida )
     {
-        fprintf( stderr, "Error escribiendo el info header del BMP\n" );
-        fclose( fbmp );
+        fprintf( salida_errores(), "Error con el nombre para guardar\
+                            del archivo\n" );
         return false;
     }
 
-    if (! ( imagen->infoheader.bitspp == 24 ) ) {
-        if ( !imagen->paleta.cant || !imagen->paleta.colores ||
-                !grabar_paleta( fbmp, imagen ) )
+    if ( imagen->rle && ( imagen->infoheader.bitspp == 4 || imagen->infoheader.bitspp == 8 ) )
+        return grabar_rle( imagen, salida );
+
+    if ( ( fila_alineada = preparar_encabezados( imagen ) ) == 0 )
+        return false;
+
+    if ( ( encabezados = armar_encabezados( imagen ) ) == NULL )
+        return false;
+
+    alto = imagen->infoheader.height;
+    codificar = codificador_de( imagen );
+    codificar_indices = codificador_indices_de( imagen );
+
+    /*
+     * Con índices de 8BPP y un ancho múltiplo de 4, o con colores en
+     * 32BPP, las filas de la matriz ya son las del archivo: se graban
+     * con un solo writev, sin copiarlas, una parte por fila.
+     */
+    if ( ( es_indexada( imagen ) && imagen->infoheader.bitspp == 8 &&
+            fila_alineada == ( uint32_t ) imagen->infoheader.width ) ||
+            ( !es_indexada( imagen ) && imagen->infoheader.bitspp == 32 ) )
+    {
+        if ( ( partes = ( struct iovec * ) malloc( sizeof( struct iovec ) * ( alto + 1 ) ) ) == NULL )
         {
-            fprintf( stderr, "Error escribiendo la plateta de colores del BMP\n" );
-            fclose( fbmp );
+            fprintf( salida_errores(), "Error alocando memoria para grabar\n" );
+            free( encabezados );
             return false;
         }
-    }
-    switch(imagen->infoheader.bitspp) {
-    case 1: {
-        if(!grabar_pixels_1bpp(imagen, fbmp, fila_alineada/8UL)) {
-            fprintf( stderr, "Error guardando imagen\n" );
-            fclose( fbmp );
-            return false;
+        partes[0].iov_base = encabezados;
+        partes[0].iov_len = imagen->fileheader.bmp_offset;
+        for ( y = alto - 1, k = 1; y >= 0; y--, k++ )
+        {
+            partes[k].iov_base = es_indexada( imagen ) ? ( void * ) imagen->filas[y]
+                                 : ( void * ) imagen->pixels[y];
+            partes[k].iov_len = fila_alineada;
         }
-        break;
+
+        ok = abrir_salida( &archivo, salida );
+        if ( ok )
+            ok = cerrar_salida( &archivo, escribir_salida( &archivo, partes, alto + 1 ) );
+        free( partes );
+        free( encabezados );
+        return ok;
     }
-    case 8: {
-        if(!grabar_pixels_8bpp(imagen, fbmp, fila_alineada/8UL)) {
-            fprintf( stderr, "Error guardando imagen\n" );
-            fclose( fbmp );
-            return false;
-        }
-        break;
+
+    /* si no, se codifican bloques grandes de filas y cada uno es un writev */
+    filas_bloque = BLOQUE_SALIDA / fila_alineada;
+    if ( filas_bloque == 0 )
+        filas_bloque = 1;
+    if ( filas_bloque > ( uint32_t ) alto )
+        filas_bloque = alto;
+
+    /* el padding queda en cero: los codificadores no lo tocan */
+    if ( ( bloque = ( uint8_t * ) calloc( filas_bloque, fila_alineada ) ) == NULL )
+    {
+        fprintf( salida_errores(), "Error alocando memoria para grabar\n" );
+        free( encabezados );
+        return false;
     }
-    case 24: {
-        if(!grabar_pixels_24bpp(imagen, fbmp, fila_alineada/8UL)) {
-            fprintf( stderr, "Error guardando imagen\n" );
-            fclose( fbmp );
-            return false;
-        }
-        break;
-    } // 24
-    } // Switch
 
-    fclose( fbmp );
-    return true;
-} // Grabar pixels
+    if ( !abrir_salida( &archivo, salida ) )
+    {
+        free( bloque );
+        free( encabezados );
+        return false;
+    }
 
+    bloques[0].iov_base = encabezados;
+    bloques[0].iov_len = imagen->fileheader.bmp_offset;
 
-/*
- * Graba la paleta de colores en el archivo.
- */
-bool grabar_paleta( FILE *fbmp, const bmp_t *imagen )
-{
-    uint32_t ncolores = imagen->paleta.cant;
+    /* las filas se graban de abajo hacia arriba */
+    ok = true;
+    for ( y = alto - 1; ok && y >= 0; y -= n )
+    {
+        n = ( uint32_t ) y + 1 < filas_bloque ? ( uint32_t ) y + 1 : filas_bloque;
+        for ( k = 0; k < n; k++ )
+        {
+            if ( es_indexada( imagen ) )
+                codificar_indices( imagen, imagen->filas[y - k], bloque + ( size_t ) k * fila_alineada );
+            else
+                codificar( imagen, imagen->pixels[y - k], bloque + ( size_t ) k * fila_alineada );
+        }
 
-    if ( fwrite( imagen->paleta.colores, sizeof( bmpcolor_t ), ncolores, fbmp ) != ncolores )
-        return false;
+        /* los encabezados salen con el primer bloque */
+        bloques[1].iov_base = bloque;
+        bloques[1].iov_len = ( size_t ) n * fila_alineada;
+        if ( y == alto - 1 )
+            ok = escribir_salida( &archivo, bloques, 2 );
+        else
+            ok = escribir_salida( &archivo, &bloques[1], 1 );
+    }
+
+    ok = cerrar_salida( &archivo, ok );
+    free( bloque );
+    free( encabezados );
+    return ok;
+} // Grabar archivo
 
-    return true;
-}
 
 /*
  * Destruye el BMP de la memoria.
@@ -1085,8 +2210,10 @@ bool destruir_bmp( bmp_t *imagen )
     if ( imagen->paleta.cant && imagen->paleta.colores )
         free( imagen->paleta.colores );
 
-    if ( imagen->pixels )
-        liberar_pixels( imagen );
+    destruir_indice_paleta( imagen->indice );
+    cerrar_fuente( &imagen->fuente );
+
+    liberar_pixels( imagen );
 
     free( imagen );
     imagen = NULL;
@@ -1095,160 +2222,192 @@ bool destruir_bmp( bmp_t *imagen )
 }
 
 /*
- * Libera el arreglo de colores de la memoria.
+ * Libera el arreglo de colores (o de índices) de la memoria.
  */
-void liberar_pixels( const bmp_t *imagen )
+void liberar_pixels( bmp_t *imagen )
 {
-    int32_t i;
-    for ( i = 0; i < imagen->infoheader.height; i++ )
-    {
-        free( imagen->pixels[i] );
-    }
-
     free( imagen->pixels );
+    devolver_bloque( imagen->datos );
+    free( imagen->filas );
+    devolver_bloque( imagen->indices );
+    imagen->pixels = NULL;
+    imagen->datos = NULL;
+    imagen->filas = NULL;
+    imagen->indices = NULL;
 }
 
 
 
 
 /*
- * Graba el file header en un archivo.
+ * Codifica una fila de colores en el formato de 1BPP: un bit por
+ * píxel, con el índice del color en la paleta.
  */
-bool grabar_file_header( FILE *fbmp, bmp_t *imagen )
+void grabar_pixels_1bpp( const bmp_t *imagen, const bmpcolor_t *origen, uint8_t *destino )
 {
-    if ( fwrite( &imagen->magic, sizeof( imagen->magic ), 1, fbmp ) != 1 )
-        return false;
-
-    if ( fwrite( &imagen->fileheader.filesz, sizeof( imagen->fileheader.filesz ), 1, fbmp ) != 1 )
-        return false;
+    long x;
+    long   nshift;
+    uint8_t  ctmp;
 
-    if ( fwrite( &imagen->fileheader.reserved, sizeof( imagen->fileheader.reserved ), 1, fbmp ) != 1 )
-        return false;
+    int32_t ancho  = imagen->infoheader.width;
 
-    if ( fwrite( &imagen->fileheader.bmp_offset, sizeof( imagen->fileheader.bmp_offset ), 1, fbmp ) != 1 )
-        return false;
+    ctmp = 0;
+    for ( x = 0L, nshift = 8L; x < ancho; x++ )
+    {
+        if ( !nshift )
+        {
+            nshift = 8L;
+            *destino++ = ctmp;
+            ctmp = 0;
+        }
 
+        ctmp |= ( ( uint8_t ) coloresde_paleta( imagen, origen[x] ) << --nshift );
+    }
 
-    return true;
+    *destino = ctmp;
 }
 
+
 /*
- * Graba el info header en un archivo.
+ * Codifica una fila de colores en el formato de 4BPP: dos píxeles por
+ * byte, con el índice del color en la paleta.
  */
-bool grabar_info_header( FILE *fbmp, bmp_t *imagen )
+void grabar_pixels_4bpp( const bmp_t *imagen, const bmpcolor_t *origen, uint8_t *destino )
 {
-    if ( fwrite( &imagen->infoheader, sizeof( imagen->infoheader ), 1, fbmp ) != 1 )
-        return false;
+    int32_t x, ancho = imagen->infoheader.width;
 
-    return true;
+    memset( destino, 0, ( ancho + 1 ) / 2 );
+    for ( x = 0; x < ancho; x++ )
+        destino[x >> 1] |= ( coloresde_paleta( imagen, origen[x] ) & 0x0F ) << ( x & 1 ? 0 : 4 );
 }
 
-
 /*
- * Graba la matriz de píxeles que estaba en memoria, en un archivo.
- * En este caso se trata de imágenes de 1BPP
+ * Codifica una fila de colores en el formato de 8BPP: un byte por
+ * píxel, con el índice del color en la paleta.
  */
-bool grabar_pixels_1bpp( bmp_t *imagen, FILE *fbmp, uint32_t alineada )
+void grabar_pixels_8bpp( const bmp_t *imagen, const bmpcolor_t *origen, uint8_t *destino )
 {
-    long x, y;
-    uint8_t *punt;
-    long   nshift;
-    uint8_t  ctmp;
-
-    int32_t alto = imagen->infoheader.height;
+    long x;
     int32_t ancho  = imagen->infoheader.width;
 
-    uint8_t bufferfila[alineada];;
-    bzero( bufferfila, alineada );
-
-    for ( y = alto - 1; y >= 0L; y-- ) /* bucle para las filas */
-    {
-        punt = bufferfila;
-        ctmp = 0;
+    for ( x = 0L; x < ancho; x++ )
+        *destino++ = coloresde_paleta( imagen, origen[x] );
+}
 
-        for ( x = 0L, nshift = 8L; x < ancho; x++ )
-        {
-            if ( !nshift )
-            {
-                nshift = 8L;
-                *punt++ = ctmp;
-                ctmp = 0;
-            }
 
-            ctmp |= ( ( uint8_t ) coloresde_paleta( imagen, imagen->pixels[y][x] ) << --nshift );
-        }
+/*
+ * Codifica una fila de colores en 16BPP con las máscaras de la imágen
+ * (RGB555, RGB565 o las que tenía el archivo).
+ */
+void grabar_pixels_16bpp( const bmp_t *imagen, const bmpcolor_t *origen, uint8_t *destino )
+{
+    uint32_t desplazamiento[4], bits[4], c;
+    const uint32_t *m = imagen->mascaras;
+    int32_t x, ancho = imagen->infoheader.width;
+    uint16_t pixel;
 
-        *punt = ctmp;
-        fwrite( bufferfila, sizeof( uint8_t ), alineada, fbmp );
+    for ( c = 0; c < 4; c++ )
+        medir_mascara( m[c], &desplazamiento[c], &bits[c] );
 
+    for ( x = 0; x < ancho; x++, destino += sizeof( pixel ) )
+    {
+        pixel = guardar_canal( origen[x].red,   desplazamiento[0], bits[0] ) |
+                guardar_canal( origen[x].green, desplazamiento[1], bits[1] ) |
+                guardar_canal( origen[x].blue,  desplazamiento[2], bits[2] ) |
+                guardar_canal( origen[x].alpha, desplazamiento[3], bits[3] );
+        memcpy( destino, &pixel, sizeof( pixel ) );
     }
-
-    return true;
 }
 
-
 /*
- * Graba la matriz de píxeles que estaba en memoria, en un archivo.
- * En este caso se trata de imágenes de 8BPP
+ * Codifica una fila de colores en el formato de 24BPP: azul, verde y
+ * rojo.
  */
-bool grabar_pixels_8bpp( bmp_t *imagen, FILE *fbmp, uint32_t alineada )
+void grabar_pixels_24bpp( const bmp_t *imagen, const bmpcolor_t *origen, uint8_t *destino )
 {
-    long x, y;
-    uint8_t *punt;
-
-    int32_t alto = imagen->infoheader.height;
-    int32_t ancho  = imagen->infoheader.width;
+    empaquetar_bgr( origen, destino, imagen->infoheader.width );
+}
 
-    uint8_t bufferfila[alineada];
-    bzero( bufferfila, alineada );
+/*
+ * Una fila de colores ya está en el formato de 32BPP (se graba siempre
+ * con las máscaras de bmpcolor_t).
+ */
+void grabar_pixels_32bpp( const bmp_t *imagen, const bmpcolor_t *origen, uint8_t *destino )
+{
+    memcpy( destino, origen, sizeof( bmpcolor_t ) * imagen->infoheader.width );
+}
 
-    for ( y = alto - 1 ; y >= 0L; y-- ) /* Loop de las filas! */
+/*
+ * Devuelve la función que codifica una fila según los BPP de la
+ * imágen, o NULL si no está soportada.
+ */
+codificador_fila codificador_de( const bmp_t *imagen )
+{
+    switch ( imagen->infoheader.bitspp )
     {
-        punt = bufferfila;
-        for ( x = 0L; x < ancho; x++ )
-        {
-            *punt++ = coloresde_paleta( imagen, imagen->pixels[y][x] );
-        }
-
-        fwrite( bufferfila, sizeof( uint8_t ), alineada, fbmp );
-
+    case 1:
+        return grabar_pixels_1bpp;
+    case 4:
+        return grabar_pixels_4bpp;
+    case 8:
+        return grabar_pixels_8bpp;
+    case 16:
+        return grabar_pixels_16bpp;
+    case 24:
+        return grabar_pixels_24bpp;
+    case 32:
+        return grabar_pixels_32bpp;
     }
-
-    return true;
+    return NULL;
 }
 
-
 /*
- * Graba la matriz de píxeles que estaba en memoria, en un archivo.
- * En este caso se trata de imágenes de 24BPP
+ * Pasa una fila de índices al formato de 1BPP: un bit por píxel.
  */
-bool grabar_pixels_24bpp( bmp_t *imagen, FILE *fbmp, uint32_t alineada )
+void grabar_indices_1bpp( const bmp_t *imagen, const uint8_t *origen, uint8_t *destino )
 {
-    long x, y;
-    uint8_t *punt;
-
-    int32_t alto = imagen->infoheader.height;
-    int32_t ancho  = imagen->infoheader.width;
+    int32_t x, ancho = imagen->infoheader.width;
 
-    uint8_t bufferfila[alineada];
-    bzero( bufferfila, alineada );
+    memset( destino, 0, ( ancho + 7 ) / 8 );
+    for ( x = 0; x < ancho; x++ )
+        destino[x >> 3] |= ( origen[x] & 1 ) << ( 7 - ( x & 7 ) );
+}
 
-    for ( y = alto - 1 ; y >= 0L; y-- ) /* Loop de las filas! */
-    {
-        punt = bufferfila;
-        bmpcolor_t color;
-        for ( x = 0L; x < ancho; x++ )
-        {
-            color = imagen->pixels[y][x];
+/*
+ * Pasa una fila de índices al formato de 4BPP: dos píxeles por byte.
+ */
+void grabar_indices_4bpp( const bmp_t *imagen, const uint8_t *origen, uint8_t *destino )
+{
+    int32_t x, ancho = imagen->infoheader.width;
 
-            *punt++ = color.blue;
-            *punt++ = color.green;
-            *punt++ = color.red;
-        }
+    for ( x = 0; x + 1 < ancho; x += 2 )
+        *destino++ = ( origen[x] & 0x0F ) << 4 | ( origen[x + 1] & 0x0F );
+    if ( x < ancho )
+        *destino = ( origen[x] & 0x0F ) << 4;
+}
 
-        fwrite( bufferfila, sizeof( uint8_t ), alineada, fbmp );
+/*
+ * Una fila de índices ya está en el formato de 8BPP.
+ */
+void grabar_indices_8bpp( const bmp_t *imagen, const uint8_t *origen, uint8_t *destino )
+{
+    memcpy( destino, origen, imagen->infoheader.width );
+}
 
+/*
+ * Devuelve la función que pasa una fila de índices al formato del
+ * archivo, o NULL si la imágen no tiene paleta.
+ */
+codificador_indices codificador_indices_de( const bmp_t *imagen )
+{
+    switch ( imagen->infoheader.bitspp )
+    {
+    case 1:
+        return grabar_indices_1bpp;
+    case 4:
+        return grabar_indices_4bpp;
+    case 8:
+        return grabar_indices_8bpp;
     }
-
-    return true;
+    return NULL;
 }
@@ -0,0 +1,719 @@
+/***********************************************************************
+ *
+ * Módulo: Redimensionado. Los factores enteros tienen sus propios
+ *         núcleos, que trabajan con filas enteras. Para cualquier otro
+ *         tamaño, los pesos de cada filtro se calculan una sola vez por
+ *         columna y por fila de la salida, y la imágen se filtra en dos
+ *         pasadas separadas: primero en horizontal y después en
+ *         vertical, las dos por bandas de filas en el pool de hilos.
+ * Autor:  Martín Aguilar
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "../headers/bmp.h"
+#include "../headers/bmp_interno.h"
+#include "../headers/pool.h"
+#include "../headers/simd.h"
+#include "../headers/errores.h"
+
+/* Filas por banda en las dos pasadas */
+#define FILAS_BANDA_ESCALA 16
+
+/* Radio de Lanczos: lóbulos a cada lado del centro */
+#define LADOS_LANCZOS 3
+
+/*
+ * Pesos de un eje: para cada píxel de la salida, el primer píxel de la
+ * entrada que usa ("inicio") y "taps" pesos en punto fijo, uno por cada
+ * píxel desde ese. Todos los píxeles usan la misma cantidad de pesos
+ * (los que sobran quedan en cero), así las pasadas no tienen casos
+ * especiales en los bordes.
+ */
+typedef struct
+{
+    int32_t *inicio;
+    int16_t *pesos;
+    uint32_t taps;
+} pesos_eje;
+
+/*
+ * Contexto de una pasada: las filas de origen y de destino, el ancho
+ * de la salida y los pesos del eje que se filtra.
+ */
+typedef struct
+{
+    bmpcolor_t      **origen;
+    bmpcolor_t      **destino;
+    int32_t           ancho;
+    const pesos_eje  *eje;
+} contexto_escala;
+
+/*
+ * Contexto del vecino más cercano: para cada columna y fila de la
+ * salida, la de la entrada que se copia.
+ */
+typedef struct
+{
+    const bmp_t   *imagen;
+    bmpcolor_t   **destino;
+    uint8_t      **destino_indices;
+    const int32_t *columnas;
+    const int32_t *filas;
+    int32_t        ancho;
+} contexto_cercano;
+
+/*
+ * Contexto de los factores enteros: la imágen original, las filas de
+ * destino (de colores o de índices), el ancho de la salida y los
+ * factores de cada eje.
+ */
+typedef struct
+{
+    const bmp_t   *imagen;
+    bmpcolor_t   **destino;
+    uint8_t      **destino_indices;
+    int32_t        ancho;
+    uint32_t       nx;
+    uint32_t       ny;
+} contexto_entero;
+
+// ENCABEZADOS FUNCIONES
+
+void replicar_banda( void *ctx, uint32_t desde, uint32_t hasta );
+
+void promediar_banda( void *ctx, uint32_t desde, uint32_t hasta );
+
+double soporte_filtro( const filtro_escala filtro );
+
+double valor_filtro( const filtro_escala filtro, double x );
+
+bool calcular_pesos( pesos_eje *eje,
+                     const int32_t entrada,
+                     const int32_t salida,
+                     const filtro_escala filtro );
+
+void liberar_pesos( pesos_eje *eje );
+
+int32_t *calcular_cercanos( const int32_t entrada, const int32_t salida );
+
+void horizontal_banda( void *ctx, uint32_t desde, uint32_t hasta );
+
+void vertical_banda( void *ctx, uint32_t desde, uint32_t hasta );
+
+void cercano_banda( void *ctx, uint32_t desde, uint32_t hasta );
+
+void escalar_cercano( bmp_t *const imagen, const int32_t ancho, const int32_t alto );
+
+void escalar_filtrado( bmp_t *const imagen,
+                       const int32_t ancho,
+                       const int32_t alto,
+                       const filtro_escala filtro );
+
+// FIN ENCABEZADOS
+
+
+/*
+ * Medio ancho del filtro, en píxeles de la entrada cuando se agranda.
+ */
+double soporte_filtro( const filtro_escala filtro )
+{
+    switch ( filtro )
+    {
+    case FILTRO_BILINEAL:
+        return 1.0;
+    case FILTRO_LANCZOS:
+        return LADOS_LANCZOS;
+    default:
+        return 0.5;
+    }
+}
+
+/*
+ * Valor del filtro a una distancia x del centro.
+ */
+double valor_filtro( const filtro_escala filtro, double x )
+{
+    double px;
+
+    switch ( filtro )
+    {
+    case FILTRO_BILINEAL:
+        x = fabs( x );
+        return x < 1.0 ? 1.0 - x : 0.0;
+    case FILTRO_LANCZOS:
+        if ( x == 0.0 )
+            return 1.0;
+        if ( x <= -LADOS_LANCZOS || x >= LADOS_LANCZOS )
+            return 0.0;
+        px = M_PI * x;
+        return LADOS_LANCZOS * sin( px ) * sin( px / LADOS_LANCZOS ) / ( px * px );
+    default:
+        return x >= -0.5 && x < 0.5 ? 1.0 : 0.0;
+    }
+}
+
+/*
+ * Calcula los pesos de un eje que pasa de "entrada" a "salida" píxeles.
+ * El centro del píxel i de la salida cae en (i + 0.5) * escala de la
+ * entrada; al achicar, el filtro se estira por la escala para que
+ * cubra todos los píxeles que caen en el de la salida. Los pesos de
+ * cada píxel se normalizan para que sumen exactamente UNO_PESO.
+ */
+bool calcular_pesos( pesos_eje *eje,
+                     const int32_t entrada,
+                     const int32_t salida,
+                     const filtro_escala filtro )
+{
+    double escala, factor, soporte, centro, total, *reales;
+    int32_t i, x, xmin, xmax, mayor, suma;
+    int16_t *p;
+
+    escala = ( double ) entrada / salida;
+    factor = escala > 1.0 ? escala : 1.0;
+    soporte = soporte_filtro( filtro ) * factor;
+
+    eje->taps = ( uint32_t ) ceil( soporte ) * 2 + 1;
+    if ( eje->taps > ( uint32_t ) entrada )
+        eje->taps = entrada;
+
+    eje->inicio = ( int32_t * ) malloc( sizeof( int32_t ) * salida );
+    eje->pesos = ( int16_t * ) calloc( ( size_t ) salida * eje->taps, sizeof( int16_t ) );
+    reales = ( double * ) malloc( sizeof( double ) * eje->taps );
+    if ( eje->inicio == NULL || eje->pesos == NULL || reales == NULL )
+    {
+        fprintf( salida_errores(), "Error alocando memoria para los pesos del filtro\n" );
+        free( reales );
+        liberar_pesos( eje );
+        return false;
+    }
+
+    for ( i = 0; i < salida; i++ )
+    {
+        centro = ( i + 0.5 ) * escala;
+        xmin = ( int32_t ) floor( centro - soporte + 0.5 );
+        xmax = ( int32_t ) floor( centro + soporte + 0.5 );
+        if ( xmin < 0 )
+            xmin = 0;
+        if ( xmax > entrada )
+            xmax = entrada;
+
+        /* la ventana de taps tiene que quedar entera dentro de la entrada */
+        eje->inicio[i] = xmin;
+        if ( eje->inicio[i] + ( int32_t ) eje->taps > entrada )
+            eje->inicio[i] = entrada - eje->taps;
+
+        total = 0.0;
+        memset( reales, 0, sizeof( double ) * eje->taps );
+        for ( x = xmin; x < xmax; x++ )
+        {
+            reales[x - eje->inicio[i]] = valor_filtro( filtro, ( x - centro + 0.5 ) / factor );
+            total += reales[x - eje->inicio[i]];
+        }
+
+        /* punto fijo: lo que se pierde al redondear va al peso mayor */
+        p = eje->pesos + ( size_t ) i * eje->taps;
+        suma = 0;
+        mayor = 0;
+        for ( x = 0; x < ( int32_t ) eje->taps; x++ )
+        {
+            if ( total != 0.0 )
+                p[x] = ( int16_t ) lround( reales[x] / total * UNO_PESO );
+            suma += p[x];
+            if ( p[x] > p[mayor] )
+                mayor = x;
+        }
+        if ( suma == 0 )
+        {
+            /* ventana vacía: se copia el píxel más cercano al centro */
+            x = ( int32_t ) centro - eje->inicio[i];
+            mayor = x < 0 ? 0 : ( x >= ( int32_t ) eje->taps ? ( int32_t ) eje->taps - 1 : x );
+        }
+        p[mayor] += UNO_PESO - suma;
+    }
+
+    free( reales );
+    return true;
+}
+
+void liberar_pesos( pesos_eje *eje )
+{
+    free( eje->inicio );
+    free( eje->pesos );
+    eje->inicio = NULL;
+    eje->pesos = NULL;
+}
+
+/*
+ * Para cada píxel de la salida, el de la entrada cuyo centro está más
+ * cerca.
+ */
+int32_t *calcular_cercanos( const int32_t entrada, const int32_t salida )
+{
+    int32_t *cercanos, i, x;
+
+    if ( ( cercanos = ( int32_t * ) malloc( sizeof( int32_t ) * salida ) ) == NULL )
+    {
+        fprintf( salida_errores(), "Error alocando memoria para redimensionar\n" );
+        return NULL;
+    }
+    for ( i = 0; i < salida; i++ )
+    {
+        x = ( int32_t ) ( ( ( int64_t ) 2 * i + 1 ) * entrada / ( 2 * ( int64_t ) salida ) );
+        cercanos[i] = x < entrada ? x : entrada - 1;
+    }
+    return cercanos;
+}
+
+/*
+ * Pasada horizontal sobre las filas [desde, hasta) de la entrada.
+ */
+void horizontal_banda( void *ctx, uint32_t desde, uint32_t hasta )
+{
+    const contexto_escala *c = ( const contexto_escala * ) ctx;
+    uint32_t y;
+
+    for ( y = desde; y < hasta; y++ )
+        filtrar_fila( c->origen[y], c->destino[y], c->ancho,
+                      c->eje->inicio, c->eje->pesos, c->eje->taps );
+}
+
+/*
+ * Pasada vertical sobre las filas [desde, hasta) de la salida: cada
+ * fila es la suma pesada de "taps" filas enteras de la pasada
+ * horizontal, así que se recorre la memoria siempre de a filas. Se
+ * acumulan los cuatro bytes de cada píxel, alpha incluido.
+ */
+void vertical_banda( void *ctx, uint32_t desde, uint32_t hasta )
+{
+    const contexto_escala *c = ( const contexto_escala * ) ctx;
+    const int16_t *p;
+    size_t bytes;
+    int32_t *suma;
+    uint32_t y, k;
+
+    bytes = ( size_t ) c->ancho * sizeof( bmpcolor_t );
+    if ( ( suma = ( int32_t * ) malloc( sizeof( int32_t ) * bytes ) ) == NULL )
+    {
+        fprintf( salida_errores(), "Error alocando memoria para redimensionar\n" );
+        return;
+    }
+
+    for ( y = desde; y < hasta; y++ )
+    {
+        memset( suma, 0, sizeof( int32_t ) * bytes );
+        p = c->eje->pesos + ( size_t ) y * c->eje->taps;
+        for ( k = 0; k < c->eje->taps; k++ )
+            if ( p[k] )
+                acumular_fila( suma, ( const uint8_t * ) c->origen[c->eje->inicio[y] + k],
+                               p[k], bytes );
+        saturar_fila( suma, ( uint8_t * ) c->destino[y], bytes );
+    }
+
+    free( suma );
+}
+
+/*
+ * Vecino más cercano sobre las filas [desde, hasta) de la salida, en
+ * colores o en índices.
+ */
+void cercano_banda( void *ctx, uint32_t desde, uint32_t hasta )
+{
+    const contexto_cercano *c = ( const contexto_cercano * ) ctx;
+    const bmpcolor_t *origen;
+    const uint8_t *origen_indices;
+    int32_t x;
+    uint32_t y;
+
+    for ( y = desde; y < hasta; y++ )
+    {
+        if ( c->destino_indices != NULL )
+        {
+            origen_indices = c->imagen->filas[c->filas[y]];
+            for ( x = 0; x < c->ancho; x++ )
+                c->destino_indices[y][x] = origen_indices[c->columnas[x]];
+        }
+        else
+        {
+            origen = c->imagen->pixels[c->filas[y]];
+            for ( x = 0; x < c->ancho; x++ )
+                c->destino[y][x] = origen[c->columnas[x]];
+        }
+    }
+}
+
+/*
+ * Vecino más cercano: no crea colores, así que las imágenes con
+ * paleta se escalan sin dejar de ser índices.
+ */
+void escalar_cercano( bmp_t *const imagen, const int32_t ancho, const int32_t alto )
+{
+    contexto_cercano ctx;
+    matriz_pixels matriz;
+    matriz_indices indices;
+    int32_t *columnas, *filas;
+
+    columnas = calcular_cercanos( imagen->infoheader.width, ancho );
+    filas = calcular_cercanos( imagen->infoheader.height, alto );
+    if ( columnas == NULL || filas == NULL )
+    {
+        free( columnas );
+        free( filas );
+        return;
+    }
+
+    ctx.imagen = imagen;
+    ctx.destino = NULL;
+    ctx.destino_indices = NULL;
+    ctx.columnas = columnas;
+    ctx.filas = filas;
+    ctx.ancho = ancho;
+
+    if ( es_indexada( imagen ) )
+    {
+        if ( crear_matriz_indices( &indices, ancho, alto ) )
+        {
+            ctx.destino_indices = indices.filas;
+            pool_paralelo( alto, FILAS_BANDA_ESCALA, cercano_banda, &ctx );
+            reemplazar_indices( imagen, &indices, ancho, alto );
+        }
+        else
+            fprintf( salida_errores(), "Error alocando memoria para los pixels\n" );
+    }
+    else
+    {
+        if ( crear_matriz_pixels( &matriz, ancho, alto ) )
+        {
+            ctx.destino = matriz.pixels;
+            pool_paralelo( alto, FILAS_BANDA_ESCALA, cercano_banda, &ctx );
+            reemplazar_pixels( imagen, &matriz, ancho, alto );
+        }
+        else
+            fprintf( salida_errores(), "Error alocando memoria para los pixels\n" );
+    }
+
+    free( columnas );
+    free( filas );
+}
+
+/*
+ * Caja, bilineal y Lanczos: las dos pasadas con los pesos calculados.
+ * La intermedia tiene el ancho nuevo y el alto original.
+ */
+void escalar_filtrado( bmp_t *const imagen,
+                       const int32_t ancho,
+                       const int32_t alto,
+                       const filtro_escala filtro )
+{
+    pesos_eje horizontal, vertical;
+    matriz_pixels intermedia, matriz;
+    contexto_escala ctx;
+
+    /* los promedios crean colores nuevos */
+    if ( !expandir_a_colores( imagen ) )
+        return;
+
+    if ( !calcular_pesos( &horizontal, imagen->infoheader.width, ancho, filtro ) )
+        return;
+    if ( !calcular_pesos( &vertical, imagen->infoheader.height, alto, filtro ) )
+    {
+        liberar_pesos( &horizontal );
+        return;
+    }
+
+    if ( !crear_matriz_pixels( &intermedia, ancho, imagen->infoheader.height ) )
+    {
+        fprintf( salida_errores(), "Error alocando memoria para los pixels\n" );
+        liberar_pesos( &horizontal );
+        liberar_pesos( &vertical );
+        return;
+    }
+    if ( !crear_matriz_pixels( &matriz, ancho, alto ) )
+    {
+        fprintf( salida_errores(), "Error alocando memoria para los pixels\n" );
+        liberar_matriz( &intermedia );
+        liberar_pesos( &horizontal );
+        liberar_pesos( &vertical );
+        return;
+    }
+
+    ctx.origen = imagen->pixels;
+    ctx.destino = intermedia.pixels;
+    ctx.ancho = ancho;
+    ctx.eje = &horizontal;
+    pool_paralelo( imagen->infoheader.height, FILAS_BANDA_ESCALA, horizontal_banda, &ctx );
+
+    ctx.origen = intermedia.pixels;
+    ctx.destino = matriz.pixels;
+    ctx.eje = &vertical;
+    pool_paralelo( alto, FILAS_BANDA_ESCALA, vertical_banda, &ctx );
+
+    reemplazar_pixels( imagen, &matriz, ancho, alto );
+    liberar_matriz( &intermedia );
+    liberar_pesos( &horizontal );
+    liberar_pesos( &vertical );
+}
+
+/*
+ * Agranda las filas [desde, hasta) de la original: cada una se arma
+ * una vez repitiendo los píxeles, y las demás copias de la fila son
+ * memcpy de la primera.
+ */
+void replicar_banda( void *ctx, uint32_t desde, uint32_t hasta )
+{
+    const contexto_entero *c = ( const contexto_entero * ) ctx;
+    const bmpcolor_t *origen;
+    const uint8_t *origen_indices;
+    bmpcolor_t *fila;
+    uint8_t *fila_indices;
+    int32_t x, ancho;
+    uint32_t y, k;
+
+    ancho = c->imagen->infoheader.width;
+    for ( y = desde; y < hasta; y++ )
+    {
+        if ( c->destino_indices != NULL )
+        {
+            origen_indices = c->imagen->filas[y];
+            fila_indices = c->destino_indices[y * c->ny];
+            for ( x = 0; x < ancho; x++ )
+                memset( fila_indices + ( size_t ) x * c->nx, origen_indices[x], c->nx );
+            for ( k = 1; k < c->ny; k++ )
+                memcpy( c->destino_indices[y * c->ny + k], fila_indices, c->ancho );
+        }
+        else
+        {
+            origen = c->imagen->pixels[y];
+            fila = c->destino[y * c->ny];
+            for ( x = 0; x < ancho; x++ )
+                for ( k = 0; k < c->nx; k++ )
+                    fila[( size_t ) x * c->nx + k] = origen[x];
+            for ( k = 1; k < c->ny; k++ )
+                memcpy( c->destino[y * c->ny + k], fila, sizeof( bmpcolor_t ) * c->ancho );
+        }
+    }
+}
+
+/*
+ * Achica las filas [desde, hasta) de la salida: las filas del bloque
+ * se suman enteras, byte a byte, y después se suman las columnas de
+ * cada bloque y se divide (redondeando) por lo que tenga el bloque.
+ */
+void promediar_banda( void *ctx, uint32_t desde, uint32_t hasta )
+{
+    const contexto_entero *c = ( const contexto_entero * ) ctx;
+    const bmp_t *imagen = c->imagen;
+    int32_t *suma, x, xx, x0, x1, y0, y1, ancho, alto, canal, cont, total;
+    uint8_t *destino;
+    uint32_t j;
+
+    ancho = imagen->infoheader.width;
+    alto = imagen->infoheader.height;
+    if ( ( suma = ( int32_t * ) malloc( sizeof( int32_t ) * 4 * ancho ) ) == NULL )
+    {
+        fprintf( salida_errores(), "Error alocando memoria para redimensionar\n" );
+        return;
+    }
+
+    for ( j = desde; j < hasta; j++ )
+    {
+        y0 = j * c->ny;
+        y1 = y0 + ( int32_t ) c->ny < alto ? y0 + ( int32_t ) c->ny : alto;
+
+        memset( suma, 0, sizeof( int32_t ) * 4 * ancho );
+        for ( ; y0 < y1; y0++ )
+            acumular_fila( suma, ( const uint8_t * ) imagen->pixels[y0], 1,
+                           sizeof( bmpcolor_t ) * ancho );
+        y0 = j * c->ny;
+
+        destino = ( uint8_t * ) c->destino[j];
+        for ( x = 0; x < c->ancho; x++ )
+        {
+            x0 = x * c->nx;
+            x1 = x0 + ( int32_t ) c->nx < ancho ? x0 + ( int32_t ) c->nx : ancho;
+            cont = ( x1 - x0 ) * ( y1 - y0 );
+            for ( canal = 0; canal < 4; canal++ )
+            {
+                total = 0;
+                for ( xx = x0; xx < x1; xx++ )
+                    total += suma[4 * xx + canal];
+                destino[4 * x + canal] = ( total + cont / 2 ) / cont;
+            }
+        }
+    }
+
+    free( suma );
+}
+
+/*
+ * Agranda la imágen "nx" veces en horizontal y "ny" en vertical,
+ * repitiendo cada píxel. No crea colores, así que las imágenes con
+ * paleta siguen siendo índices.
+ */
+void ampliar_entero( bmp_t *const imagen, const uint32_t nx, const uint32_t ny )
+{
+    contexto_entero ctx;
+    matriz_pixels matriz;
+    matriz_indices indices;
+    int64_t ancho, alto;
+
+    ancho = ( int64_t ) imagen->infoheader.width * nx;
+    alto = ( int64_t ) imagen->infoheader.height * ny;
+    if ( ancho > INT32_MAX || alto > INT32_MAX )
+    {
+        fprintf( salida_errores(), "La imagen queda demasiado grande\n" );
+        return;
+    }
+
+    ctx.imagen = imagen;
+    ctx.destino = NULL;
+    ctx.destino_indices = NULL;
+    ctx.ancho = ancho;
+    ctx.nx = nx;
+    ctx.ny = ny;
+
+    /* cada banda arma filas de la salida enteras: se reparten las de la original */
+    if ( es_indexada( imagen ) )
+    {
+        if ( !crear_matriz_indices( &indices, ancho, alto ) )
+        {
+            fprintf( salida_errores(), "Error alocando memoria para los pixels\n" );
+            return;
+        }
+        ctx.destino_indices = indices.filas;
+        pool_paralelo( imagen->infoheader.height, FILAS_BANDA_ESCALA, replicar_banda, &ctx );
+        reemplazar_indices( imagen, &indices, ancho, alto );
+    }
+    else
+    {
+        if ( !crear_matriz_pixels( &matriz, ancho, alto ) )
+        {
+            fprintf( salida_errores(), "Error alocando memoria para los pixels\n" );
+            return;
+        }
+        ctx.destino = matriz.pixels;
+        pool_paralelo( imagen->infoheader.height, FILAS_BANDA_ESCALA, replicar_banda, &ctx );
+        reemplazar_pixels( imagen, &matriz, ancho, alto );
+    }
+
+    /* el tamaño se va a cambiar al guardar el archivo */
+    imagen->infoheader.hres = imagen->infoheader.hres * ( int32_t ) nx;
+    imagen->infoheader.vres = imagen->infoheader.vres * ( int32_t ) ny;
+}
+
+/*
+ * Achica la imágen "nx" veces en horizontal y "ny" en vertical: cada
+ * píxel es el promedio de un bloque de nx x ny. Si el ancho o el alto
+ * no son múltiplos, el último bloque es más chico y se promedia sólo
+ * lo que tiene.
+ */
+void reducir_entero( bmp_t *const imagen, const uint32_t nx, const uint32_t ny )
+{
+    contexto_entero ctx;
+    matriz_pixels matriz;
+    int32_t ancho, alto;
+
+    /* los promedios crean colores nuevos */
+    if ( !expandir_a_colores( imagen ) )
+        return;
+
+    ancho = ( imagen->infoheader.width + ( int64_t ) nx - 1 ) / nx;
+    alto = ( imagen->infoheader.height + ( int64_t ) ny - 1 ) / ny;
+
+    if ( !crear_matriz_pixels( &matriz, ancho, alto ) )
+    {
+        fprintf( salida_errores(), "Error alocando memoria para los pixels\n" );
+        return;
+    }
+
+    ctx.imagen = imagen;
+    ctx.destino = matriz.pixels;
+    ctx.destino_indices = NULL;
+    ctx.ancho = ancho;
+    ctx.nx = nx;
+    ctx.ny = ny;
+    pool_paralelo( alto, FILAS_BANDA_ESCALA, promediar_banda, &ctx );
+
+    reemplazar_pixels( imagen, &matriz, ancho, alto );
+
+    /* el tamaño se va a cambiar al guardar el archivo */
+    imagen->infoheader.hres = imagen->infoheader.hres / ( int32_t ) nx;
+    imagen->infoheader.vres = imagen->infoheader.vres / ( int32_t ) ny;
+}
+
+/*
+ * Redimensiona la imágen al doble de tamaño, repitiendo cada píxel.
+ */
+void redimensionar2x( bmp_t *const imagen )
+{
+    ampliar_entero( imagen, 2, 2 );
+}
+
+/*
+ * Redimensiona la imágen a la mitad de tamaño, promediando cada bloque
+ * de 2x2 píxeles.
+ */
+void redimensionar1_2x( bmp_t *const imagen )
+{
+    reducir_entero( imagen, 2, 2 );
+}
+
+/*
+ * Redimensiona la imágen a "ancho" x "alto" con el filtro pedido. Si
+ * uno de los dos es 0, se calcula con el otro manteniendo la
+ * proporción.
+ */
+void redimensionar( bmp_t *const imagen,
+                    uint32_t ancho,
+                    uint32_t alto,
+                    const filtro_escala filtro )
+{
+    int32_t ancho_viejo, alto_viejo;
+
+    ancho_viejo = imagen->infoheader.width;
+    alto_viejo = imagen->infoheader.height;
+
+    if ( ancho == 0 )
+        ancho = ( uint32_t ) llround( ( double ) alto * ancho_viejo / alto_viejo );
+    if ( alto == 0 )
+        alto = ( uint32_t ) llround( ( double ) ancho * alto_viejo / ancho_viejo );
+    if ( ancho == 0 )
+        ancho = 1;
+    if ( alto == 0 )
+        alto = 1;
+
+    if ( ancho == ( uint32_t ) ancho_viejo && alto == ( uint32_t ) alto_viejo )
+        return;
+
+    /*
+     * Con factores enteros el vecino más cercano y la caja son repetir
+     * píxeles o promediar bloques: se usan los núcleos por filas.
+     */
+    if ( ( filtro == FILTRO_CERCANO || filtro == FILTRO_CAJA ) &&
+            ancho % ancho_viejo == 0 && alto % alto_viejo == 0 )
+    {
+        ampliar_entero( imagen, ancho / ancho_viejo, alto / alto_viejo );
+        return;
+    }
+    if ( filtro == FILTRO_CAJA && ancho_viejo % ancho == 0 && alto_viejo % alto == 0 )
+    {
+        reducir_entero( imagen, ancho_viejo / ancho, alto_viejo / alto );
+        return;
+    }
+
+    if ( filtro == FILTRO_CERCANO )
+        escalar_cercano( imagen, ancho, alto );
+    else
+        escalar_filtrado( imagen, ancho, alto, filtro );
+
+    /* la resolución acompaña al tamaño, igual que en redimensionar2x */
+    if ( imagen->infoheader.width == ( int32_t ) ancho &&
+            imagen->infoheader.height == ( int32_t ) alto )
+    {
+        imagen->infoheader.hres = ( int64_t ) imagen->infoheader.hres * ( int32_t ) ancho / ancho_viejo;
+        imagen->infoheader.vres = ( int64_t ) imagen->infoheader.vres * ( int32_t ) alto / alto_viejo;
+    }
+}
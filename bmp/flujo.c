@@ -0,0 +1,187 @@
+/***********************************************************************
+ *
+ * Módulo: Procesamiento por filas. Cuando todas las operaciones pedidas
+ *         trabajan de a una fila (o sólo reordenan filas), la imágen se
+ *         lee, se transforma y se graba de a una fila, sin cargarla
+ *         entera en memoria.
+ * Autor:  Martín Aguilar
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../headers/bmp_interno.h"
+#include "../headers/salida.h"
+#include "../headers/errores.h"
+
+/* Bytes de filas que se juntan antes de cada escritura */
+#define BUFFER_SALIDA ( 1 << 20 )
+
+/*
+ * Aplica las operaciones por filas a una imágen abierta con
+ * abrir_imagen_archivo, leyendo y transformando de a una fila, y
+ * grabando en "salida" por bloques de filas. La memoria usada depende
+ * sólo del ancho. Las
+ * imágenes con paleta se procesan como índices, igual que en memoria:
+ * los negativos cambian sólo la paleta, antes de grabarla.
+ * Con un flip, los bloques se graban cada uno en su lugar del archivo;
+ * si la salida es un pipe no se puede, y en cambio se lee la entrada
+ * de a bloques, de arriba hacia abajo, para grabarlos en orden.
+ */
+bool procesar_por_filas( bmp_t *imagen,
+                         const op_fila *ops,
+                         const uint32_t nops,
+                         const char *salida )
+{
+    salida_bmp archivo;
+    uint32_t i, k, n, hechas, fila_entrada, fila_salida, filas_bloque;
+    int32_t y, destino, alto, base, lugar;
+    const uint8_t *origen;
+    uint8_t *bloque, *indices, *encabezados;
+    bmpcolor_t *fila;
+    op_fila *preparadas;
+    decodificador_fila decodificar;
+    codificador_fila codificar;
+    decodificador_indices decodificar_indices;
+    codificador_indices codificar_indices;
+    struct iovec parte;
+    bool ok, invertida, en_orden;
+
+    alto = imagen->infoheader.height;
+    decodificar = decodificador_de( imagen );
+    codificar = codificador_de( imagen );
+    decodificar_indices = decodificador_indices_de( imagen );
+    codificar_indices = codificador_indices_de( imagen );
+
+    fila_entrada = calcular_fila_alineada( imagen->infoheader.width,
+                                           imagen->infoheader.bitspp );
+    if ( imagen->infoheader.bmp_bytesz != ( uint64_t ) fila_entrada * alto )
+    {
+        fprintf( salida_errores(), "El tamaño del arreglo de pixeles no coincide\n" );
+        return false;
+    }
+
+    if ( ( fila_salida = preparar_encabezados( imagen ) ) == 0 )
+        return false;
+
+    /* las filas se juntan en bloques, y cada bloque es una escritura */
+    filas_bloque = BUFFER_SALIDA / fila_salida;
+    if ( filas_bloque == 0 )
+        filas_bloque = 1;
+    if ( filas_bloque > ( uint32_t ) alto )
+        filas_bloque = alto;
+
+    /* un flip da vuelta el orden de todas las filas por igual */
+    invertida = false;
+    for ( i = 0; i < nops; i++ )
+        if ( ops[i].tipo == FILA_FLIP )
+            invertida = !invertida;
+
+    fila = ( bmpcolor_t * ) malloc( sizeof( bmpcolor_t ) * imagen->infoheader.width );
+    indices = ( uint8_t * ) malloc( imagen->infoheader.width );
+    bloque = ( uint8_t * ) calloc( filas_bloque, fila_salida );
+    preparadas = ( op_fila * ) malloc( sizeof( op_fila ) * ( nops ? nops : 1 ) );
+    if ( fila == NULL || indices == NULL || bloque == NULL || preparadas == NULL )
+    {
+        fprintf( salida_errores(), "Error alocando memoria para la fila\n" );
+        free( fila );
+        free( indices );
+        free( bloque );
+        free( preparadas );
+        return false;
+    }
+
+    /* la paleta tiene que quedar lista antes de armar los encabezados */
+    memcpy( preparadas, ops, sizeof( op_fila ) * nops );
+    ok = decodificar_indices == NULL || preparar_ops_indices( imagen, preparadas, nops );
+
+    encabezados = ok ? armar_encabezados( imagen ) : NULL;
+    if ( encabezados == NULL || !abrir_salida( &archivo, salida ) )
+    {
+        free( encabezados );
+        free( fila );
+        free( indices );
+        free( bloque );
+        free( preparadas );
+        return false;
+    }
+
+    /* sin flip los bloques salen en el orden del archivo */
+    en_orden = !invertida || !archivo.posicionable;
+    if ( invertida && en_orden )
+        fuente_salteada( &imagen->fuente );
+
+    parte.iov_base = encabezados;
+    parte.iov_len = imagen->fileheader.bmp_offset;
+    ok = escribir_salida( &archivo, &parte, 1 );
+
+    /* las filas están guardadas de abajo hacia arriba */
+    for ( hechas = 0; ok && hechas < ( uint32_t ) alto; hechas += n )
+    {
+        n = alto - hechas < filas_bloque ? alto - hechas : filas_bloque;
+        if ( invertida && en_orden )
+        {
+            /* el bloque de arriba de la imágen va primero en la salida */
+            y = hechas + n - 1;
+            if ( !posicionar_fuente( &imagen->fuente, imagen->fileheader.bmp_offset +
+                                     ( uint64_t ) ( alto - 1 - y ) * fila_entrada ) )
+            {
+                fprintf( salida_errores(), "No se puede invertir una entrada sin seek hacia un pipe\n" );
+                ok = false;
+                break;
+            }
+        }
+        else
+            y = alto - 1 - hechas;
+        /* primera fila del archivo que cae en este bloque */
+        base = invertida ? y - ( int32_t ) n + 1 : alto - 1 - y;
+
+        for ( k = 0; k < n; k++ )
+        {
+            if ( ( origen = leer_fuente( &imagen->fuente, fila_entrada ) ) == NULL )
+            {
+                fprintf( salida_errores(), "Error leyendo fila de pixeles.\n" );
+                ok = false;
+                break;
+            }
+            destino = y - ( int32_t ) k;
+            lugar = 0;
+            if ( decodificar_indices != NULL )
+            {
+                decodificar_indices( imagen, origen, indices );
+                for ( i = 0; i < nops; i++ )
+                    aplicar_op_indices( imagen, &preparadas[i], &destino, indices );
+                lugar = alto - 1 - destino - base;
+                codificar_indices( imagen, indices, bloque + ( size_t ) lugar * fila_salida );
+            }
+            else
+            {
+                decodificar( imagen, origen, fila );
+                for ( i = 0; i < nops; i++ )
+                    aplicar_op_fila( imagen, &ops[i], &destino, fila );
+                lugar = alto - 1 - destino - base;
+                codificar( imagen, fila, bloque + ( size_t ) lugar * fila_salida );
+            }
+        }
+
+        parte.iov_base = bloque;
+        parte.iov_len = ( size_t ) n * fila_salida;
+        if ( ok && en_orden )
+            ok = escribir_salida( &archivo, &parte, 1 );
+        else if ( ok )
+            ok = escribir_salida_en( &archivo, bloque, parte.iov_len,
+                                     imagen->fileheader.bmp_offset
+                                     + ( off_t ) base * fila_salida );
+    }
+
+    ok = cerrar_salida( &archivo, ok );
+    cerrar_fuente( &imagen->fuente );
+    free( encabezados );
+    free( fila );
+    free( indices );
+    free( bloque );
+    free( preparadas );
+
+    return ok;
+}
@@ -0,0 +1,182 @@
+/***********************************************************************
+ *
+ * Módulo: Implementación de la fuente de lectura de los BMP. Con un
+ *         archivo regular se usa mmap, y las filas se decodifican
+ *         directo desde el mapa, sin copiarlas antes a un buffer.
+ * Autor:  Martín Aguilar
+ *
+ **********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../headers/fuente.h"
+
+/*
+ * Buffer de stdio al leer sólo los encabezados: alcanza para el header
+ * más largo y una paleta de 256 colores.
+ */
+#define BUFFER_ENCABEZADOS 2048
+
+/*
+ * Abre el archivo. Si es un archivo regular se mapea en memoria y se le
+ * avisa al kernel que se va a leer en forma secuencial.
+ */
+bool abrir_fuente( fuente_bmp *fuente, const char *filename )
+{
+    struct stat info;
+    void *mapa;
+    int fd;
+
+    memset( fuente, 0, sizeof( fuente_bmp ) );
+
+    if ( ( fd = open( filename, O_RDONLY ) ) < 0 )
+        return false;
+
+    if ( fstat( fd, &info ) == 0 && S_ISREG( info.st_mode ) && info.st_size > 0 )
+    {
+        mapa = mmap( NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+        if ( mapa != MAP_FAILED )
+        {
+            madvise( mapa, info.st_size, MADV_SEQUENTIAL );
+            fuente->mapa = ( const uint8_t * ) mapa;
+            fuente->tamanio = info.st_size;
+            close( fd ); /* el mapa sigue valiendo sin el descriptor */
+            return true;
+        }
+    }
+
+    /* no se puede mapear: se lee con stdio */
+    if ( ( fuente->archivo = fdopen( fd, "r" ) ) == NULL )
+    {
+        close( fd );
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Abre el archivo con stdio, con un buffer del tamaño de los
+ * encabezados: es lo único que se lee del disco.
+ */
+bool abrir_fuente_encabezados( fuente_bmp *fuente, const char *filename )
+{
+    memset( fuente, 0, sizeof( fuente_bmp ) );
+
+    if ( ( fuente->archivo = fopen( filename, "r" ) ) == NULL )
+        return false;
+
+    setvbuf( fuente->archivo, NULL, _IOFBF, BUFFER_ENCABEZADOS );
+    return true;
+}
+
+/*
+ * Devuelve un puntero a los próximos n bytes de la fuente y avanza, o
+ * NULL si no hay n bytes más. El puntero vale hasta la próxima lectura.
+ */
+const uint8_t *leer_fuente( fuente_bmp *fuente, size_t n )
+{
+    const uint8_t *p;
+
+    if ( fuente->mapa )
+    {
+        if ( n > fuente->tamanio - fuente->pos )
+            return NULL;
+
+        p = fuente->mapa + fuente->pos;
+        fuente->pos += n;
+        return p;
+    }
+
+    if ( n > fuente->capacidad )
+    {
+        uint8_t *nuevo = ( uint8_t * ) realloc( fuente->buffer, n );
+        if ( nuevo == NULL )
+            return NULL;
+        fuente->buffer = nuevo;
+        fuente->capacidad = n;
+    }
+
+    if ( fread( fuente->buffer, sizeof( uint8_t ), n, fuente->archivo ) != n )
+        return NULL;
+
+    fuente->pos += n;
+    return fuente->buffer;
+}
+
+/*
+ * Copia los próximos n bytes de la fuente a destino.
+ */
+bool copiar_fuente( fuente_bmp *fuente, void *destino, size_t n )
+{
+    if ( fuente->mapa )
+    {
+        const uint8_t *p = leer_fuente( fuente, n );
+        if ( p == NULL )
+            return false;
+        memcpy( destino, p, n );
+        return true;
+    }
+
+    /* con stdio se lee directo al destino, sin pasar por el buffer */
+    if ( fread( destino, sizeof( uint8_t ), n, fuente->archivo ) != n )
+        return false;
+
+    fuente->pos += n;
+    return true;
+}
+
+/*
+ * Con el mapa se pasa de MADV_SEQUENTIAL a MADV_RANDOM; con stdio no
+ * hay nada que avisar.
+ */
+void fuente_salteada( fuente_bmp *fuente )
+{
+    if ( fuente->mapa )
+        madvise( ( void * ) fuente->mapa, fuente->tamanio, MADV_RANDOM );
+}
+
+bool posicionar_fuente( fuente_bmp *fuente, uint64_t pos )
+{
+    uint64_t falta;
+
+    if ( fuente->mapa )
+    {
+        if ( pos > fuente->tamanio )
+            return false;
+        fuente->pos = pos;
+        return true;
+    }
+
+    if ( fseeko( fuente->archivo, ( off_t ) pos, SEEK_SET ) == 0 )
+    {
+        fuente->pos = pos;
+        return true;
+    }
+
+    /* sin seek sólo se puede avanzar, descartando de a pedazos */
+    if ( pos < fuente->pos )
+        return false;
+    while ( ( falta = pos - fuente->pos ) > 0 )
+        if ( leer_fuente( fuente, falta < BUFSIZ ? falta : BUFSIZ ) == NULL )
+            return false;
+    return true;
+}
+
+/*
+ * Cierra la fuente y libera todo lo que tenga asociado.
+ */
+void cerrar_fuente( fuente_bmp *fuente )
+{
+    if ( fuente->mapa )
+        munmap( ( void * ) fuente->mapa, fuente->tamanio );
+    if ( fuente->archivo )
+        fclose( fuente->archivo );
+    free( fuente->buffer );
+
+    memset( fuente, 0, sizeof( fuente_bmp ) );
+}
@@ -0,0 +1,274 @@
+/***********************************************************************
+ *
+ * Módulo: Implementación del índice inverso de la paleta. Es una tabla
+ *         hash (direccionamiento abierto) de color RGB a índice, que
+ *         arranca con los colores exactos de la paleta y memoriza el
+ *         resultado de cada búsqueda del color más cercano. La búsqueda
+ *         del más cercano usa la paleta ordenada por rojo para cortar
+ *         apenas la distancia en ese canal supera a la mejor.
+ * Autor:  Martín Aguilar
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "../headers/paleta.h"
+
+/* Capacidad inicial de la tabla hash (potencia de 2) */
+#define CAPACIDAD_INICIAL 1024
+
+/*
+ * Tipo para una entrada de la tabla: el color empaquetado como 0xRRGGBB
+ * más uno (0 es "vacía") y su índice en la paleta.
+ */
+typedef struct
+{
+    uint32_t clave;
+    uint32_t indice;
+} entrada_paleta;
+
+/*
+ * Tipo para un color de la paleta ordenada por rojo, con su índice
+ * original.
+ */
+typedef struct
+{
+    int32_t  red;
+    int32_t  green;
+    int32_t  blue;
+    uint32_t indice;
+} color_ordenado;
+
+struct indice_paleta
+{
+    entrada_paleta *tabla;
+    uint32_t        capacidad;
+    uint32_t        usadas;
+    color_ordenado *ordenada;
+    uint32_t        cant;
+};
+
+static inline uint32_t clave_color( const bmpcolor_t color )
+{
+    return ( ( uint32_t ) color.red << 16 | ( uint32_t ) color.green << 8 | color.blue ) + 1;
+}
+
+static inline uint32_t hash_clave( uint32_t clave, uint32_t capacidad )
+{
+    return ( clave * 2654435761U ) & ( capacidad - 1 );
+}
+
+/*
+ * Devuelve la entrada de la clave, o la vacía donde debería ir.
+ */
+static entrada_paleta *buscar_entrada( entrada_paleta *tabla,
+                                       uint32_t capacidad,
+                                       uint32_t clave )
+{
+    uint32_t pos = hash_clave( clave, capacidad );
+
+    while ( tabla[pos].clave && tabla[pos].clave != clave )
+        pos = ( pos + 1 ) & ( capacidad - 1 );
+
+    return &tabla[pos];
+}
+
+/*
+ * Duplica la capacidad de la tabla, reubicando las entradas.
+ */
+static bool agrandar_tabla( indice_paleta *indice )
+{
+    uint32_t i, capacidad = indice->capacidad * 2;
+    entrada_paleta *tabla;
+
+    tabla = ( entrada_paleta * ) calloc( capacidad, sizeof( entrada_paleta ) );
+    if ( tabla == NULL )
+        return false;
+
+    for ( i = 0; i < indice->capacidad; i++ )
+        if ( indice->tabla[i].clave )
+            *buscar_entrada( tabla, capacidad, indice->tabla[i].clave ) = indice->tabla[i];
+
+    free( indice->tabla );
+    indice->tabla = tabla;
+    indice->capacidad = capacidad;
+    return true;
+}
+
+/*
+ * Guarda el índice de un color, agrandando la tabla si pasa de la
+ * mitad de ocupación. Si el color ya estaba, se conserva el anterior.
+ */
+static void memorizar( indice_paleta *indice, uint32_t clave, uint32_t valor )
+{
+    entrada_paleta *e;
+
+    if ( ( indice->usadas + 1 ) * 2 > indice->capacidad && !agrandar_tabla( indice ) )
+        return; /* sin memoria para memorizar; la búsqueda sigue siendo correcta */
+
+    e = buscar_entrada( indice->tabla, indice->capacidad, clave );
+    if ( !e->clave )
+    {
+        e->clave = clave;
+        e->indice = valor;
+        indice->usadas++;
+    }
+}
+
+static int comparar_rojo( const void *a, const void *b )
+{
+    const color_ordenado *ca = ( const color_ordenado * ) a;
+    const color_ordenado *cb = ( const color_ordenado * ) b;
+
+    if ( ca->red != cb->red )
+        return ca->red - cb->red;
+    return ( int ) ca->indice - ( int ) cb->indice;
+}
+
+/*
+ * Arma el índice inverso de una paleta de "cant" colores. La paleta
+ * no se copia, así que debe vivir mientras viva el índice.
+ */
+indice_paleta *crear_indice_paleta( const bmpcolor_t *colores, uint32_t cant )
+{
+    indice_paleta *indice;
+    uint32_t i;
+
+    indice = ( indice_paleta * ) calloc( 1, sizeof( indice_paleta ) );
+    if ( indice == NULL )
+        return NULL;
+
+    indice->capacidad = CAPACIDAD_INICIAL;
+    while ( indice->capacidad < cant * 2 )
+        indice->capacidad *= 2;
+
+    indice->tabla = ( entrada_paleta * ) calloc( indice->capacidad, sizeof( entrada_paleta ) );
+    indice->ordenada = ( color_ordenado * ) malloc( sizeof( color_ordenado ) * ( cant ? cant : 1 ) );
+    if ( indice->tabla == NULL || indice->ordenada == NULL )
+    {
+        destruir_indice_paleta( indice );
+        return NULL;
+    }
+
+    indice->cant = cant;
+    for ( i = 0; i < cant; i++ )
+    {
+        indice->ordenada[i].red    = colores[i].red;
+        indice->ordenada[i].green  = colores[i].green;
+        indice->ordenada[i].blue   = colores[i].blue;
+        indice->ordenada[i].indice = i;
+
+        /* colores exactos: si se repiten, gana el primero */
+        memorizar( indice, clave_color( colores[i] ), i );
+    }
+    qsort( indice->ordenada, cant, sizeof( color_ordenado ), comparar_rojo );
+
+    return indice;
+}
+
+/*
+ * Busca el color más cercano recorriendo la paleta ordenada por rojo
+ * hacia ambos lados desde el rojo buscado. Un lado se abandona cuando
+ * la distancia sólo en rojo ya supera a la mejor encontrada.
+ */
+static uint32_t mas_cercano( const indice_paleta *indice, const bmpcolor_t color )
+{
+    int32_t lo, hi, medio, dr, dg, db, n;
+    uint32_t mejor = 0;
+    int32_t distancia = INT32_MAX, temp;
+    const color_ordenado *c;
+
+    n = ( int32_t ) indice->cant;
+
+    /* primer color con rojo >= al buscado */
+    lo = 0;
+    hi = n;
+    while ( lo < hi )
+    {
+        medio = ( lo + hi ) / 2;
+        if ( indice->ordenada[medio].red < color.red )
+            lo = medio + 1;
+        else
+            hi = medio;
+    }
+    hi = lo;
+    lo = lo - 1;
+
+    while ( lo >= 0 || hi < n )
+    {
+        if ( hi < n )
+        {
+            c = &indice->ordenada[hi];
+            dr = c->red - color.red;
+            if ( dr * dr > distancia )
+                hi = n;
+            else
+            {
+                dg = c->green - color.green;
+                db = c->blue - color.blue;
+                temp = dr * dr + dg * dg + db * db;
+                if ( temp < distancia || ( temp == distancia && c->indice < mejor ) )
+                {
+                    distancia = temp;
+                    mejor = c->indice;
+                }
+                hi++;
+            }
+        }
+        if ( lo >= 0 )
+        {
+            c = &indice->ordenada[lo];
+            dr = c->red - color.red;
+            if ( dr * dr > distancia )
+                lo = -1;
+            else
+            {
+                dg = c->green - color.green;
+                db = c->blue - color.blue;
+                temp = dr * dr + dg * dg + db * db;
+                if ( temp < distancia || ( temp == distancia && c->indice < mejor ) )
+                {
+                    distancia = temp;
+                    mejor = c->indice;
+                }
+                lo--;
+            }
+        }
+    }
+
+    return mejor;
+}
+
+/*
+ * Devuelve el índice del color en la paleta o, si no está, el del más
+ * cercano (distancia euclídea en RGB; ante empates, el menor índice).
+ * Los resultados se memorizan, así que cada color distinto se busca
+ * una sola vez.
+ */
+uint8_t buscar_en_paleta( indice_paleta *indice, const bmpcolor_t color )
+{
+    uint32_t clave = clave_color( color ), valor;
+    entrada_paleta *e;
+
+    e = buscar_entrada( indice->tabla, indice->capacidad, clave );
+    if ( e->clave )
+        return ( uint8_t ) e->indice;
+
+    valor = mas_cercano( indice, color );
+    memorizar( indice, clave, valor );
+
+    return ( uint8_t ) valor;
+}
+
+/*
+ * Libera el índice inverso.
+ */
+void destruir_indice_paleta( indice_paleta *indice )
+{
+    if ( indice == NULL )
+        return;
+
+    free( indice->tabla );
+    free( indice->ordenada );
+    free( indice );
+}
@@ -0,0 +1,258 @@
+/***********************************************************************
+ *
+ * Módulo: Cambio de los BPP con que se graba una imágen (opción -B).
+ *         Para pasar a 16, 24 o 32 BPP alcanza con los colores; para
+ *         bajar a 8 o menos se arma una paleta con los colores que usa
+ *         la imágen, si entran, o si no una fija, y se indexa.
+ * Autor:  Martín Aguilar
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../headers/bmp.h"
+#include "../headers/bmp_interno.h"
+#include "../headers/errores.h"
+
+/*
+ * Lugares de la tabla con que se cuentan los colores distintos: el
+ * doble de los que puede tener una paleta, para que nunca se llene.
+ */
+#define BITS_COLORES    9
+#define LUGARES_COLORES ( 1 << BITS_COLORES )
+
+/*
+ * Colores de la paleta fija de 4 BPP: los 16 de VGA, en RGB.
+ */
+static const uint32_t colores_vga[16] =
+{
+    0x000000, 0x800000, 0x008000, 0x808000, 0x000080, 0x800080, 0x008080, 0xC0C0C0,
+    0x808080, 0xFF0000, 0x00FF00, 0xFFFF00, 0x0000FF, 0xFF00FF, 0x00FFFF, 0xFFFFFF
+};
+
+// ENCABEZADOS FUNCIONES
+
+void quitar_paleta( bmp_t *imagen );
+
+uint32_t contar_colores( const bmp_t *imagen, bmpcolor_t *colores, uint32_t limite );
+
+uint32_t paleta_fija( bmpcolor_t *colores, uint32_t bits );
+
+bool indexar( bmp_t *imagen, bmpcolor_t *colores, uint32_t cant );
+
+// FIN ENCABEZADOS
+
+
+/*
+ * Libera la paleta y su índice inverso.
+ */
+void quitar_paleta( bmp_t *imagen )
+{
+    free( imagen->paleta.colores );
+    destruir_indice_paleta( imagen->indice );
+    imagen->paleta.colores = NULL;
+    imagen->paleta.cant = 0;
+    imagen->indice = NULL;
+}
+
+/*
+ * Deja en "colores" los colores distintos que usa la imágen y devuelve
+ * cuántos son. Si son más que "limite" deja de contar y devuelve
+ * limite + 1. En una imágen indexada se miran sólo los índices usados.
+ */
+uint32_t contar_colores( const bmp_t *imagen, bmpcolor_t *colores, uint32_t limite )
+{
+    uint32_t tabla[LUGARES_COLORES] = { 0 }, clave, anterior = 0, pos, cant = 0;
+    bool usados[256] = { false };
+    int32_t x, y, ancho, alto;
+    const bmpcolor_t *fila;
+
+    ancho = imagen->infoheader.width;
+    alto = imagen->infoheader.height;
+
+    if ( es_indexada( imagen ) )
+    {
+        for ( y = 0; y < alto; y++ )
+            for ( x = 0; x < ancho; x++ )
+                usados[imagen->filas[y][x]] = true;
+        for ( x = 0; x < 256; x++ )
+            if ( usados[x] && x < ( int32_t ) imagen->paleta.cant )
+            {
+                if ( cant == limite )
+                    return limite + 1;
+                colores[cant++] = imagen->paleta.colores[x];
+            }
+        return cant;
+    }
+
+    /* la clave es el color sin alpha, con un bit más para que nunca sea 0 */
+    for ( y = 0; y < alto; y++ )
+    {
+        fila = imagen->pixels[y];
+        for ( x = 0; x < ancho; x++ )
+        {
+            clave = 1u << 24 | fila[x].red << 16 | fila[x].green << 8 | fila[x].blue;
+            if ( clave == anterior )
+                continue;
+            anterior = clave;
+
+            pos = ( clave * 2654435761u ) >> ( 32 - BITS_COLORES );
+            while ( tabla[pos] && tabla[pos] != clave )
+                pos = ( pos + 1 ) % LUGARES_COLORES;
+            if ( tabla[pos] )
+                continue;
+
+            if ( cant == limite )
+                return limite + 1;
+            tabla[pos] = clave;
+            colores[cant] = fila[x];
+            colores[cant++].alpha = 0;
+        }
+    }
+    return cant;
+}
+
+/*
+ * Deja en "colores" la paleta fija de "bits" BPP y devuelve cuántos
+ * colores tiene: blanco y negro en 1 BPP, los de VGA en 4, y en 8 un
+ * cubo de 6 x 6 x 6 más 40 grises.
+ */
+uint32_t paleta_fija( bmpcolor_t *colores, uint32_t bits )
+{
+    uint32_t i, r, g, b, cant = 0;
+
+    memset( colores, 0, sizeof( bmpcolor_t ) << bits );
+    if ( bits == 1 )
+    {
+        colores[1].red = colores[1].green = colores[1].blue = 255;
+        return 2;
+    }
+    if ( bits == 4 )
+    {
+        for ( i = 0; i < 16; i++ )
+        {
+            colores[i].red   = colores_vga[i] >> 16;
+            colores[i].green = colores_vga[i] >> 8;
+            colores[i].blue  = colores_vga[i];
+        }
+        return 16;
+    }
+
+    for ( r = 0; r < 6; r++ )
+        for ( g = 0; g < 6; g++ )
+            for ( b = 0; b < 6; b++, cant++ )
+            {
+                colores[cant].red   = r * 51;
+                colores[cant].green = g * 51;
+                colores[cant].blue  = b * 51;
+            }
+    for ( i = 1; i <= 40; i++, cant++ )
+        colores[cant].red = colores[cant].green = colores[cant].blue = i * 255 / 41;
+    return cant;
+}
+
+/*
+ * Reemplaza la paleta por "colores" (que pasa a ser de la imágen) y
+ * pasa cada píxel al índice del color más cercano. Se hace desde un
+ * solo hilo, porque el índice inverso de la paleta memoriza lo que
+ * busca.
+ */
+bool indexar( bmp_t *imagen, bmpcolor_t *colores, uint32_t cant )
+{
+    matriz_indices indices;
+    int32_t x, y, ancho, alto;
+
+    if ( !expandir_a_colores( imagen ) )
+    {
+        free( colores );
+        return false;
+    }
+
+    quitar_paleta( imagen );
+    imagen->paleta.colores = colores;
+    imagen->paleta.cant = cant;
+    if ( ( imagen->indice = crear_indice_paleta( colores, cant ) ) == NULL )
+    {
+        fprintf( salida_errores(), "Error al alocar memoria para el indice de la paleta\n" );
+        return false;
+    }
+
+    ancho = imagen->infoheader.width;
+    alto = imagen->infoheader.height;
+    if ( !crear_matriz_indices( &indices, ancho, alto ) )
+        return false;
+
+    for ( y = 0; y < alto; y++ )
+        for ( x = 0; x < ancho; x++ )
+            indices.filas[y][x] = coloresde_paleta( imagen, imagen->pixels[y][x] );
+
+    reemplazar_indices( imagen, &indices, ancho, alto );
+    return true;
+}
+
+bool cambiar_profundidad( bmp_t *imagen, uint32_t bpp )
+{
+    uint32_t bits = bpp == 15 ? 16 : bpp, limite, cant;
+    bmpcolor_t *colores;
+    bool alfa = tiene_alfa( imagen );
+
+    if ( bpp != 1 && bpp != 4 && bpp != 8 && bpp != 15 && bpp != 16 && bpp != 24 && bpp != 32 )
+    {
+        fprintf( salida_errores(), "Error: no se puede grabar en %u BPP\n", bpp );
+        return false;
+    }
+
+    /* sin paleta: los colores ya están, sólo cambian las máscaras */
+    if ( bits > 8 )
+    {
+        if ( !expandir_a_colores( imagen ) )
+            return false;
+        quitar_paleta( imagen );
+
+        memset( imagen->mascaras, 0, sizeof( imagen->mascaras ) );
+        if ( bits == 16 )
+        {
+            imagen->mascaras[0] = bpp == 15 ? MASCARA_ROJO_555 : MASCARA_ROJO_565;
+            imagen->mascaras[1] = bpp == 15 ? MASCARA_VERDE_555 : MASCARA_VERDE_565;
+            imagen->mascaras[2] = MASCARA_AZUL_16;
+        }
+        else if ( bits == 32 )
+        {
+            imagen->mascaras[0] = MASCARA_ROJO;
+            imagen->mascaras[1] = MASCARA_VERDE;
+            imagen->mascaras[2] = MASCARA_AZUL;
+            imagen->mascaras[3] = alfa ? MASCARA_ALFA : 0;
+        }
+        imagen->infoheader.bitspp = bits;
+        return true;
+    }
+
+    memset( imagen->mascaras, 0, sizeof( imagen->mascaras ) );
+    limite = 1u << bits;
+
+    /* si la paleta que tiene entra, se conserva */
+    if ( imagen->paleta.cant && imagen->paleta.cant <= limite )
+    {
+        imagen->infoheader.bitspp = bits;
+        return true;
+    }
+
+    if ( ( colores = ( bmpcolor_t * ) malloc( sizeof( bmpcolor_t ) * 256 ) ) == NULL )
+    {
+        fprintf( salida_errores(), "Error al alocar memoria para la paleta de colores\n" );
+        return false;
+    }
+    if ( ( cant = contar_colores( imagen, colores, limite ) ) > limite )
+        cant = paleta_fija( colores, bits );
+    if ( !cant )
+    {
+        memset( colores, 0, sizeof( bmpcolor_t ) );
+        cant = 1;
+    }
+
+    if ( !indexar( imagen, colores, cant ) )
+        return false;
+    imagen->infoheader.bitspp = bits;
+    return true;
+}
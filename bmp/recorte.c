@@ -0,0 +1,220 @@
+/***********************************************************************
+ *
+ * Módulo: Recorte de un rectángulo de la imágen (opción -C). Desde el
+ *         archivo se leen sólo las filas del recorte, yendo directo a
+ *         cada una con bmp_offset y el tamaño de la fila alineada, y de
+ *         cada fila sólo los bytes de las columnas pedidas.
+ * Autor:  Martín Aguilar
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../headers/bmp.h"
+#include "../headers/bmp_interno.h"
+#include "../headers/errores.h"
+
+// ENCABEZADOS FUNCIONES
+
+bool ajustar_recorte( const bmp_t *imagen, uint32_t x, uint32_t y,
+                      uint32_t *ancho, uint32_t *alto );
+
+bool leer_recorte( fuente_bmp *fuente, bmp_t *imagen, uint32_t x, uint32_t y,
+                   uint32_t ancho, uint32_t alto );
+
+// FIN ENCABEZADOS
+
+
+/*
+ * Achica "ancho" y "alto" para que el recorte no se salga de la
+ * imágen. Devuelve false si no queda ningún píxel.
+ */
+bool ajustar_recorte( const bmp_t *imagen, uint32_t x, uint32_t y,
+                      uint32_t *ancho, uint32_t *alto )
+{
+    uint32_t ancho_imagen = imagen->infoheader.width;
+    uint32_t alto_imagen = imagen->infoheader.height;
+
+    if ( imagen->infoheader.width <= 0 || imagen->infoheader.height <= 0 ||
+            x >= ancho_imagen || y >= alto_imagen )
+    {
+        fprintf( salida_errores(), "Error: el recorte queda fuera de la imagen (%ux%u)\n",
+                 ancho_imagen, alto_imagen );
+        return false;
+    }
+
+    if ( *ancho > ancho_imagen - x )
+        *ancho = ancho_imagen - x;
+    if ( *alto > alto_imagen - y )
+        *alto = alto_imagen - y;
+    return true;
+}
+
+/*
+ * Lee el recorte de una imágen sin comprimir, con la fuente al comienzo
+ * de los píxeles. Las filas se recorren en el orden del archivo (de
+ * abajo hacia arriba), así la fuente sólo avanza. En 1 y 4 BPP la
+ * primera columna puede caer a mitad de un byte: se decodifica desde
+ * el comienzo del byte y se descartan los píxeles de más ("fase").
+ */
+bool leer_recorte( fuente_bmp *fuente, bmp_t *imagen, uint32_t x, uint32_t y,
+                   uint32_t ancho, uint32_t alto )
+{
+    uint32_t fila_alineada, fase, bytes_tramo;
+    uint64_t columnas, fila_archivo;
+    int32_t alto_archivo, i;
+    const uint8_t *bufferfila;
+    uint8_t *tramo = NULL;
+    bmp_t vista;
+
+    fila_alineada = calcular_fila_alineada( imagen->infoheader.width,
+                                            imagen->infoheader.bitspp );
+    if ( imagen->infoheader.bmp_bytesz != ( uint64_t ) fila_alineada * imagen->infoheader.height )
+    {
+        fprintf( salida_errores(), "El tamaño del arreglo de pixeles no coincide\n" );
+        return false;
+    }
+
+    fase = imagen->infoheader.bitspp < 8 ? x % ( 8 / imagen->infoheader.bitspp ) : 0;
+    columnas = ( uint64_t ) ( x - fase ) * imagen->infoheader.bitspp / 8;
+    bytes_tramo = ( ( uint64_t ) ( ancho + fase ) * imagen->infoheader.bitspp + 7 ) / 8;
+    alto_archivo = imagen->infoheader.height;
+
+    /* los decodificadores ven una fila del ancho del tramo */
+    vista = *imagen;
+    vista.infoheader.width = ancho + fase;
+    imagen->infoheader.width = ancho;
+    imagen->infoheader.height = alto;
+
+    decodificador_indices decodificar_indices = decodificador_indices_de( imagen );
+    if ( decodificar_indices != NULL )
+    {
+        matriz_indices indices;
+        if ( !crear_matriz_indices( &indices, ancho, alto ) )
+            return false;
+        imagen->indices = indices.datos;
+        imagen->filas   = indices.filas;
+        imagen->stride_indices = indices.stride;
+
+        if ( fase && ( tramo = ( uint8_t * ) malloc( ancho + fase ) ) == NULL )
+        {
+            fprintf( salida_errores(), "Error alocando memoria para el recorte\n" );
+            return false;
+        }
+    }
+    else
+    {
+        /* sin paleta son 16 BPP o más: las columnas empiezan en un byte */
+        matriz_pixels matriz;
+        if ( !crear_matriz_pixels( &matriz, ancho, alto ) )
+            return false;
+        imagen->datos  = matriz.datos;
+        imagen->pixels = matriz.pixels;
+        imagen->stride = matriz.stride;
+    }
+
+    for ( i = alto - 1; i >= 0; i-- )
+    {
+        fila_archivo = alto_archivo - 1 - ( y + i );
+        if ( !posicionar_fuente( fuente, imagen->fileheader.bmp_offset +
+                                 fila_archivo * fila_alineada + columnas ) ||
+                ( bufferfila = leer_fuente( fuente, bytes_tramo ) ) == NULL )
+        {
+            fprintf( salida_errores(), "Error leyendo fila de pixeles.\n" );
+            free( tramo );
+            return false;
+        }
+
+        if ( decodificar_indices == NULL )
+            decodificador_de( imagen )( &vista, bufferfila, imagen->pixels[i] );
+        else if ( tramo == NULL )
+            decodificar_indices( &vista, bufferfila, imagen->filas[i] );
+        else
+        {
+            decodificar_indices( &vista, bufferfila, tramo );
+            memcpy( imagen->filas[i], tramo + fase, ancho );
+        }
+    }
+
+    free( tramo );
+    return true;
+}
+
+/*
+ * Abre el archivo, ajusta el recorte a la imágen y lee sólo sus
+ * píxeles. Las comprimidas no tienen filas de tamaño fijo: se cargan
+ * enteras y se recortan en memoria.
+ */
+bmp_t *crear_recorte_archivo( const char *filename, uint32_t x, uint32_t y,
+                              uint32_t ancho, uint32_t alto )
+{
+    bmp_t *imagen;
+    bool ok;
+
+    if ( ( imagen = abrir_imagen_archivo( filename ) ) == NULL )
+        return NULL;
+
+    if ( !ajustar_recorte( imagen, x, y, &ancho, &alto ) )
+    {
+        destruir_bmp( imagen );
+        return NULL;
+    }
+
+    if ( !legible_por_filas( imagen ) )
+    {
+        destruir_bmp( imagen );
+        if ( ( imagen = crear_imagen_archivo( filename ) ) != NULL &&
+                !recortar( imagen, x, y, ancho, alto ) )
+        {
+            destruir_bmp( imagen );
+            return NULL;
+        }
+        return imagen;
+    }
+
+    fuente_salteada( &imagen->fuente );
+    ok = leer_recorte( &imagen->fuente, imagen, x, y, ancho, alto );
+    cerrar_fuente( &imagen->fuente ); // Se cierra el archivo
+    if ( !ok )
+    {
+        fprintf( salida_errores(), "Error leyendo los pixels del archivo %s\n", filename );
+        destruir_bmp( imagen );
+        return NULL;
+    }
+
+    return imagen;
+}
+
+/*
+ * Copia el rectángulo a una matriz nueva, de índices o de colores
+ * según cómo esté la imágen. Si el recorte se sale de la imágen se
+ * achica; si no queda nada, la imágen no cambia.
+ */
+bool recortar( bmp_t *const imagen, uint32_t x, uint32_t y,
+               uint32_t ancho, uint32_t alto )
+{
+    uint32_t i;
+
+    if ( !ajustar_recorte( imagen, x, y, &ancho, &alto ) )
+        return false;
+
+    if ( es_indexada( imagen ) )
+    {
+        matriz_indices indices;
+        if ( !crear_matriz_indices( &indices, ancho, alto ) )
+            return false;
+        for ( i = 0; i < alto; i++ )
+            memcpy( indices.filas[i], imagen->filas[y + i] + x, ancho );
+        reemplazar_indices( imagen, &indices, ancho, alto );
+        return true;
+    }
+
+    matriz_pixels matriz;
+    if ( !crear_matriz_pixels( &matriz, ancho, alto ) )
+        return false;
+    for ( i = 0; i < alto; i++ )
+        memcpy( matriz.pixels[i], imagen->pixels[y + i] + x, sizeof( bmpcolor_t ) * ancho );
+    reemplazar_pixels( imagen, &matriz, ancho, alto );
+    return true;
+}
@@ -0,0 +1,211 @@
+/***********************************************************************
+ *
+ * Módulo: Implementación de la reserva de bloques. Cada operación que
+ *         cambia el tamaño de la imágen aloca una matriz nueva y libera
+ *         la anterior; al procesar muchas imágenes seguidas, esos
+ *         bloques se reusan en lugar de pedirlos de nuevo al sistema.
+ *         Los bloques grandes pueden ir en páginas grandes (opción -H),
+ *         para que recorrerlos por primera vez cueste menos fallos.
+ * Autor:  Martín Aguilar
+ *
+ **********************************************************************/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "../headers/reserva.h"
+#include "../headers/bmp_interno.h"
+
+/* Cantidad máxima de bloques que se guardan para reusar */
+#define BLOQUES_RESERVA 8
+
+/*
+ * Un bloque de la reserva se reusa sólo si no es más que este factor
+ * del tamaño pedido: un pedido chico no se queda con uno enorme.
+ */
+#define PROPORCION_REUSO 2
+
+/* Tamaño de una página grande, y el mínimo para pedir un bloque en ellas */
+#define PAGINA_GRANDE ( 2u << 20 )
+
+/*
+ * Cada bloque lleva, antes de los datos, un encabezado del tamaño de la
+ * alineación, para que los datos sigan alineados.
+ */
+#define ENCABEZADO_BLOQUE ALINEACION_PIXELS
+
+/*
+ * Encabezado de un bloque: su capacidad en bytes de datos, y el largo
+ * del mapeo si se pidió con mmap (0 si salió de aligned_alloc).
+ */
+typedef struct
+{
+    size_t capacidad;
+    size_t mapeado;
+} encabezado_bloque;
+
+static void *reserva[BLOQUES_RESERVA];
+static pthread_mutex_t mutex_reserva = PTHREAD_MUTEX_INITIALIZER;
+
+/* Si es true, los bloques de una página grande o más se piden con mmap */
+static bool paginas_grandes = false;
+
+/* Bytes pedidos con reservar_bloque desde que empezó el programa */
+static uint64_t total_pedido = 0;
+
+/*
+ * Devuelve la capacidad (en bytes de datos) de un bloque.
+ */
+static size_t capacidad_bloque( void *bloque )
+{
+    return ( ( encabezado_bloque * ) ( ( uint8_t * ) bloque - ENCABEZADO_BLOQUE ) )->capacidad;
+}
+
+/*
+ * Pide al sistema un bloque de "tam" bytes (ya redondeado) en páginas
+ * grandes: primero de las reservadas con hugetlbfs, y si no hay, en
+ * páginas comunes marcadas para que el kernel las junte. Devuelve el
+ * comienzo del mapeo, o NULL.
+ */
+static uint8_t *mapear_bloque( size_t tam, size_t *largo )
+{
+    void *base;
+
+    *largo = ENCABEZADO_BLOQUE + tam;
+    if ( *largo % PAGINA_GRANDE )
+        *largo += PAGINA_GRANDE - *largo % PAGINA_GRANDE;
+
+#ifdef MAP_HUGETLB
+    base = mmap( NULL, *largo, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+    if ( base != MAP_FAILED )
+        return ( uint8_t * ) base;
+#endif
+
+    base = mmap( NULL, *largo, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if ( base == MAP_FAILED )
+        return NULL;
+#ifdef MADV_HUGEPAGE
+    madvise( base, *largo, MADV_HUGEPAGE );
+#endif
+    return ( uint8_t * ) base;
+}
+
+/*
+ * Devuelve al sistema un bloque, con free o munmap según cómo se pidió.
+ */
+static void liberar_bloque( void *bloque )
+{
+    encabezado_bloque *encabezado;
+
+    encabezado = ( encabezado_bloque * ) ( ( uint8_t * ) bloque - ENCABEZADO_BLOQUE );
+    if ( encabezado->mapeado )
+        munmap( encabezado, encabezado->mapeado );
+    else
+        free( encabezado );
+}
+
+void usar_paginas_grandes( bool usar )
+{
+    paginas_grandes = usar;
+}
+
+void *reservar_bloque( size_t tam )
+{
+    uint32_t i, elegido = BLOQUES_RESERVA;
+    uint8_t *base = NULL;
+    size_t mapeado = 0;
+    void *bloque = NULL;
+
+    __atomic_fetch_add( &total_pedido, tam, __ATOMIC_RELAXED );
+
+    /* se usa el bloque más chico que alcance, si no sobra demasiado */
+    pthread_mutex_lock( &mutex_reserva );
+    for ( i = 0; i < BLOQUES_RESERVA; i++ )
+    {
+        if ( reserva[i] != NULL && capacidad_bloque( reserva[i] ) >= tam &&
+                capacidad_bloque( reserva[i] ) / PROPORCION_REUSO <= tam &&
+                ( elegido == BLOQUES_RESERVA ||
+                  capacidad_bloque( reserva[i] ) < capacidad_bloque( reserva[elegido] ) ) )
+            elegido = i;
+    }
+    if ( elegido != BLOQUES_RESERVA )
+    {
+        bloque = reserva[elegido];
+        reserva[elegido] = NULL;
+    }
+    pthread_mutex_unlock( &mutex_reserva );
+
+    if ( bloque != NULL )
+        return bloque;
+
+    /* redondear a la alineación, como pide aligned_alloc */
+    if ( tam % ALINEACION_PIXELS )
+        tam += ALINEACION_PIXELS - tam % ALINEACION_PIXELS;
+
+    if ( paginas_grandes && tam >= PAGINA_GRANDE )
+        base = mapear_bloque( tam, &mapeado );
+    if ( base == NULL )
+    {
+        mapeado = 0;
+        base = ( uint8_t * ) aligned_alloc( ALINEACION_PIXELS, ENCABEZADO_BLOQUE + tam );
+        if ( base == NULL )
+            return NULL;
+    }
+    ( ( encabezado_bloque * ) base )->capacidad = tam;
+    ( ( encabezado_bloque * ) base )->mapeado = mapeado;
+    return base + ENCABEZADO_BLOQUE;
+}
+
+void devolver_bloque( void *bloque )
+{
+    uint32_t i, menor = 0;
+
+    if ( bloque == NULL )
+        return;
+
+    pthread_mutex_lock( &mutex_reserva );
+    for ( i = 0; i < BLOQUES_RESERVA; i++ )
+    {
+        if ( reserva[i] == NULL )
+        {
+            reserva[i] = bloque;
+            pthread_mutex_unlock( &mutex_reserva );
+            return;
+        }
+        if ( capacidad_bloque( reserva[i] ) < capacidad_bloque( reserva[menor] ) )
+            menor = i;
+    }
+
+    /* reserva llena: se queda con el más grande de los dos */
+    if ( capacidad_bloque( reserva[menor] ) < capacidad_bloque( bloque ) )
+    {
+        void *tmp = reserva[menor];
+        reserva[menor] = bloque;
+        bloque = tmp;
+    }
+    pthread_mutex_unlock( &mutex_reserva );
+
+    liberar_bloque( bloque );
+}
+
+void vaciar_reserva( void )
+{
+    uint32_t i;
+
+    pthread_mutex_lock( &mutex_reserva );
+    for ( i = 0; i < BLOQUES_RESERVA; i++ )
+    {
+        if ( reserva[i] != NULL )
+            liberar_bloque( reserva[i] );
+        reserva[i] = NULL;
+    }
+    pthread_mutex_unlock( &mutex_reserva );
+}
+
+uint64_t bytes_pedidos( void )
+{
+    return __atomic_load_n( &total_pedido, __ATOMIC_RELAXED );
+}
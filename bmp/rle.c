@@ -0,0 +1,490 @@
+/***********************************************************************
+ *
+ * Módulo: Compresión RLE8 y RLE4. Al leer, se recorren una vez los
+ *         códigos para anotar dónde empieza cada fila, y después las
+ *         bandas de filas se decodifican en paralelo, cada una desde su
+ *         primera fila. Al grabar, cada banda se codifica en su propio
+ *         buffer y todos salen en un solo writev.
+ * Autor:  Martín Aguilar
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include "../headers/bmp.h"
+#include "../headers/bmp_interno.h"
+#include "../headers/pool.h"
+#include "../headers/salida.h"
+#include "../headers/errores.h"
+
+/* Filas por banda al decodificar y al codificar */
+#define FILAS_BANDA_RLE 64
+
+/* Largo máximo de una corrida o de un tramo sin comprimir */
+#define MAXIMO_RLE 255
+
+/*
+ * Píxeles máximos de una imágen comprimida. Con los saltos y el fin de
+ * imágen unos pocos bytes cubren cualquier tamaño, así que el tamaño
+ * del archivo no acota la matriz: se acota con este máximo.
+ */
+#define MAXIMO_PIXELS_RLE ( 1ull << 28 )
+
+/*
+ * Estado del decodificador: posición en los datos, y columna y fila
+ * (del archivo, contando desde abajo) del próximo píxel.
+ */
+typedef struct
+{
+    uint32_t posicion;
+    uint32_t x;
+    uint32_t y;
+} estado_rle;
+
+/*
+ * Contexto de la lectura que comparten las bandas. "filas" tiene, para
+ * cada fila del archivo, el estado al llegar al primer código que puede
+ * escribir en ella o en una posterior.
+ */
+typedef struct
+{
+    bmp_t            *imagen;
+    const uint8_t    *datos;
+    uint32_t          tam;
+    bool              cuatro;
+    const estado_rle *filas;
+} contexto_leer_rle;
+
+/*
+ * Contexto de la escritura: cada banda deja sus códigos en bloques[k],
+ * con largos[k] bytes.
+ */
+typedef struct
+{
+    const bmp_t  *imagen;
+    bool          cuatro;
+    uint8_t     **bloques;
+    size_t       *largos;
+} contexto_grabar_rle;
+
+// ENCABEZADOS FUNCIONES
+
+void pintar_corrida( const contexto_leer_rle *c, const estado_rle *e,
+                     uint32_t n, uint8_t valor );
+
+void pintar_tramo( const contexto_leer_rle *c, const estado_rle *e,
+                   uint32_t n, const uint8_t *origen );
+
+void recorrer_rle( const contexto_leer_rle *c, estado_rle e,
+                   uint32_t hasta, estado_rle *filas, bool escribir );
+
+void leer_rle_banda( void *ctx, uint32_t desde, uint32_t hasta );
+
+uint32_t largo_corrida( const uint8_t *fila, uint32_t n );
+
+size_t codificar_fila_rle( const uint8_t *fila, uint32_t n, bool cuatro, uint8_t *destino );
+
+void grabar_rle_banda( void *ctx, uint32_t desde, uint32_t hasta );
+
+// FIN ENCABEZADOS
+
+
+/*
+ * Escribe una corrida de "n" píxeles desde el estado "e". En RLE4 los
+ * píxeles alternan entre el nibble alto y el bajo de "valor". Lo que
+ * cae afuera de la imágen se descarta.
+ */
+void pintar_corrida( const contexto_leer_rle *c, const estado_rle *e,
+                     uint32_t n, uint8_t valor )
+{
+    uint32_t ancho = c->imagen->infoheader.width, i;
+    uint8_t *fila;
+
+    if ( e->x >= ancho )
+        return;
+    if ( n > ancho - e->x )
+        n = ancho - e->x;
+
+    fila = c->imagen->filas[c->imagen->infoheader.height - 1 - e->y] + e->x;
+    if ( !c->cuatro || valor >> 4 == ( valor & 0x0F ) )
+    {
+        memset( fila, c->cuatro ? valor & 0x0F : valor, n );
+        return;
+    }
+    for ( i = 0; i < n; i++ )
+        fila[i] = i & 1 ? valor & 0x0F : valor >> 4;
+}
+
+/*
+ * Escribe un tramo sin comprimir de "n" píxeles: bytes en RLE8, nibbles
+ * en RLE4.
+ */
+void pintar_tramo( const contexto_leer_rle *c, const estado_rle *e,
+                   uint32_t n, const uint8_t *origen )
+{
+    uint32_t ancho = c->imagen->infoheader.width, i;
+    uint8_t *fila;
+
+    if ( e->x >= ancho )
+        return;
+    if ( n > ancho - e->x )
+        n = ancho - e->x;
+
+    fila = c->imagen->filas[c->imagen->infoheader.height - 1 - e->y] + e->x;
+    if ( !c->cuatro )
+    {
+        memcpy( fila, origen, n );
+        return;
+    }
+    for ( i = 0; i < n; i++ )
+        fila[i] = i & 1 ? origen[i >> 1] & 0x0F : origen[i >> 1] >> 4;
+}
+
+/*
+ * Recorre los códigos desde el estado "e" hasta llegar a la fila
+ * "hasta" o al final de los datos. Si "filas" no es NULL, anota el
+ * estado con que empieza cada fila; si "escribir" es true, escribe los
+ * píxeles en la matriz de índices. Los datos mal formados cortan el
+ * recorrido, y lo que falte queda en el índice 0.
+ */
+void recorrer_rle( const contexto_leer_rle *c, estado_rle e,
+                   uint32_t hasta, estado_rle *filas, bool escribir )
+{
+    const uint8_t *d = c->datos;
+    uint32_t siguiente = e.y, n, bytes;
+
+    while ( e.y < hasta && e.posicion + 2 <= c->tam )
+    {
+        if ( filas != NULL )
+            while ( siguiente <= e.y )
+                filas[siguiente++] = e;
+
+        n = d[e.posicion];
+        if ( n )
+        {
+            /* corrida: n píxeles con el mismo valor (o par de nibbles) */
+            if ( escribir )
+                pintar_corrida( c, &e, n, d[e.posicion + 1] );
+            e.x += n;
+            e.posicion += 2;
+            continue;
+        }
+
+        n = d[e.posicion + 1];
+        e.posicion += 2;
+        if ( n == 0 )           /* fin de fila */
+        {
+            e.x = 0;
+            e.y++;
+        }
+        else if ( n == 1 )      /* fin de la imágen */
+            break;
+        else if ( n == 2 )      /* salto: dx columnas y dy filas */
+        {
+            if ( e.posicion + 2 > c->tam )
+                break;
+            e.x += d[e.posicion];
+            e.y += d[e.posicion + 1];
+            e.posicion += 2;
+        }
+        else                    /* tramo sin comprimir, relleno a 16 bits */
+        {
+            bytes = c->cuatro ? ( n + 1 ) / 2 : n;
+            if ( e.posicion + bytes > c->tam )
+                break;
+            if ( escribir )
+                pintar_tramo( c, &e, n, d + e.posicion );
+            e.x += n;
+            e.posicion += bytes + ( bytes & 1 );
+        }
+    }
+
+    /* las filas a las que no se llegó quedan vacías */
+    if ( filas != NULL )
+    {
+        e.posicion = c->tam;
+        while ( siguiente < hasta )
+            filas[siguiente++] = e;
+    }
+}
+
+/*
+ * Decodifica las filas [desde, hasta) del archivo, empezando desde el
+ * estado anotado para "desde".
+ */
+void leer_rle_banda( void *ctx, uint32_t desde, uint32_t hasta )
+{
+    const contexto_leer_rle *c = ( const contexto_leer_rle * ) ctx;
+    uint32_t y, alto = c->imagen->infoheader.height;
+
+    for ( y = desde; y < hasta; y++ )
+        memset( c->imagen->filas[alto - 1 - y], 0, c->imagen->infoheader.width );
+
+    recorrer_rle( c, c->filas[desde], hasta, NULL, true );
+}
+
+bool leer_rle( fuente_bmp *fuente, bmp_t *imagen )
+{
+    contexto_leer_rle ctx;
+    matriz_indices indices;
+    estado_rle *filas, inicio = { 0, 0, 0 };
+    uint32_t tam, alto;
+
+    /* el header es lo único que dice cuánta memoria hace falta */
+    if ( imagen->infoheader.width <= 0 || imagen->infoheader.height <= 0 ||
+            ( uint64_t ) imagen->infoheader.width * imagen->infoheader.height > MAXIMO_PIXELS_RLE )
+    {
+        fprintf( salida_errores(), "Error: tamaño incorrecto para una imagen comprimida (%dx%d)\n",
+                 imagen->infoheader.width, imagen->infoheader.height );
+        return false;
+    }
+
+    /* el tamaño de los datos comprimidos es el del header, o hasta el final */
+    tam = imagen->infoheader.bmp_bytesz;
+    if ( !tam && imagen->fileheader.filesz > imagen->fileheader.bmp_offset )
+        tam = imagen->fileheader.filesz - imagen->fileheader.bmp_offset;
+
+    if ( ( ctx.datos = leer_fuente( fuente, tam ) ) == NULL )
+    {
+        fprintf( salida_errores(), "Error leyendo los pixeles comprimidos.\n" );
+        return false;
+    }
+
+    alto = imagen->infoheader.height;
+    if ( !crear_matriz_indices( &indices, imagen->infoheader.width, alto ) )
+        return false;
+    imagen->indices = indices.datos;
+    imagen->filas   = indices.filas;
+    imagen->stride_indices = indices.stride;
+
+    if ( ( filas = ( estado_rle * ) malloc( sizeof( estado_rle ) * alto ) ) == NULL )
+    {
+        fprintf( salida_errores(), "Error alocando memoria para las filas comprimidas\n" );
+        return false;
+    }
+
+    ctx.imagen = imagen;
+    ctx.tam    = tam;
+    ctx.cuatro = imagen->infoheader.tipo_compres == BI_RLE4;
+    ctx.filas  = filas;
+
+    /* primero sólo se anota dónde empieza cada fila */
+    recorrer_rle( &ctx, inicio, alto, filas, false );
+    pool_paralelo( alto, FILAS_BANDA_RLE, leer_rle_banda, &ctx );
+
+    free( filas );
+    return true;
+}
+
+/*
+ * Largo de la corrida de bytes iguales al primero, hasta MAXIMO_RLE.
+ * Se compara de a 8 bytes: el primer byte distinto es el primer bit en
+ * 1 del XOR con el patrón.
+ */
+uint32_t largo_corrida( const uint8_t *fila, uint32_t n )
+{
+    uint64_t patron = 0x0101010101010101ULL * fila[0], bloque;
+    uint32_t i = 1;
+
+    if ( n > MAXIMO_RLE )
+        n = MAXIMO_RLE;
+
+    for ( ; i + 8 <= n; i += 8 )
+    {
+        memcpy( &bloque, fila + i, sizeof( bloque ) );
+        bloque ^= patron;
+        if ( bloque )
+            return i + __builtin_ctzll( bloque ) / 8;
+    }
+    while ( i < n && fila[i] == fila[0] )
+        i++;
+    return i;
+}
+
+/*
+ * Codifica una fila de índices (uno por byte) en "destino", sin el fin
+ * de fila, y devuelve los bytes escritos. Las corridas de dos o más van
+ * comprimidas; lo demás se junta en tramos sin comprimir, que se cortan
+ * al encontrar una corrida de tres o más. Los tramos de menos de tres
+ * píxeles van como corridas de uno, porque el formato no los permite.
+ * "destino" tiene que tener lugar para 2 * n bytes.
+ */
+size_t codificar_fila_rle( const uint8_t *fila, uint32_t n, bool cuatro, uint8_t *destino )
+{
+    uint32_t x = 0, corrida, inicio, largo, i;
+    uint8_t *d = destino;
+
+    while ( x < n )
+    {
+        corrida = largo_corrida( fila + x, n - x );
+        if ( corrida >= 2 )
+        {
+            *d++ = corrida;
+            *d++ = cuatro ? fila[x] << 4 | fila[x] : fila[x];
+            x += corrida;
+            continue;
+        }
+
+        /* tramo sin comprimir, hasta la próxima corrida de tres */
+        inicio = x;
+        while ( x < n && x - inicio < MAXIMO_RLE )
+        {
+            corrida = largo_corrida( fila + x, n - x );
+            if ( corrida >= 3 )
+                break;
+            if ( corrida > MAXIMO_RLE - ( x - inicio ) )
+                corrida = MAXIMO_RLE - ( x - inicio );
+            x += corrida;
+        }
+        largo = x - inicio;
+
+        if ( largo < 3 )
+        {
+            for ( i = inicio; i < x; i++ )
+            {
+                *d++ = 1;
+                *d++ = cuatro ? fila[i] << 4 : fila[i];
+            }
+            continue;
+        }
+
+        *d++ = 0;
+        *d++ = largo;
+        if ( cuatro )
+        {
+            for ( i = 0; i < largo; i += 2 )
+                *d++ = fila[inicio + i] << 4 | ( i + 1 < largo ? fila[inicio + i + 1] : 0 );
+            largo = ( largo + 1 ) / 2;
+        }
+        else
+        {
+            memcpy( d, fila + inicio, largo );
+            d += largo;
+        }
+        if ( largo & 1 )
+            *d++ = 0;
+    }
+
+    return d - destino;
+}
+
+/*
+ * Codifica las bandas [desde, hasta): la banda k son las filas del
+ * archivo desde k * FILAS_BANDA_RLE. Si la imágen ya no está indexada,
+ * cada color se vuelve a buscar en la paleta (y entonces se llama con
+ * todas las bandas, desde un solo hilo).
+ */
+void grabar_rle_banda( void *ctx, uint32_t desde, uint32_t hasta )
+{
+    const contexto_grabar_rle *c = ( const contexto_grabar_rle * ) ctx;
+    const bmp_t *imagen = c->imagen;
+    uint32_t ancho, alto, k, y, y1, x;
+    const uint8_t *fila;
+    uint8_t *indices, *d;
+
+    ancho = imagen->infoheader.width;
+    alto = imagen->infoheader.height;
+    indices = es_indexada( imagen ) ? NULL : ( uint8_t * ) malloc( ancho );
+
+    for ( k = desde; k < hasta; k++ )
+    {
+        y = k * FILAS_BANDA_RLE;
+        y1 = y + FILAS_BANDA_RLE < alto ? y + FILAS_BANDA_RLE : alto;
+
+        /* lo peor son dos bytes por píxel, más el fin de cada fila */
+        c->bloques[k] = ( uint8_t * ) malloc( ( size_t ) ( y1 - y ) * ( 2 * ancho + 2 ) );
+        c->largos[k] = 0;
+        if ( c->bloques[k] == NULL || ( !es_indexada( imagen ) && indices == NULL ) )
+        {
+            fprintf( salida_errores(), "Error alocando memoria para comprimir\n" );
+            continue;
+        }
+
+        for ( d = c->bloques[k]; y < y1; y++ )
+        {
+            if ( es_indexada( imagen ) )
+                fila = imagen->filas[alto - 1 - y];
+            else
+            {
+                for ( x = 0; x < ancho; x++ )
+                    indices[x] = coloresde_paleta( imagen, imagen->pixels[alto - 1 - y][x] );
+                fila = indices;
+            }
+
+            d += codificar_fila_rle( fila, ancho, c->cuatro, d );
+            /* la última fila termina la imágen */
+            *d++ = 0;
+            *d++ = y + 1 == alto ? 1 : 0;
+        }
+        c->largos[k] = d - c->bloques[k];
+    }
+
+    free( indices );
+}
+
+bool grabar_rle( bmp_t *imagen, const char *salida )
+{
+    contexto_grabar_rle ctx;
+    salida_bmp archivo;
+    struct iovec *partes;
+    uint32_t nbandas, k;
+    uint8_t *encabezados = NULL;
+    size_t total;
+    bool ok;
+
+    if ( preparar_encabezados( imagen ) == 0 )
+        return false;
+
+    nbandas = ( imagen->infoheader.height + FILAS_BANDA_RLE - 1 ) / FILAS_BANDA_RLE;
+    ctx.imagen = imagen;
+    ctx.cuatro = imagen->infoheader.bitspp == 4;
+    ctx.bloques = ( uint8_t ** ) calloc( nbandas, sizeof( uint8_t * ) );
+    ctx.largos = ( size_t * ) calloc( nbandas, sizeof( size_t ) );
+    partes = ( struct iovec * ) malloc( sizeof( struct iovec ) * ( nbandas + 1 ) );
+    ok = ctx.bloques != NULL && ctx.largos != NULL && partes != NULL;
+    if ( !ok )
+        fprintf( salida_errores(), "Error alocando memoria para comprimir\n" );
+
+    if ( ok )
+    {
+        /* el índice inverso de la paleta no se puede consultar desde varios hilos */
+        if ( es_indexada( imagen ) )
+            pool_paralelo( nbandas, 1, grabar_rle_banda, &ctx );
+        else
+            grabar_rle_banda( &ctx, 0, nbandas );
+
+        for ( k = 0, total = 0; ok && k < nbandas; k++ )
+        {
+            ok = ctx.bloques[k] != NULL && ( ctx.largos[k] || !imagen->infoheader.width );
+            partes[k + 1].iov_base = ctx.bloques[k];
+            partes[k + 1].iov_len = ctx.largos[k];
+            total += ctx.largos[k];
+        }
+    }
+
+    /* el tamaño de los datos se sabe recién ahora */
+    if ( ok )
+    {
+        imagen->infoheader.tipo_compres = ctx.cuatro ? BI_RLE4 : BI_RLE8;
+        imagen->infoheader.bmp_bytesz = total;
+        imagen->fileheader.filesz = imagen->fileheader.bmp_offset + total;
+        ok = ( encabezados = armar_encabezados( imagen ) ) != NULL;
+    }
+
+    if ( ok && ( ok = abrir_salida( &archivo, salida ) ) )
+    {
+        partes[0].iov_base = encabezados;
+        partes[0].iov_len = imagen->fileheader.bmp_offset;
+        ok = cerrar_salida( &archivo, escribir_salida( &archivo, partes, nbandas + 1 ) );
+    }
+
+    for ( k = 0; ctx.bloques != NULL && k < nbandas; k++ )
+        free( ctx.bloques[k] );
+    free( ctx.bloques );
+    free( ctx.largos );
+    free( partes );
+    free( encabezados );
+    return ok;
+}
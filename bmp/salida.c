@@ -0,0 +1,221 @@
+/***********************************************************************
+ *
+ * Módulo: Implementación de la salida de los BMP. Todo se escribe con
+ *         write/writev/pwrite sobre un temporal, sin el buffer de
+ *         stdio en el medio, y rename lo pone en su lugar al terminar.
+ * Autor:  Martín Aguilar
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../headers/salida.h"
+#include "../headers/errores.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+/* Intentos de nombre para el temporal, por si ya existe */
+#define INTENTOS_TEMPORAL 16
+
+/* Distingue los temporales de varios hilos del mismo proceso */
+static unsigned long contador_temporal = 0;
+
+/*
+ * Abre "nombre" para escribir directo en él, como fopen con "w".
+ */
+static bool abrir_directo( salida_bmp *salida )
+{
+    /* 0666 y el umask, como fopen */
+    if ( ( salida->fd = open( salida->nombre, O_WRONLY | O_CREAT | O_TRUNC, 0666 ) ) < 0 )
+    {
+        fprintf( salida_errores(), "Error al abrir %s para escribir\n", salida->nombre );
+        return false;
+    }
+    salida->posicionable = lseek( salida->fd, 0, SEEK_CUR ) >= 0;
+    return true;
+}
+
+/*
+ * Abre la salida. Si "nombre" no existe o es un archivo regular, se
+ * crea un temporal al lado del archivo final (siguiendo los enlaces
+ * simbólicos), con los permisos y el dueño del archivo que reemplaza.
+ * Los dispositivos, los pipes y los archivos con más de un enlace duro
+ * se escriben directo.
+ */
+bool abrir_salida( salida_bmp *salida, const char *nombre )
+{
+    struct stat info;
+    const char *final;
+    size_t largo;
+    int intento;
+    bool existe;
+
+    salida->fd = -1;
+    salida->nombre = nombre;
+    salida->destino = NULL;
+    salida->temporal = NULL;
+    salida->posicionable = true;
+
+    /* /dev/stdout, /proc/self/fd/N: son descriptores del propio proceso */
+    if ( strncmp( nombre, "/dev/std", 8 ) == 0 || strncmp( nombre, "/dev/fd/", 8 ) == 0 ||
+            strncmp( nombre, "/proc/", 6 ) == 0 )
+        return abrir_directo( salida );
+
+    /* un enlace se reemplaza en el archivo al que apunta, no el enlace */
+    if ( lstat( nombre, &info ) == 0 && S_ISLNK( info.st_mode ) &&
+            ( salida->destino = realpath( nombre, NULL ) ) == NULL )
+        return abrir_directo( salida ); // enlace roto: lo crea fopen igual
+    final = salida->destino != NULL ? salida->destino : nombre;
+
+    /* un fifo no se puede renombrar encima, y un enlace duro se perdería */
+    existe = stat( final, &info ) == 0;
+    if ( existe && ( !S_ISREG( info.st_mode ) || info.st_nlink > 1 ) )
+    {
+        free( salida->destino );
+        salida->destino = NULL;
+        return abrir_directo( salida );
+    }
+
+    largo = strlen( final ) + 48;
+    if ( ( salida->temporal = ( char * ) malloc( largo ) ) == NULL )
+    {
+        fprintf( salida_errores(), "Error alocando memoria para la salida\n" );
+        free( salida->destino );
+        salida->destino = NULL;
+        return false;
+    }
+
+    for ( intento = 0; intento < INTENTOS_TEMPORAL; intento++ )
+    {
+        snprintf( salida->temporal, largo, "%s.%ld.%lu.tmp", final, ( long ) getpid(),
+                  __atomic_fetch_add( &contador_temporal, 1, __ATOMIC_RELAXED ) );
+        /* 0666 y el umask, como fopen */
+        salida->fd = open( salida->temporal, O_WRONLY | O_CREAT | O_EXCL, 0666 );
+        if ( salida->fd >= 0 || errno != EEXIST )
+            break;
+    }
+    if ( salida->fd < 0 )
+    {
+        fprintf( salida_errores(), "Error al abrir %s para escribir\n", nombre );
+        free( salida->temporal );
+        free( salida->destino );
+        salida->temporal = NULL;
+        salida->destino = NULL;
+        return false;
+    }
+
+    /* el reemplazo queda como el archivo anterior; el dueño, si se puede */
+    if ( existe )
+    {
+        fchmod( salida->fd, info.st_mode & 07777 );
+        if ( fchown( salida->fd, info.st_uid, info.st_gid ) )
+            fchmod( salida->fd, info.st_mode & 0777 );
+    }
+
+    return true;
+}
+
+/*
+ * Escribe las "cant" partes seguidas, en la posición actual, con la
+ * menor cantidad de llamadas posible.
+ */
+bool escribir_salida( salida_bmp *salida, const struct iovec *partes, int cant )
+{
+    struct iovec pendientes[IOV_MAX];
+    ssize_t escritos;
+    int n, i;
+
+    while ( cant > 0 )
+    {
+        n = cant < IOV_MAX ? cant : IOV_MAX;
+        memcpy( pendientes, partes, sizeof( struct iovec ) * n );
+        partes += n;
+        cant -= n;
+
+        /* writev puede escribir menos: se sigue desde donde quedó */
+        for ( i = 0; i < n; )
+        {
+            if ( ( escritos = writev( salida->fd, pendientes + i, n - i ) ) < 0 )
+            {
+                if ( errno == EINTR )
+                    continue;
+                fprintf( salida_errores(), "Error guardando imagen\n" );
+                return false;
+            }
+            while ( i < n && ( size_t ) escritos >= pendientes[i].iov_len )
+                escritos -= pendientes[i++].iov_len;
+            if ( i < n )
+            {
+                pendientes[i].iov_base = ( uint8_t * ) pendientes[i].iov_base + escritos;
+                pendientes[i].iov_len -= escritos;
+            }
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Escribe n bytes en la posición indicada, sin mover la actual.
+ */
+bool escribir_salida_en( salida_bmp *salida, const void *datos, size_t n, off_t posicion )
+{
+    const uint8_t *p = ( const uint8_t * ) datos;
+    ssize_t escritos;
+
+    while ( n > 0 )
+    {
+        if ( ( escritos = pwrite( salida->fd, p, n, posicion ) ) < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            fprintf( salida_errores(), "Error guardando imagen\n" );
+            return false;
+        }
+        p += escritos;
+        n -= escritos;
+        posicion += escritos;
+    }
+
+    return true;
+}
+
+/*
+ * Cierra la salida. Si "ok", el temporal reemplaza al archivo final; si
+ * no, se borra y el archivo final queda como estaba.
+ */
+bool cerrar_salida( salida_bmp *salida, bool ok )
+{
+    if ( salida->fd >= 0 && close( salida->fd ) && ok )
+    {
+        fprintf( salida_errores(), "Error guardando imagen\n" );
+        ok = false;
+    }
+    salida->fd = -1;
+
+    if ( salida->temporal != NULL )
+    {
+        if ( ok && rename( salida->temporal, salida->destino != NULL ?
+                                             salida->destino : salida->nombre ) )
+        {
+            fprintf( salida_errores(), "Error al renombrar %s a %s\n", salida->temporal, salida->nombre );
+            ok = false;
+        }
+        if ( !ok )
+            unlink( salida->temporal );
+        free( salida->temporal );
+        salida->temporal = NULL;
+    }
+    free( salida->destino );
+    salida->destino = NULL;
+
+    return ok;
+}
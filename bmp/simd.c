@@ -0,0 +1,508 @@
+/***********************************************************************
+ *
+ * Módulo: Implementación de los núcleos vectoriales. En x86 se elige
+ *         en tiempo de ejecución la mejor versión que soporte el
+ *         procesador; el resto de las arquitecturas usa la escalar.
+ *         Todas las versiones dan exactamente el mismo resultado.
+ * Autor:  Martín Aguilar
+ *
+ **********************************************************************/
+
+#include <string.h>
+#include "../headers/simd.h"
+
+#if defined( __GNUC__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+#define SIMD_X86
+#include <immintrin.h>
+#endif
+
+/*
+ * Máscara de la negación: rojo, verde y azul en FF, alpha en 00. Como
+ * 255 - x == x ^ 255, negar un píxel es un XOR con esta máscara.
+ */
+#define MASCARA_NEGATIVO 0x00FFFFFFu
+
+// ENCABEZADOS FUNCIONES
+
+void negar_pixels_escalar( bmpcolor_t *pixels, size_t cant );
+
+void expandir_bgr_escalar( const uint8_t *origen, bmpcolor_t *destino, size_t cant );
+
+void empaquetar_bgr_escalar( const bmpcolor_t *origen, uint8_t *destino, size_t cant );
+
+void acumular_fila_escalar( int32_t *suma, const uint8_t *fila, int16_t peso, size_t cant );
+
+void saturar_fila_escalar( const int32_t *suma, uint8_t *destino, size_t cant );
+
+void filtrar_fila_escalar( const bmpcolor_t *origen, bmpcolor_t *destino, size_t cant,
+                           const int32_t *inicio, const int16_t *pesos, uint32_t taps );
+
+uint8_t saturar_peso( int32_t suma );
+
+#ifdef SIMD_X86
+size_t negar_pixels_sse2( bmpcolor_t *pixels, size_t cant );
+
+size_t negar_pixels_avx2( bmpcolor_t *pixels, size_t cant );
+
+size_t expandir_bgr_ssse3( const uint8_t *origen, bmpcolor_t *destino, size_t cant );
+
+size_t expandir_bgr_avx2( const uint8_t *origen, bmpcolor_t *destino, size_t cant );
+
+size_t empaquetar_bgr_ssse3( const bmpcolor_t *origen, uint8_t *destino, size_t cant );
+
+size_t empaquetar_bgr_avx2( const bmpcolor_t *origen, uint8_t *destino, size_t cant );
+
+size_t acumular_fila_sse2( int32_t *suma, const uint8_t *fila, int16_t peso, size_t cant );
+
+size_t acumular_fila_avx2( int32_t *suma, const uint8_t *fila, int16_t peso, size_t cant );
+
+size_t saturar_fila_sse2( const int32_t *suma, uint8_t *destino, size_t cant );
+
+size_t saturar_fila_avx2( const int32_t *suma, uint8_t *destino, size_t cant );
+
+size_t filtrar_fila_sse2( const bmpcolor_t *origen, bmpcolor_t *destino, size_t cant,
+                          const int32_t *inicio, const int16_t *pesos, uint32_t taps );
+#endif
+
+// FIN ENCABEZADOS
+
+
+void negar_pixels_escalar( bmpcolor_t *pixels, size_t cant )
+{
+    size_t i;
+
+    for ( i = 0; i < cant; i++ )
+    {
+        pixels[i].red   = 255 - pixels[i].red;
+        pixels[i].green = 255 - pixels[i].green;
+        pixels[i].blue  = 255 - pixels[i].blue;
+    }
+}
+
+void expandir_bgr_escalar( const uint8_t *origen, bmpcolor_t *destino, size_t cant )
+{
+    size_t i;
+    bmpcolor_t color;
+
+    for ( i = 0; i < cant; i++ )
+    {
+        color.blue  = *origen++;
+        color.green = *origen++;
+        color.red   = *origen++;
+        color.alpha = 0;
+
+        destino[i] = color;
+    }
+}
+
+void empaquetar_bgr_escalar( const bmpcolor_t *origen, uint8_t *destino, size_t cant )
+{
+    size_t i;
+
+    for ( i = 0; i < cant; i++ )
+    {
+        *destino++ = origen[i].blue;
+        *destino++ = origen[i].green;
+        *destino++ = origen[i].red;
+    }
+}
+
+/*
+ * Redondea una suma de punto fijo y la recorta a un byte. Los filtros
+ * con lóbulos negativos (Lanczos) pueden dar de menos de 0 o más de 255.
+ */
+uint8_t saturar_peso( int32_t suma )
+{
+    suma = ( suma + UNO_PESO / 2 ) >> BITS_PESO;
+    if ( suma < 0 )
+        return 0;
+    if ( suma > 255 )
+        return 255;
+    return ( uint8_t ) suma;
+}
+
+void acumular_fila_escalar( int32_t *suma, const uint8_t *fila, int16_t peso, size_t cant )
+{
+    size_t i;
+
+    for ( i = 0; i < cant; i++ )
+        suma[i] += peso * fila[i];
+}
+
+void saturar_fila_escalar( const int32_t *suma, uint8_t *destino, size_t cant )
+{
+    size_t i;
+
+    for ( i = 0; i < cant; i++ )
+        destino[i] = saturar_peso( suma[i] );
+}
+
+void filtrar_fila_escalar( const bmpcolor_t *origen, bmpcolor_t *destino, size_t cant,
+                           const int32_t *inicio, const int16_t *pesos, uint32_t taps )
+{
+    const bmpcolor_t *o;
+    const int16_t *p;
+    int32_t r, g, b, a;
+    size_t x;
+    uint32_t k;
+
+    for ( x = 0; x < cant; x++ )
+    {
+        o = origen + inicio[x];
+        p = pesos + x * taps;
+        r = g = b = a = 0;
+        for ( k = 0; k < taps; k++ )
+        {
+            r += p[k] * o[k].red;
+            g += p[k] * o[k].green;
+            b += p[k] * o[k].blue;
+            a += p[k] * o[k].alpha;
+        }
+        destino[x].red   = saturar_peso( r );
+        destino[x].green = saturar_peso( g );
+        destino[x].blue  = saturar_peso( b );
+        destino[x].alpha = saturar_peso( a );
+    }
+}
+
+#ifdef SIMD_X86
+
+/*
+ * Las versiones vectoriales procesan los píxeles que entran en bloques
+ * enteros y devuelven cuántos procesaron; el resto lo hace la escalar.
+ * Ninguna lee ni escribe fuera de los "cant" píxeles.
+ */
+
+__attribute__(( target( "sse2" ) ))
+size_t negar_pixels_sse2( bmpcolor_t *pixels, size_t cant )
+{
+    const __m128i mascara = _mm_set1_epi32( MASCARA_NEGATIVO );
+    __m128i *p = ( __m128i * ) pixels;
+    size_t i;
+
+    for ( i = 0; i + 4 <= cant; i += 4, p++ )
+        _mm_storeu_si128( p, _mm_xor_si128( _mm_loadu_si128( p ), mascara ) );
+    return i;
+}
+
+__attribute__(( target( "avx2" ) ))
+size_t negar_pixels_avx2( bmpcolor_t *pixels, size_t cant )
+{
+    const __m256i mascara = _mm256_set1_epi32( MASCARA_NEGATIVO );
+    __m256i *p = ( __m256i * ) pixels;
+    size_t i;
+
+    for ( i = 0; i + 8 <= cant; i += 8, p++ )
+        _mm256_storeu_si256( p, _mm256_xor_si256( _mm256_loadu_si256( p ), mascara ) );
+    return i;
+}
+
+/*
+ * Expande de a 4 píxeles: se cargan 16 bytes (los 12 de los píxeles y
+ * 4 del siguiente), por eso tienen que quedar al menos 6 píxeles.
+ */
+__attribute__(( target( "ssse3" ) ))
+size_t expandir_bgr_ssse3( const uint8_t *origen, bmpcolor_t *destino, size_t cant )
+{
+    const __m128i orden = _mm_setr_epi8( 0, 1, 2, -1, 3, 4, 5, -1,
+                                         6, 7, 8, -1, 9, 10, 11, -1 );
+    __m128i v;
+    size_t i;
+
+    for ( i = 0; i + 6 <= cant; i += 4 )
+    {
+        v = _mm_loadu_si128( ( const __m128i * ) ( origen + i * 3 ) );
+        _mm_storeu_si128( ( __m128i * ) ( destino + i ), _mm_shuffle_epi8( v, orden ) );
+    }
+    return i;
+}
+
+/*
+ * Expande de a 8 píxeles: se leen exactamente sus 24 bytes, se reparten
+ * 12 en cada mitad del registro y se intercalan los alpha en 0.
+ */
+__attribute__(( target( "avx2" ) ))
+size_t expandir_bgr_avx2( const uint8_t *origen, bmpcolor_t *destino, size_t cant )
+{
+    const __m256i mitades = _mm256_setr_epi32( 0, 1, 2, 0, 3, 4, 5, 0 );
+    const __m256i orden = _mm256_setr_epi8( 0, 1, 2, -1, 3, 4, 5, -1,
+                                            6, 7, 8, -1, 9, 10, 11, -1,
+                                            0, 1, 2, -1, 3, 4, 5, -1,
+                                            6, 7, 8, -1, 9, 10, 11, -1 );
+    const uint8_t *o;
+    __m256i v;
+    size_t i;
+
+    for ( i = 0; i + 8 <= cant; i += 8 )
+    {
+        o = origen + i * 3;
+        v = _mm256_inserti128_si256(
+                _mm256_castsi128_si256( _mm_loadu_si128( ( const __m128i * ) o ) ),
+                _mm_loadl_epi64( ( const __m128i * ) ( o + 16 ) ), 1 );
+        v = _mm256_permutevar8x32_epi32( v, mitades );
+        _mm256_storeu_si256( ( __m256i * ) ( destino + i ), _mm256_shuffle_epi8( v, orden ) );
+    }
+    return i;
+}
+
+/*
+ * Empaqueta de a 4 píxeles: quedan 12 bytes, que se graban como 8 + 4.
+ */
+__attribute__(( target( "ssse3" ) ))
+size_t empaquetar_bgr_ssse3( const bmpcolor_t *origen, uint8_t *destino, size_t cant )
+{
+    const __m128i orden = _mm_setr_epi8( 0, 1, 2, 4, 5, 6, 8, 9,
+                                         10, 12, 13, 14, -1, -1, -1, -1 );
+    __m128i v;
+    uint32_t resto;
+    size_t i;
+
+    for ( i = 0; i + 4 <= cant; i += 4 )
+    {
+        v = _mm_shuffle_epi8( _mm_loadu_si128( ( const __m128i * ) ( origen + i ) ), orden );
+        _mm_storel_epi64( ( __m128i * ) ( destino + i * 3 ), v );
+        resto = _mm_cvtsi128_si32( _mm_srli_si128( v, 8 ) );
+        memcpy( destino + i * 3 + 8, &resto, 4 );
+    }
+    return i;
+}
+
+/*
+ * Empaqueta de a 8 píxeles: cada mitad deja 12 bytes al principio, se
+ * juntan los 24 y se graban como 16 + 8.
+ */
+__attribute__(( target( "avx2" ) ))
+size_t empaquetar_bgr_avx2( const bmpcolor_t *origen, uint8_t *destino, size_t cant )
+{
+    const __m256i orden = _mm256_setr_epi8( 0, 1, 2, 4, 5, 6, 8, 9,
+                                            10, 12, 13, 14, -1, -1, -1, -1,
+                                            0, 1, 2, 4, 5, 6, 8, 9,
+                                            10, 12, 13, 14, -1, -1, -1, -1 );
+    const __m256i juntar = _mm256_setr_epi32( 0, 1, 2, 4, 5, 6, 3, 7 );
+    __m256i v;
+    size_t i;
+
+    for ( i = 0; i + 8 <= cant; i += 8 )
+    {
+        v = _mm256_shuffle_epi8( _mm256_loadu_si256( ( const __m256i * ) ( origen + i ) ), orden );
+        v = _mm256_permutevar8x32_epi32( v, juntar );
+        _mm_storeu_si128( ( __m128i * ) ( destino + i * 3 ), _mm256_castsi256_si128( v ) );
+        _mm_storel_epi64( ( __m128i * ) ( destino + i * 3 + 16 ), _mm256_extracti128_si256( v, 1 ) );
+    }
+    return i;
+}
+
+/*
+ * Acumula de a 16 bytes: se pasan a 16 bits, y los productos de 32 bits
+ * se arman con la parte baja y la alta de la multiplicación de 16.
+ */
+__attribute__(( target( "sse2" ) ))
+size_t acumular_fila_sse2( int32_t *suma, const uint8_t *fila, int16_t peso, size_t cant )
+{
+    const __m128i cero = _mm_setzero_si128();
+    const __m128i w = _mm_set1_epi16( peso );
+    __m128i v, mitad, bajo, alto, *s;
+    size_t i;
+    int m;
+
+    for ( i = 0; i + 16 <= cant; i += 16 )
+    {
+        v = _mm_loadu_si128( ( const __m128i * ) ( fila + i ) );
+        s = ( __m128i * ) ( suma + i );
+        for ( m = 0; m < 2; m++ )
+        {
+            mitad = m ? _mm_unpackhi_epi8( v, cero ) : _mm_unpacklo_epi8( v, cero );
+            bajo = _mm_mullo_epi16( mitad, w );
+            alto = _mm_mulhi_epi16( mitad, w );
+            _mm_storeu_si128( s, _mm_add_epi32( _mm_loadu_si128( s ),
+                                                _mm_unpacklo_epi16( bajo, alto ) ) );
+            s++;
+            _mm_storeu_si128( s, _mm_add_epi32( _mm_loadu_si128( s ),
+                                                _mm_unpackhi_epi16( bajo, alto ) ) );
+            s++;
+        }
+    }
+    return i;
+}
+
+__attribute__(( target( "avx2" ) ))
+size_t acumular_fila_avx2( int32_t *suma, const uint8_t *fila, int16_t peso, size_t cant )
+{
+    const __m256i w = _mm256_set1_epi32( peso );
+    __m256i v, *s;
+    size_t i;
+
+    for ( i = 0; i + 8 <= cant; i += 8 )
+    {
+        v = _mm256_cvtepu8_epi32( _mm_loadl_epi64( ( const __m128i * ) ( fila + i ) ) );
+        s = ( __m256i * ) ( suma + i );
+        _mm256_storeu_si256( s, _mm256_add_epi32( _mm256_loadu_si256( s ),
+                                                  _mm256_mullo_epi32( v, w ) ) );
+    }
+    return i;
+}
+
+/*
+ * Satura de a 16: redondeo y corrimiento en 32 bits, y los dos pack con
+ * saturación recortan a [0, 255].
+ */
+__attribute__(( target( "sse2" ) ))
+size_t saturar_fila_sse2( const int32_t *suma, uint8_t *destino, size_t cant )
+{
+    const __m128i medio = _mm_set1_epi32( UNO_PESO / 2 );
+    __m128i v[4];
+    size_t i;
+    int k;
+
+    for ( i = 0; i + 16 <= cant; i += 16 )
+    {
+        for ( k = 0; k < 4; k++ )
+            v[k] = _mm_srai_epi32( _mm_add_epi32( _mm_loadu_si128( ( const __m128i * ) ( suma + i ) + k ),
+                                                  medio ), BITS_PESO );
+        _mm_storeu_si128( ( __m128i * ) ( destino + i ),
+                          _mm_packus_epi16( _mm_packs_epi32( v[0], v[1] ),
+                                            _mm_packs_epi32( v[2], v[3] ) ) );
+    }
+    return i;
+}
+
+/*
+ * Igual que la SSE2 de a 32; los pack trabajan por mitades del
+ * registro, así que al final se reordenan los grupos de 4 bytes.
+ */
+__attribute__(( target( "avx2" ) ))
+size_t saturar_fila_avx2( const int32_t *suma, uint8_t *destino, size_t cant )
+{
+    const __m256i medio = _mm256_set1_epi32( UNO_PESO / 2 );
+    const __m256i orden = _mm256_setr_epi32( 0, 4, 1, 5, 2, 6, 3, 7 );
+    __m256i v[4], b;
+    size_t i;
+    int k;
+
+    for ( i = 0; i + 32 <= cant; i += 32 )
+    {
+        for ( k = 0; k < 4; k++ )
+            v[k] = _mm256_srai_epi32( _mm256_add_epi32( _mm256_loadu_si256( ( const __m256i * ) ( suma + i ) + k ),
+                                                        medio ), BITS_PESO );
+        b = _mm256_packus_epi16( _mm256_packs_epi32( v[0], v[1] ),
+                                 _mm256_packs_epi32( v[2], v[3] ) );
+        _mm256_storeu_si256( ( __m256i * ) ( destino + i ), _mm256_permutevar8x32_epi32( b, orden ) );
+    }
+    return i;
+}
+
+/*
+ * Filtra un píxel por vuelta, con los cuatro canales en un registro:
+ * cada canal queda en 32 bits como el par (canal, 0) de 16, y madd con
+ * el par (peso, 0) da canal * peso.
+ */
+__attribute__(( target( "sse2" ) ))
+size_t filtrar_fila_sse2( const bmpcolor_t *origen, bmpcolor_t *destino, size_t cant,
+                          const int32_t *inicio, const int16_t *pesos, uint32_t taps )
+{
+    const __m128i cero = _mm_setzero_si128();
+    const __m128i medio = _mm_set1_epi32( UNO_PESO / 2 );
+    const bmpcolor_t *o;
+    const int16_t *p;
+    __m128i suma, v;
+    uint32_t k, color;
+    size_t x;
+
+    for ( x = 0; x < cant; x++ )
+    {
+        o = origen + inicio[x];
+        p = pesos + x * taps;
+        suma = medio;
+        for ( k = 0; k < taps; k++ )
+        {
+            memcpy( &color, o + k, sizeof( color ) );
+            v = _mm_unpacklo_epi16( _mm_unpacklo_epi8( _mm_cvtsi32_si128( color ), cero ), cero );
+            suma = _mm_add_epi32( suma, _mm_madd_epi16( v, _mm_set1_epi32( ( uint16_t ) p[k] ) ) );
+        }
+        v = _mm_srai_epi32( suma, BITS_PESO );
+        v = _mm_packus_epi16( _mm_packs_epi32( v, v ), v );
+        color = _mm_cvtsi128_si32( v );
+        memcpy( destino + x, &color, sizeof( color ) );
+    }
+    return x;
+}
+
+#endif
+
+void negar_pixels( bmpcolor_t *pixels, size_t cant )
+{
+    size_t hechos = 0;
+
+#ifdef SIMD_X86
+    if ( __builtin_cpu_supports( "avx2" ) )
+        hechos = negar_pixels_avx2( pixels, cant );
+    else if ( __builtin_cpu_supports( "sse2" ) )
+        hechos = negar_pixels_sse2( pixels, cant );
+#endif
+    negar_pixels_escalar( pixels + hechos, cant - hechos );
+}
+
+void expandir_bgr( const uint8_t *origen, bmpcolor_t *destino, size_t cant )
+{
+    size_t hechos = 0;
+
+#ifdef SIMD_X86
+    if ( __builtin_cpu_supports( "avx2" ) )
+        hechos = expandir_bgr_avx2( origen, destino, cant );
+    else if ( __builtin_cpu_supports( "ssse3" ) )
+        hechos = expandir_bgr_ssse3( origen, destino, cant );
+#endif
+    expandir_bgr_escalar( origen + hechos * 3, destino + hechos, cant - hechos );
+}
+
+void empaquetar_bgr( const bmpcolor_t *origen, uint8_t *destino, size_t cant )
+{
+    size_t hechos = 0;
+
+#ifdef SIMD_X86
+    if ( __builtin_cpu_supports( "avx2" ) )
+        hechos = empaquetar_bgr_avx2( origen, destino, cant );
+    else if ( __builtin_cpu_supports( "ssse3" ) )
+        hechos = empaquetar_bgr_ssse3( origen, destino, cant );
+#endif
+    empaquetar_bgr_escalar( origen + hechos, destino + hechos * 3, cant - hechos );
+}
+
+void acumular_fila( int32_t *suma, const uint8_t *fila, int16_t peso, size_t cant )
+{
+    size_t hechos = 0;
+
+#ifdef SIMD_X86
+    if ( __builtin_cpu_supports( "avx2" ) )
+        hechos = acumular_fila_avx2( suma, fila, peso, cant );
+    else if ( __builtin_cpu_supports( "sse2" ) )
+        hechos = acumular_fila_sse2( suma, fila, peso, cant );
+#endif
+    acumular_fila_escalar( suma + hechos, fila + hechos, peso, cant - hechos );
+}
+
+void saturar_fila( const int32_t *suma, uint8_t *destino, size_t cant )
+{
+    size_t hechos = 0;
+
+#ifdef SIMD_X86
+    if ( __builtin_cpu_supports( "avx2" ) )
+        hechos = saturar_fila_avx2( suma, destino, cant );
+    else if ( __builtin_cpu_supports( "sse2" ) )
+        hechos = saturar_fila_sse2( suma, destino, cant );
+#endif
+    saturar_fila_escalar( suma + hechos, destino + hechos, cant - hechos );
+}
+
+void filtrar_fila( const bmpcolor_t *origen, bmpcolor_t *destino, size_t cant,
+                   const int32_t *inicio, const int16_t *pesos, uint32_t taps )
+{
+    size_t hechos = 0;
+
+#ifdef SIMD_X86
+    if ( __builtin_cpu_supports( "sse2" ) )
+        hechos = filtrar_fila_sse2( origen, destino, cant, inicio, pesos, taps );
+#endif
+    filtrar_fila_escalar( origen, destino + hechos, cant - hechos, inicio + hechos,
+                          pesos + hechos * taps, taps );
+}
@@ -0,0 +1,205 @@
+/***********************************************************************
+ *
+ * Módulo: Cliente de prueba del modo servidor (-D). Manda las opciones
+ *         recibidas como un trabajo y muestra la respuesta: lo que
+ *         escribió el trabajo y la línea del resultado, que es la última.
+ *         Con "-i -" la imágen se lee de la entrada estándar y se manda
+ *         por el socket; con "-o -" la imágen grabada llega por el
+ *         socket y se escribe en la salida estándar, y los mensajes del
+ *         trabajo van a la salida de errores.
+ *         Uso: cliente SOCKET OPCIONES...
+ *         Ej.: cliente /tmp/wat.sock -n -i in.bmp -o out.bmp
+ *              cliente /tmp/wat.sock -n -i - -o - < in.bmp > out.bmp
+ * Autor:  Martín Aguilar
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* Bytes que se copian de una vez */
+#define BLOQUE 65536
+
+// ENCABEZADOS FUNCIONES
+
+bool enviar( int fd, const void *datos, size_t largo );
+
+bool enviar_entrada( int fd );
+
+bool copiar_imagen( FILE *respuesta, unsigned long long bytes );
+
+bool tiene_opcion( int argc, char *argv[], const char *opcion );
+
+// FIN ENCABEZADOS
+
+
+bool enviar( int fd, const void *datos, size_t largo )
+{
+    const char *p = ( const char * ) datos;
+    ssize_t n;
+
+    while ( largo > 0 )
+    {
+        if ( ( n = write( fd, p, largo ) ) <= 0 )
+            return false;
+        p += n;
+        largo -= n;
+    }
+    return true;
+}
+
+/*
+ * Lee toda la entrada estándar y la manda como "DATOS BYTES" y los
+ * bytes.
+ */
+bool enviar_entrada( int fd )
+{
+    char *datos = NULL, *nuevo, linea[64];
+    size_t largo = 0, capacidad = 0, leido;
+    bool ok;
+
+    do
+    {
+        if ( largo == capacidad )
+        {
+            capacidad = capacidad ? capacidad * 2 : BLOQUE;
+            if ( ( nuevo = ( char * ) realloc( datos, capacidad ) ) == NULL )
+            {
+                free( datos );
+                return false;
+            }
+            datos = nuevo;
+        }
+        leido = fread( datos + largo, 1, capacidad - largo, stdin );
+        largo += leido;
+    }
+    while ( leido > 0 );
+
+    snprintf( linea, sizeof( linea ), "DATOS %zu\n", largo );
+    ok = enviar( fd, linea, strlen( linea ) ) && enviar( fd, datos, largo );
+    free( datos );
+    return ok;
+}
+
+/*
+ * Copia a la salida estándar los "bytes" de la imágen que llegó.
+ */
+bool copiar_imagen( FILE *respuesta, unsigned long long bytes )
+{
+    char bloque[BLOQUE];
+    size_t parte;
+
+    while ( bytes > 0 )
+    {
+        parte = bytes < BLOQUE ? bytes : BLOQUE;
+        if ( fread( bloque, 1, parte, respuesta ) != parte ||
+                fwrite( bloque, 1, parte, stdout ) != parte )
+            return false;
+        bytes -= parte;
+    }
+    return true;
+}
+
+/*
+ * Devuelve true si entre las opciones está "opcion" seguida de "-".
+ */
+bool tiene_opcion( int argc, char *argv[], const char *opcion )
+{
+    int i;
+
+    for ( i = 2; i + 1 < argc; i++ )
+        if ( strcmp( argv[i], opcion ) == 0 && strcmp( argv[i + 1], "-" ) == 0 )
+            return true;
+    return false;
+}
+
+int main( int argc, char *argv[] )
+{
+    struct sockaddr_un direccion;
+    char linea[4096], ultima[3] = "";
+    unsigned long long bytes;
+    bool comienzo = true;
+    FILE *respuesta, *textos;
+    int fd, i;
+
+    if ( argc < 3 )
+    {
+        fprintf( stderr, "Uso: %s SOCKET OPCIONES...\n", argv[0] );
+        return EXIT_FAILURE;
+    }
+
+    if ( strlen( argv[1] ) >= sizeof( direccion.sun_path ) ||
+            ( fd = socket( AF_UNIX, SOCK_STREAM, 0 ) ) < 0 )
+    {
+        fprintf( stderr, "Error creando el socket\n" );
+        return EXIT_FAILURE;
+    }
+
+    memset( &direccion, 0, sizeof( direccion ) );
+    direccion.sun_family = AF_UNIX;
+    strcpy( direccion.sun_path, argv[1] );
+    if ( connect( fd, ( struct sockaddr * ) &direccion, sizeof( direccion ) ) )
+    {
+        fprintf( stderr, "No se pudo conectar a %s\n", argv[1] );
+        close( fd );
+        return EXIT_FAILURE;
+    }
+
+    /* una opción por línea, una línea vacía al final, y la imágen de "-i -" */
+    for ( i = 2; i < argc; i++ )
+    {
+        if ( !enviar( fd, argv[i], strlen( argv[i] ) ) || !enviar( fd, "\n", 1 ) )
+        {
+            fprintf( stderr, "Error enviando el trabajo\n" );
+            close( fd );
+            return EXIT_FAILURE;
+        }
+    }
+    if ( !enviar( fd, "\n", 1 ) )
+    {
+        fprintf( stderr, "Error enviando el trabajo\n" );
+        close( fd );
+        return EXIT_FAILURE;
+    }
+    /* si el servidor rechaza el trabajo no lee la imágen: la respuesta dice por qué */
+    signal( SIGPIPE, SIG_IGN );
+    if ( tiene_opcion( argc, argv, "-i" ) )
+        enviar_entrada( fd );
+
+    if ( ( respuesta = fdopen( fd, "r" ) ) == NULL )
+    {
+        close( fd );
+        return EXIT_FAILURE;
+    }
+
+    /* con "-o -" la salida estándar es para la imágen */
+    textos = tiene_opcion( argc, argv, "-o" ) ? stderr : stdout;
+
+    /* se muestra a medida que llega; de cada línea se guarda el comienzo */
+    while ( fgets( linea, sizeof( linea ), respuesta ) != NULL )
+    {
+        if ( comienzo && sscanf( linea, "DATOS %llu", &bytes ) == 1 )
+        {
+            if ( !copiar_imagen( respuesta, bytes ) )
+            {
+                fprintf( stderr, "Error recibiendo la imagen\n" );
+                fclose( respuesta );
+                return EXIT_FAILURE;
+            }
+            continue;
+        }
+        fputs( linea, textos );
+        if ( comienzo )
+            strncpy( ultima, linea, sizeof( ultima ) - 1 );
+        comienzo = linea[strlen( linea ) - 1] == '\n';
+    }
+    fclose( respuesta );
+
+    return strncmp( ultima, "OK", 2 ) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
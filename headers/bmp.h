@@ -8,6 +8,7 @@
 
 #ifndef BMP_H
 #define BMP_H
+#include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -23,36 +24,107 @@ typedef struct
 
 typedef struct bmp bmp_t;
 
+/*
+ * Filtros para redimensionar a cualquier tamaño.
+ */
+typedef enum
+{
+    FILTRO_CERCANO,
+    FILTRO_CAJA,
+    FILTRO_BILINEAL,
+    FILTRO_LANCZOS
+} filtro_escala;
+
+/*
+ * Operaciones que trabajan de a una fila, o que sólo cambian el orden
+ * de las filas. Se pueden aplicar leyendo y grabando la imágen por
+ * filas, sin tenerla entera en memoria.
+ */
+typedef enum
+{
+    FILA_NEGATIVO,
+    FILA_LINEAS_H,
+    FILA_LINEAS_V,
+    FILA_FLIP
+} tipo_op_fila;
+
+/*
+ * Una operación por filas, con los parámetros de las líneas (si es que
+ * es una de líneas). En las imágenes indexadas, "indice" es la entrada
+ * de la paleta con que se pintan las líneas; se completa al aplicarla.
+ */
+typedef struct
+{
+    tipo_op_fila tipo;
+    uint32_t     ancho;
+    uint32_t     espacio;
+    bmpcolor_t   color;
+    uint8_t      indice;
+} op_fila;
 
 
 /*
  *  Mostrar header recibe un puntero a un archivo bmp ya cargado
- *  en memoria, e imprime los headers en stdout.
+ *  en memoria, e imprime los headers en "salida".
 */
-void mostrar_header( bmp_t *imagen );
+void mostrar_header( bmp_t *imagen, FILE *salida );
 
 
 /*
- * Rota la imágen 90 grados.
+ * Rota la imágen "veces" x 90 grados (90, 180 o 270).
  */
-void rotar( bmp_t *const imagen );
+void rotar( const uint32_t veces, bmp_t *const imagen );
 
 /*
  * Produce el "negativo" de la imágen.
  */
-void negativo( const bmp_t *const imagen );
+void negativo( bmp_t *const imagen );
 
 
 /*
- * Redimensiona la imágen al doble de tamaño.
+ * Redimensiona la imágen al doble de tamaño, repitiendo cada píxel.
  */
 void redimensionar2x( bmp_t *const imagen );
 
 /*
- * Redimensiona la imágen a la mitad de tamaño.
+ * Redimensiona la imágen a la mitad de tamaño, promediando cada bloque
+ * de 2x2 píxeles.
  */
 void redimensionar1_2x( bmp_t *const imagen );
 
+/*
+ * Agranda la imágen "nx" veces en horizontal y "ny" en vertical,
+ * repitiendo cada píxel.
+ */
+void ampliar_entero( bmp_t *const imagen, const uint32_t nx, const uint32_t ny );
+
+/*
+ * Achica la imágen "nx" veces en horizontal y "ny" en vertical: cada
+ * píxel es el promedio de un bloque de nx x ny. Si el ancho o el alto
+ * no son múltiplos, el último bloque es más chico y se promedia sólo
+ * lo que tiene.
+ */
+void reducir_entero( bmp_t *const imagen, const uint32_t nx, const uint32_t ny );
+
+/*
+ * Redimensiona la imágen a "ancho" x "alto" con el filtro pedido. Si
+ * uno de los dos es 0, se calcula con el otro manteniendo la
+ * proporción.
+ */
+void redimensionar( bmp_t *const imagen,
+                    uint32_t ancho,
+                    uint32_t alto,
+                    const filtro_escala filtro );
+
+/*
+ * Deja en la imágen sólo el rectángulo de "ancho" x "alto" píxeles que
+ * empieza en la columna x y la fila y (contando desde arriba). El
+ * rectángulo se achica si se sale de la imágen. Devuelve false si
+ * empieza fuera de la imágen o no hay memoria, y la imágen no cambia.
+ */
+bool recortar( bmp_t *const imagen, uint32_t x, uint32_t y,
+               uint32_t ancho, uint32_t alto );
+
 /*
  * Produce el efecto 'blur' en la imágen, con el valor que rate
  * lo indique.
@@ -99,11 +171,99 @@ bool destruir_bmp( bmp_t *imagen );
  */
 bmp_t *crear_imagen_archivo( const char *filename );
 
+/*
+ * Igual que crear_imagen_archivo, pero carga sólo el rectángulo de
+ * "ancho" x "alto" píxeles que empieza en la columna x y la fila y
+ * (contando desde arriba): del archivo se leen sólo esas filas y, de
+ * cada una, esas columnas. El rectángulo se achica si se sale de la
+ * imágen.
+ */
+bmp_t *crear_recorte_archivo( const char *filename, uint32_t x, uint32_t y,
+                              uint32_t ancho, uint32_t alto );
+
 /*
  * Realiza un "flip vertical" de la imágen. Es decir, la da vuelta.
  */
 void flip_vertical( const bmp_t *const imagen );
 
+/*
+ * Abre un archivo .bmp y lee sólo los headers y la paleta. Los píxeles
+ * se leen después con cargar_pixels o procesar_por_filas.
+ */
+bmp_t *abrir_imagen_archivo( const char *filename );
+
+/*
+ * Devuelve true si los píxeles de una imágen abierta con
+ * abrir_imagen_archivo se pueden leer de a una fila, es decir, si no
+ * están comprimidos.
+ */
+bool legible_por_filas( const bmp_t *imagen );
+
+/*
+ * Pide que la imágen se grabe comprimida con RLE, si es de 4 u 8 BPP.
+ */
+void usar_rle( bmp_t *imagen, bool usar );
+
+/*
+ * Cambia los BPP con que se graba la imágen: 1, 4, 8, 16 (RGB565), 15
+ * (RGB555, en 16 BPP), 24 o 32. Para 8 o menos, si la paleta que tiene
+ * no entra se arma otra con los colores que usa o, si son demasiados,
+ * una fija. Devuelve false si no se pudo.
+ */
+bool cambiar_profundidad( bmp_t *imagen, uint32_t bpp );
+
+/*
+ * Lee sólo los headers y la paleta de un archivo .bmp, sin mapearlo ni
+ * leer nada de los píxeles, y lo cierra. Alcanza para mostrar el header
+ * o resumirlo; los píxeles no se pueden cargar después.
+ */
+bmp_t *leer_header_archivo( const char *filename );
+
+/*
+ * Resumen del header de una imágen, para listar muchas (opción -S).
+ * "compresion" es el valor del info header (0 sin compresión).
+ */
+typedef struct
+{
+    int32_t  ancho;
+    int32_t  alto;
+    uint16_t bpp;
+    uint32_t compresion;
+    uint32_t colores;
+    uint32_t offset;
+    uint32_t tam_header;
+    uint32_t tam_archivo;
+} resumen_header;
+
+/*
+ * Completa el resumen con los headers de la imágen.
+ */
+void resumir_header( const bmp_t *imagen, resumen_header *resumen );
+
+/*
+ * Lee los píxeles de una imágen abierta con abrir_imagen_archivo.
+ */
+bool cargar_pixels( bmp_t *imagen );
+
+/*
+ * Aplica las operaciones por filas a una imágen abierta con
+ * abrir_imagen_archivo, leyendo y transformando de a una fila, y
+ * grabando en "salida" por bloques de filas. La memoria usada depende
+ * sólo del ancho.
+ */
+bool procesar_por_filas( bmp_t *imagen,
+                         const op_fila *ops,
+                         const uint32_t nops,
+                         const char *salida );
+
+/*
+ * Aplica varias operaciones por filas, que no pueden ser flips, en una
+ * sola pasada sobre la imágen en memoria.
+ */
+void aplicar_ops_filas( bmp_t *const imagen,
+                        const op_fila *ops,
+                        const uint32_t nops );
+
 
 
 
@@ -0,0 +1,318 @@
+/***********************************************************************
+ *
+ * Módulo: Tipos y funciones internas del bmp, compartidas entre los
+ *         módulos de la carpeta bmp/ pero no expuestas en bmp.h.
+ * Autor:  Martín Aguilar
+ *
+ **********************************************************************/
+
+#ifndef BMP_INTERNO_H
+#define BMP_INTERNO_H
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "bmp.h"
+#include "paleta.h"
+#include "fuente.h"
+
+/*
+ * Tipo para la paleta de colores, conteniendo una lista de colores
+ * y la cantidad que son.
+ */
+typedef struct
+{
+    uint64_t cant;
+    bmpcolor_t *colores;
+} paleta_color;
+
+
+/*
+ * Tipo del Bitmap File Header, el MagicNumber está separado, para
+ * que la estructura esté alineada y se pueda usar para leer
+ * directamente y no campo a campo.
+ */
+typedef struct
+{
+    uint32_t filesz;
+    uint32_t reserved;
+    uint32_t bmp_offset;
+} bitmapfileheader;
+
+/*
+ * Tipo para el Bitmap Info Header, contiene los datos con la
+ * información del encabezado
+ */
+typedef struct
+{
+    uint32_t header_sz;
+    int32_t width;
+    int32_t height;
+    uint16_t nplanes;
+    uint16_t bitspp;
+    uint32_t tipo_compres;
+    uint32_t bmp_bytesz;
+    int32_t hres;
+    int32_t vres;
+    uint32_t ncolores;
+    uint32_t n_colores_imp;
+} bitmapinfoheader;
+
+/*
+ * Tipos de compresión del info header que se aceptan. BI_RLE8 y
+ * BI_RLE4 son corridas de índices de la paleta, en 8 y 4 BPP. Con
+ * BI_BITFIELDS las máscaras de los canales van después del header de
+ * 40 bytes (o dentro del header, en las versiones más largas);
+ * BI_ALPHABITFIELDS agrega la del alpha.
+ */
+#define BI_RGB            0
+#define BI_RLE8           1
+#define BI_RLE4           2
+#define BI_BITFIELDS      3
+#define BI_ALPHABITFIELDS 6
+
+/*
+ * Tamaño del header BITMAPV4HEADER, con el que se graban las imágenes
+ * que necesitan máscaras: las de 32 BPP con alpha y las de 16 BPP que
+ * no son RGB555.
+ */
+#define HEADER_V4 108
+
+/*
+ * Máscaras de un píxel de 32 BPP con el mismo orden de bytes que
+ * bmpcolor_t (azul, verde, rojo y alpha): con estas se copia tal cual.
+ */
+#define MASCARA_ROJO  0x00FF0000u
+#define MASCARA_VERDE 0x0000FF00u
+#define MASCARA_AZUL  0x000000FFu
+#define MASCARA_ALFA  0xFF000000u
+
+/*
+ * Máscaras de 16 BPP: RGB555 es la que se usa con BI_RGB, y RGB565 la
+ * más común con BI_BITFIELDS. El azul es igual en las dos.
+ */
+#define MASCARA_ROJO_555  0x7C00u
+#define MASCARA_VERDE_555 0x03E0u
+#define MASCARA_ROJO_565  0xF800u
+#define MASCARA_VERDE_565 0x07E0u
+#define MASCARA_AZUL_16   0x001Fu
+
+/*
+ * Alineación (en bytes) del bloque de píxeles y de cada fila: una
+ * línea de caché.
+ */
+#define ALINEACION_PIXELS 64
+
+/*
+ * Tipo para una matriz de píxeles. Todos los píxeles viven en un único
+ * bloque contiguo y alineado (datos); cada fila ocupa "stride" píxeles,
+ * el ancho redondeado a múltiplo de una línea de caché. El arreglo de
+ * punteros a filas es sólo una vista sobre ese bloque.
+ */
+typedef struct
+{
+    bmpcolor_t  *datos;
+    bmpcolor_t **pixels;
+    uint32_t     stride;
+} matriz_pixels;
+
+/*
+ * Tipo para una matriz de índices de la paleta, un byte por píxel, con
+ * la misma organización que matriz_pixels.
+ */
+typedef struct
+{
+    uint8_t  *datos;
+    uint8_t **filas;
+    uint32_t  stride;
+} matriz_indices;
+
+/*
+ * Tipo BMP. De esta forma se representa la imágen completa en la
+ * memoria. Incluye un File header, un Info header, una paleta (con su
+ * índice inverso) y una matriz de colores. También se incluye el
+ * MagicNumber.
+ * La matriz es un bloque contiguo (datos) con filas de "stride"
+ * píxeles; pixels[y] apunta al comienzo de la fila y. Mientras los
+ * píxeles no se cargaron, "fuente" es el archivo abierto.
+ * Las imágenes de 1, 4 y 8 BPP se guardan indexadas: en lugar de la
+ * matriz de colores se usa "indices" (con "filas" y "stride_indices"),
+ * hasta que una operación crea colores nuevos y se expanden.
+ * En 16 y 32 BPP, "mascaras" son las del archivo (rojo, verde, azul y
+ * alpha); si la del alpha no es 0, la imágen tiene alpha y se conserva.
+ * En 16 BPP son también las que se usan al grabar.
+ * Si "rle" es true, se graba comprimida (RLE8 o RLE4).
+ */
+struct bmp
+{
+    uint16_t magic;
+    bitmapfileheader fileheader;
+    bitmapinfoheader infoheader;
+    paleta_color      paleta;
+    indice_paleta      *indice;
+    bmpcolor_t         *datos;
+    uint32_t            stride;
+    bmpcolor_t         **pixels;
+    uint8_t            *indices;
+    uint32_t            stride_indices;
+    uint8_t            **filas;
+    uint32_t            mascaras[4];
+    bool                rle;
+    fuente_bmp          fuente;
+};
+
+/*
+ * Tipo de las funciones que pasan una fila del archivo (origen) a
+ * colores (destino), y de las que hacen lo contrario.
+ */
+typedef void ( *decodificador_fila )( const bmp_t *imagen,
+                                      const uint8_t *origen,
+                                      bmpcolor_t *destino );
+
+typedef void ( *codificador_fila )( const bmp_t *imagen,
+                                    const bmpcolor_t *origen,
+                                    uint8_t *destino );
+
+/*
+ * Lo mismo para las imágenes indexadas: pasan una fila del archivo a un
+ * byte por píxel con el índice en la paleta, y al revés.
+ */
+typedef void ( *decodificador_indices )( const bmp_t *imagen,
+                                         const uint8_t *origen,
+                                         uint8_t *destino );
+
+typedef void ( *codificador_indices )( const bmp_t *imagen,
+                                       const uint8_t *origen,
+                                       uint8_t *destino );
+
+// ENCABEZADOS FUNCIONES INTERNAS
+
+/*
+ * Lee el magic number, los headers y la paleta desde la fuente, y
+ * devuelve la imágen sin píxeles, con la fuente posicionada al
+ * comienzo del arreglo de píxeles.
+ */
+bmp_t *leer_encabezados( fuente_bmp *fuente, const char *filename );
+
+/*
+ * Devuelve el tamaño en bytes de una fila en el archivo, con el
+ * padding a múltiplo de 4 bytes.
+ */
+uint32_t calcular_fila_alineada( const int32_t width, const uint16_t bitspp );
+
+/*
+ * Devuelven la función que decodifica o codifica una fila según los
+ * BPP de la imágen, o NULL si no está soportada.
+ */
+decodificador_fila decodificador_de( const bmp_t *imagen );
+
+codificador_fila codificador_de( const bmp_t *imagen );
+
+/*
+ * Lo mismo para las filas de índices. Devuelven NULL si la imágen no
+ * tiene paleta.
+ */
+decodificador_indices decodificador_indices_de( const bmp_t *imagen );
+
+codificador_indices codificador_indices_de( const bmp_t *imagen );
+
+/*
+ * Devuelve true si los píxeles de la imágen están guardados como
+ * índices de la paleta.
+ */
+bool es_indexada( const bmp_t *imagen );
+
+/*
+ * Devuelve true si la imágen tiene un canal alpha que hay que conservar.
+ */
+bool tiene_alfa( const bmp_t *imagen );
+
+/*
+ * Completa los campos del header que dependen del tamaño de la imágen,
+ * antes de grabarla. Devuelve el tamaño de cada fila en el archivo, o
+ * 0 si la imágen no se puede grabar.
+ */
+uint32_t preparar_encabezados( bmp_t *imagen );
+
+/*
+ * Arma en un solo buffer el file header, el info header y la paleta,
+ * tal como van al principio del archivo: son bmp_offset bytes. Se
+ * libera con free.
+ */
+uint8_t *armar_encabezados( const bmp_t *imagen );
+
+bool crear_matriz_pixels( matriz_pixels *matriz,
+                          const int32_t width,
+                          const int32_t height );
+
+void liberar_matriz( matriz_pixels *matriz );
+
+void liberar_pixels( bmp_t *imagen );
+
+void reemplazar_pixels( bmp_t *imagen,
+                        matriz_pixels *matriz,
+                        const int32_t width,
+                        const int32_t height );
+
+bool crear_matriz_indices( matriz_indices *matriz,
+                           const int32_t width,
+                           const int32_t height );
+
+void liberar_matriz_indices( matriz_indices *matriz );
+
+void reemplazar_indices( bmp_t *imagen,
+                         matriz_indices *matriz,
+                         const int32_t width,
+                         const int32_t height );
+
+/*
+ * Pasa una imágen indexada a colores, antes de una operación que crea
+ * colores nuevos. Si ya estaba en colores no hace nada.
+ */
+bool expandir_a_colores( bmp_t *imagen );
+
+/*
+ * Negativo de una imágen indexada, hecho sobre la paleta: en 1BPP se
+ * intercambian los dos colores, y si no, se invierte cada color. Se
+ * vuelve a armar el índice inverso.
+ */
+bool negar_paleta( bmp_t *imagen );
+
+/*
+ * Prepara las operaciones por filas para una imágen indexada: los
+ * negativos se aplican a la paleta (una sola vez) y las líneas guardan
+ * el índice de su color en la paleta que hay en ese momento.
+ */
+bool preparar_ops_indices( bmp_t *imagen, op_fila *ops, const uint32_t nops );
+
+uint8_t coloresde_paleta( const bmp_t *imagen, const bmpcolor_t color );
+
+void aplicar_op_fila( const bmp_t *const imagen,
+                      const op_fila *op,
+                      int32_t *y,
+                      bmpcolor_t *fila );
+
+/*
+ * Igual que aplicar_op_fila, sobre una fila de índices de operaciones
+ * preparadas con preparar_ops_indices.
+ */
+void aplicar_op_indices( const bmp_t *const imagen,
+                         const op_fila *op,
+                         int32_t *y,
+                         uint8_t *fila );
+
+/*
+ * Lee los píxeles comprimidos con RLE8 o RLE4 a la matriz de índices.
+ * Una primera pasada anota dónde empieza cada fila en los datos, y
+ * después las bandas de filas se decodifican en paralelo (rle.c).
+ */
+bool leer_rle( fuente_bmp *fuente, bmp_t *imagen );
+
+/*
+ * Graba la imágen (de 4 u 8 BPP) comprimida con RLE4 o RLE8. Las
+ * bandas de filas se codifican en paralelo (rle.c).
+ */
+bool grabar_rle( bmp_t *imagen, const char *salida );
+
+// FIN ENCABEZADOS
+
+#endif
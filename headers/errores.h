@@ -0,0 +1,26 @@
+/***********************************************************************
+ *
+ * Módulo: Header del errores.c, destino de los mensajes de error de
+ *         cada hilo. En la línea de comandos es stderr; el servidor lo
+ *         cambia por el de cada trabajo, para devolverlos al cliente.
+ * Autor:  Martín Aguilar
+ *
+ **********************************************************************/
+
+#ifndef ERRORES_H
+#define ERRORES_H
+#include <stdio.h>
+
+/*
+ * Devuelve dónde escribe sus errores el hilo que llama: stderr, salvo
+ * que se haya cambiado con desviar_errores.
+ */
+FILE *salida_errores( void );
+
+/*
+ * Cambia dónde escribe sus errores el hilo que llama (NULL vuelve a
+ * stderr). Devuelve la salida anterior, para restaurarla.
+ */
+FILE *desviar_errores( FILE *salida );
+
+#endif
@@ -0,0 +1,74 @@
+/***********************************************************************
+ *
+ * Módulo: Header del fuente.c, origen de los bytes de un archivo BMP
+ *         al leerlo: el archivo mapeado en memoria o, si no se puede
+ *         mapear (pipes, dispositivos), un FILE* común.
+ * Autor:  Martín Aguilar
+ *
+ **********************************************************************/
+
+#ifndef FUENTE_H
+#define FUENTE_H
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Tipo para la fuente. Si "mapa" no es NULL, el archivo entero está
+ * mapeado y las lecturas devuelven punteros al mapa; si no, se lee con
+ * "archivo" a un buffer interno.
+ */
+typedef struct
+{
+    FILE          *archivo;
+    const uint8_t *mapa;
+    size_t         tamanio;
+    size_t         pos;
+    uint8_t       *buffer;
+    size_t         capacidad;
+} fuente_bmp;
+
+/*
+ * Abre el archivo. Si es un archivo regular se mapea en memoria y se le
+ * avisa al kernel que se va a leer en forma secuencial.
+ */
+bool abrir_fuente( fuente_bmp *fuente, const char *filename );
+
+/*
+ * Abre el archivo para leer sólo los headers y la paleta: con stdio y
+ * un buffer chico, sin mapearlo, para no leer por adelantado nada de
+ * los píxeles.
+ */
+bool abrir_fuente_encabezados( fuente_bmp *fuente, const char *filename );
+
+/*
+ * Devuelve un puntero a los próximos n bytes de la fuente y avanza, o
+ * NULL si no hay n bytes más. El puntero vale hasta la próxima lectura.
+ */
+const uint8_t *leer_fuente( fuente_bmp *fuente, size_t n );
+
+/*
+ * Copia los próximos n bytes de la fuente a destino.
+ */
+bool copiar_fuente( fuente_bmp *fuente, void *destino, size_t n );
+
+/*
+ * Avisa que la fuente se va a leer salteada (un recorte): si está
+ * mapeada, el kernel no lee por adelantado más que lo que se toca.
+ */
+void fuente_salteada( fuente_bmp *fuente );
+
+/*
+ * Mueve la fuente a "pos" bytes del comienzo del archivo. Si no está
+ * mapeada y no se puede hacer seek (un pipe), sólo se puede avanzar: se
+ * leen y descartan los bytes del medio.
+ */
+bool posicionar_fuente( fuente_bmp *fuente, uint64_t pos );
+
+/*
+ * Cierra la fuente y libera todo lo que tenga asociado.
+ */
+void cerrar_fuente( fuente_bmp *fuente );
+
+#endif
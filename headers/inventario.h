@@ -0,0 +1,24 @@
+/***********************************************************************
+ *
+ * Módulo: Header del inventario.c, listado de los headers de muchas
+ *         imágenes sin leer sus píxeles (opción -S).
+ * Autor:  Martín Aguilar
+ *
+ **********************************************************************/
+
+#ifndef INVENTARIO_H
+#define INVENTARIO_H
+#include <stdio.h>
+#include <stdbool.h>
+
+/*
+ * Lee sólo los headers de la entrada (un archivo) o de todos los
+ * archivos de "entradas" (como en -e), y escribe en "salida" una fila
+ * por archivo: en una tabla separada por tabs, o si json es true en un
+ * arreglo JSON. Los headers se leen en paralelo y se escriben en el
+ * orden de la lista. Un archivo que no se puede leer se informa y no
+ * detiene al resto; devuelve false si falló alguno.
+ */
+bool inventariar( const char *entrada, const char *entradas, bool json, FILE *salida );
+
+#endif
@@ -0,0 +1,54 @@
+/***********************************************************************
+ *
+ * Módulo: Header del lote.c, procesamiento de muchas imágenes con el
+ *         mismo plan de operaciones, repartidas en el pool de hilos.
+ * Autor:  Martín Aguilar
+ *
+ **********************************************************************/
+
+#ifndef LOTE_H
+#define LOTE_H
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "plan.h"
+
+/*
+ * Tipo para la lista de archivos de entrada del lote.
+ */
+typedef struct
+{
+    char   **nombres;
+    uint32_t cant;
+    uint32_t capacidad;
+} lista_archivos;
+
+/*
+ * Arma la lista de archivos a partir de "entradas", que puede ser un
+ * directorio (se toman sus .bmp), un patrón como "*.bmp", o
+ * "@archivo", con un nombre de archivo por línea.
+ */
+bool listar_entradas( const char *entradas, lista_archivos *lista );
+
+/*
+ * Libera la lista de archivos.
+ */
+void liberar_lista( lista_archivos *lista );
+
+/*
+ * Arma en "destino" el nombre de salida de "entrada", reemplazando el
+ * %s de "patron" por el nombre de la entrada sin carpeta ni extensión.
+ */
+bool armar_salida( const char *patron, const char *entrada,
+                   char *destino, size_t tam );
+
+/*
+ * Aplica el plan a todos los archivos de "entradas", grabando cada uno
+ * según "patron". Los archivos se reparten entre los hilos del pool; un
+ * error en un archivo se informa y no detiene al resto. Si dos archivos
+ * irían a la misma salida, no se procesa ninguno de los dos. Devuelve
+ * false si falló alguno.
+ */
+bool procesar_lote( const plan_t *plan, const char *entradas, const char *patron );
+
+#endif
@@ -0,0 +1,27 @@
+/***********************************************************************
+ *
+ * Módulo: Header del medicion.c, lo que comparten el perfil, la traza,
+ *         el inventario y el bench: el reloj en nanosegundos y los
+ *         textos de JSON.
+ * Autor:  Martín Aguilar
+ *
+ **********************************************************************/
+
+#ifndef MEDICION_H
+#define MEDICION_H
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Nanosegundos del reloj pedido (CLOCK_MONOTONIC para tiempo real,
+ * CLOCK_PROCESS_CPUTIME_ID para el de CPU de todos los hilos).
+ */
+uint64_t reloj_ns( clockid_t reloj );
+
+/*
+ * Escribe un texto entre comillas, escapando lo que JSON no acepta.
+ */
+void escribir_json_texto( FILE *salida, const char *texto );
+
+#endif
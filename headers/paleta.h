@@ -0,0 +1,35 @@
+/***********************************************************************
+ *
+ * Módulo: Header del paleta.c, índice inverso de la paleta de colores
+ *         (de color a índice), usado al grabar imágenes de 1 y 8 BPP.
+ * Autor:  Martín Aguilar
+ *
+ **********************************************************************/
+
+#ifndef PALETA_H
+#define PALETA_H
+#include <stdint.h>
+#include "bmp.h"
+
+typedef struct indice_paleta indice_paleta;
+
+/*
+ * Arma el índice inverso de una paleta de "cant" colores. La paleta
+ * no se copia, así que debe vivir mientras viva el índice.
+ */
+indice_paleta *crear_indice_paleta( const bmpcolor_t *colores, uint32_t cant );
+
+/*
+ * Devuelve el índice del color en la paleta o, si no está, el del más
+ * cercano (distancia euclídea en RGB; ante empates, el menor índice).
+ * Los resultados se memorizan, así que cada color distinto se busca
+ * una sola vez.
+ */
+uint8_t buscar_en_paleta( indice_paleta *indice, const bmpcolor_t color );
+
+/*
+ * Libera el índice inverso.
+ */
+void destruir_indice_paleta( indice_paleta *indice );
+
+#endif
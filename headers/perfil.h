@@ -0,0 +1,71 @@
+/***********************************************************************
+ *
+ * Módulo: Header del perfil.c, medición de tiempo y memoria de cada
+ *         paso al procesar una imágen (opción -t).
+ * Autor:  Martín Aguilar
+ *
+ **********************************************************************/
+
+#ifndef PERFIL_H
+#define PERFIL_H
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Un paso medido: tiempo real y de CPU (de todos los hilos), bytes
+ * pedidos para matrices de píxeles, cambio de los bytes en uso del
+ * heap, y el pico de memoria residente del proceso al terminarlo.
+ */
+typedef struct
+{
+    char     nombre[96];
+    double   pared_ms;
+    double   cpu_ms;
+    uint64_t pedido;
+    int64_t  heap;
+    long     pico_rss_kb;
+} paso_perfil;
+
+/*
+ * Los pasos medidos, y los valores al empezar el paso en curso.
+ */
+typedef struct
+{
+    paso_perfil *pasos;
+    uint32_t     cant;
+    uint32_t     capacidad;
+    uint64_t     pared;
+    uint64_t     cpu;
+    uint64_t     pedido;
+    int64_t      heap;
+} perfil_t;
+
+/*
+ * Deja el perfil vacío.
+ */
+void iniciar_perfil( perfil_t *perfil );
+
+/*
+ * Toma los valores de inicio del próximo paso.
+ */
+void empezar_paso( perfil_t *perfil );
+
+/*
+ * Cierra el paso en curso y lo guarda con "nombre".
+ */
+void terminar_paso( perfil_t *perfil, const char *nombre );
+
+/*
+ * Imprime los pasos como una tabla, con una fila de total.
+ */
+void mostrar_perfil( const perfil_t *perfil, FILE *salida );
+
+/*
+ * Graba los pasos en JSON en "archivo".
+ */
+bool grabar_perfil_json( const perfil_t *perfil, const char *archivo );
+
+void liberar_perfil( perfil_t *perfil );
+
+#endif
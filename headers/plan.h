@@ -0,0 +1,132 @@
+/***********************************************************************
+ *
+ * Módulo: Header del plan.c. Los parámetros se leen una sola vez a una
+ *         lista de operaciones (el plan), que se optimiza antes de
+ *         ejecutarla sobre la imágen.
+ * Autor:  Martín Aguilar
+ *
+ **********************************************************************/
+
+#ifndef PLAN_H
+#define PLAN_H
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "bmp.h"
+#include "validar.h"
+#include "perfil.h"
+
+/*
+ * Tipos de operaciones del plan. OP_FILAS es una pasada que aplica
+ * varias operaciones por filas seguidas (negativo y líneas) en un solo
+ * recorrido de la imágen.
+ */
+typedef enum
+{
+    OP_HEADER,
+    OP_FLIP,
+    OP_ROTAR,
+    OP_NEGATIVO,
+    OP_LINEAS_H,
+    OP_LINEAS_V,
+    OP_DOBLE,
+    OP_MITAD,
+    OP_BLUR,
+    OP_ESCALAR,
+    OP_RECORTE,
+    OP_FILAS
+} tipo_operacion;
+
+/*
+ * Una operación del plan. "veces" es la cantidad de rotaciones de 90
+ * grados; "rate" el del blur; "ancho", "alto" y "filtro" los de
+ * OP_ESCALAR; "x", "y", "ancho" y "alto" los de OP_RECORTE; "fila"
+ * los parámetros de negativo y líneas; "filas" y "nfilas" las
+ * operaciones fusionadas de OP_FILAS.
+ */
+typedef struct
+{
+    tipo_operacion tipo;
+    uint32_t       veces;
+    uint32_t       rate;
+    uint32_t       ancho;
+    uint32_t       alto;
+    uint32_t       x;
+    uint32_t       y;
+    filtro_escala  filtro;
+    op_fila        fila;
+    op_fila       *filas;
+    uint32_t       nfilas;
+} operacion;
+
+/*
+ * El plan: la lista de operaciones, cuántas había antes de optimizar,
+ * si hay que grabar un archivo de salida, si se graba comprimido con
+ * RLE (-c), con qué BPP se graba (-B; 0 si con los de la entrada),
+ * dónde se muestran los headers (-s), y el perfil donde se mide cada
+ * paso (NULL si no se pidió -t).
+ */
+typedef struct
+{
+    operacion *ops;
+    uint32_t   cant;
+    uint32_t   original;
+    bool       guardar;
+    bool       comprimir;
+    uint32_t   profundidad;
+    FILE      *textos;
+    perfil_t  *perfil;
+} plan_t;
+
+/*
+ * Arma el plan recorriendo los parámetros, ya validados por
+ * parametros_correctos, en el orden en que fueron recibidos.
+ */
+bool armar_plan( char *argv[], int argc, const datix *datos, plan_t *plan );
+
+/*
+ * Optimiza el plan: descarta los pares de flips y de negativos
+ * seguidos, junta las rotaciones seguidas (cuatro se anulan) y fusiona
+ * las operaciones por filas seguidas en una sola pasada.
+ */
+void optimizar_plan( plan_t *plan );
+
+/*
+ * Devuelve true si todas las operaciones del plan trabajan por filas,
+ * y por lo tanto se puede procesar la imágen sin cargarla entera.
+ */
+bool plan_por_filas( const plan_t *plan );
+
+/*
+ * Deja en "ops" la lista de operaciones por filas del plan (que debe
+ * cumplir plan_por_filas) y devuelve cuántas son. En "mostrar" deja
+ * cuántas veces hay que imprimir el header.
+ */
+uint32_t aplanar_plan( const plan_t *plan, op_fila *ops, uint32_t *mostrar );
+
+/*
+ * Ejecuta una operación del plan sobre la imágen en memoria. Los
+ * headers se muestran en "textos". Devuelve false si la operación no
+ * se pudo hacer (un recorte fuera de la imágen).
+ */
+bool ejecutar_operacion( const operacion *op, bmp_t *imagen, FILE *textos );
+
+/*
+ * Aplica el plan a la imágen del archivo "entrada" y, si el plan lo
+ * pide, graba el resultado en "salida". Si todas las operaciones son
+ * por filas, la imágen no se carga entera. Se puede llamar desde varios
+ * hilos a la vez con el mismo plan.
+ */
+bool ejecutar_plan( const plan_t *plan, const char *entrada, const char *salida );
+
+/*
+ * Imprime el plan, una operación por línea.
+ */
+void mostrar_plan( const plan_t *plan, FILE *salida );
+
+/*
+ * Libera la memoria del plan.
+ */
+void liberar_plan( plan_t *plan );
+
+#endif
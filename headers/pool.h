@@ -0,0 +1,45 @@
+/***********************************************************************
+ *
+ * Módulo: Header del pool.c, pool de hilos compartido por los
+ *         algoritmos que trabajan por bandas de filas.
+ * Autor:  Martín Aguilar
+ *
+ **********************************************************************/
+
+#ifndef POOL_H
+#define POOL_H
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Tipo de la función que procesa una banda. Recibe el contexto que se
+ * le pasó a pool_paralelo y el rango [desde, hasta) a procesar.
+ */
+typedef void ( *tarea_banda )( void *ctx, uint32_t desde, uint32_t hasta );
+
+/*
+ * Inicia el pool global con nhilos trabajadores (contando al hilo que
+ * llama). Si nhilos es 0 se usa la cantidad de procesadores en línea.
+ */
+bool pool_iniciar( uint32_t nhilos );
+
+/*
+ * Detiene los trabajadores y libera el pool global.
+ */
+void pool_destruir( void );
+
+/*
+ * Devuelve la cantidad de hilos del pool global (1 si no fue iniciado).
+ */
+uint32_t pool_hilos( void );
+
+/*
+ * Divide [0, total) en bandas de "grano" elementos y las reparte entre
+ * los hilos del pool. Vuelve cuando todas las bandas fueron procesadas.
+ * Si el pool no está iniciado, o si se llama desde una banda, se
+ * ejecuta todo en el hilo que llama.
+ */
+void pool_paralelo( uint32_t total, uint32_t grano,
+                    tarea_banda tarea, void *ctx );
+
+#endif
@@ -0,0 +1,47 @@
+/***********************************************************************
+ *
+ * Módulo: Header del reserva.c, bloques alineados para las matrices de
+ *         píxeles que se reusan en lugar de devolverlos al sistema.
+ * Autor:  Martín Aguilar
+ *
+ **********************************************************************/
+
+#ifndef RESERVA_H
+#define RESERVA_H
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Devuelve un bloque de al menos "tam" bytes alineado a ALINEACION_PIXELS,
+ * tomado de la reserva si hay uno que alcance y no sea más del doble, o
+ * NULL si no hay memoria.
+ */
+void *reservar_bloque( size_t tam );
+
+/*
+ * Devuelve a la reserva un bloque obtenido con reservar_bloque. Si la
+ * reserva está llena se libera el más chico. Acepta NULL.
+ */
+void devolver_bloque( void *bloque );
+
+/*
+ * Libera todos los bloques guardados en la reserva.
+ */
+void vaciar_reserva( void );
+
+/*
+ * Si "usar" es true, los bloques nuevos de 2 MB o más se piden en
+ * páginas grandes (hugetlbfs si hay, si no páginas transparentes).
+ * Conviene con cadenas largas de operaciones o lotes, donde los
+ * bloques se reusan muchas veces.
+ */
+void usar_paginas_grandes( bool usar );
+
+/*
+ * Devuelve cuántos bytes se pidieron con reservar_bloque desde que
+ * empezó el programa, salgan o no de la reserva.
+ */
+uint64_t bytes_pedidos( void );
+
+#endif
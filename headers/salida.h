@@ -0,0 +1,61 @@
+/***********************************************************************
+ *
+ * Módulo: Header del salida.c, destino de los bytes de un archivo BMP
+ *         al grabarlo: un archivo temporal en el mismo directorio que
+ *         se renombra al final, para que nunca quede a la vista un BMP
+ *         a medio escribir.
+ * Autor:  Martín Aguilar
+ *
+ **********************************************************************/
+
+#ifndef SALIDA_H
+#define SALIDA_H
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/*
+ * Tipo para la salida. Si "temporal" no es NULL se está escribiendo ahí
+ * y al cerrar se renombra a "destino" (el archivo al que apunta "nombre"
+ * si es un enlace simbólico) o a "nombre"; si no (dispositivos, pipes),
+ * se escribe directo en "nombre". "posicionable" es false si no se puede
+ * usar escribir_salida_en (pipes, fifos, sockets).
+ */
+typedef struct
+{
+    int         fd;
+    const char *nombre;
+    char       *destino;
+    char       *temporal;
+    bool        posicionable;
+} salida_bmp;
+
+/*
+ * Abre la salida. Si "nombre" no existe o es un archivo regular, se
+ * crea un temporal al lado del archivo final (siguiendo los enlaces
+ * simbólicos), con los permisos y el dueño del archivo que reemplaza.
+ * Los dispositivos, los pipes y los archivos con más de un enlace duro
+ * se escriben directo, y un error a mitad de camino los deja cortados.
+ */
+bool abrir_salida( salida_bmp *salida, const char *nombre );
+
+/*
+ * Escribe las "cant" partes seguidas, en la posición actual, con la
+ * menor cantidad de llamadas posible.
+ */
+bool escribir_salida( salida_bmp *salida, const struct iovec *partes, int cant );
+
+/*
+ * Escribe n bytes en la posición indicada, sin mover la actual.
+ */
+bool escribir_salida_en( salida_bmp *salida, const void *datos, size_t n, off_t posicion );
+
+/*
+ * Cierra la salida. Si "ok", el temporal reemplaza al archivo final; si
+ * no, se borra y el archivo final queda como estaba.
+ */
+bool cerrar_salida( salida_bmp *salida, bool ok );
+
+#endif
@@ -0,0 +1,49 @@
+/***********************************************************************
+ *
+ * Módulo: Header del servidor.c, modo servidor: el programa queda
+ *         esperando trabajos en un socket Unix, con el pool de hilos ya
+ *         caliente. La reserva de bloques se comparte entre los
+ *         trabajos que se solapan, y se vacía cuando no queda ninguno.
+ * Autor:  Martín Aguilar
+ *
+ **********************************************************************/
+
+#ifndef SERVIDOR_H
+#define SERVIDOR_H
+#include <stdbool.h>
+#include "validar.h"
+
+/*
+ * Protocolo: el cliente se conecta y manda las opciones del trabajo,
+ * las mismas de la línea de comandos, una por línea (por ejemplo "-n",
+ * "-i", "entrada.bmp", "-o", "salida.bmp"), terminadas con una línea
+ * vacía. El servidor responde con lo que escribió el trabajo (los
+ * headers de -s, el inventario de -S y los errores) y una última
+ * línea, "OK MILISEGUNDOS" o "ERROR MENSAJE", y cierra la conexión.
+ * Las opciones que cambian el estado de todo el proceso (-x, -H, -t,
+ * -T, -j y -D) no se aceptan en un trabajo, y la entrada y la salida
+ * tienen que ser archivos regulares (no /dev/stdout, fifos ni enlaces).
+ * Las imágenes se indican por su ruta; con rutas en /dev/shm la entrada
+ * se mapea directo desde la memoria compartida, sin copiarla. Con
+ * "-i -", después de la línea vacía el cliente manda "DATOS BYTES" en
+ * una línea y los bytes del BMP; con "-o -", antes de la última línea
+ * el servidor manda la imágen grabada de la misma forma.
+ */
+
+/* Cantidad máxima de trabajos atendidos a la vez */
+#define MAX_TRABAJOS 64
+
+/* Tamaño máximo del pedido de un trabajo, en bytes */
+#define MAX_PEDIDO 65536
+
+/* Tamaño máximo de una imágen que llega por el socket, en bytes */
+#define MAX_DATOS ( 1ull << 32 )
+
+/*
+ * Escucha en el socket Unix "ruta" hasta recibir SIGINT o SIGTERM.
+ * Cada conexión se atiende en su propio hilo. Devuelve false si no se
+ * pudo crear el socket.
+ */
+bool servir( const char *ruta );
+
+#endif
@@ -0,0 +1,60 @@
+/***********************************************************************
+ *
+ * Módulo: Header del simd.c, núcleos vectoriales (SSE2/SSSE3/AVX2) para
+ *         los recorridos más simples de los píxeles, con su versión
+ *         escalar para los demás procesadores.
+ * Autor:  Martín Aguilar
+ *
+ **********************************************************************/
+
+#ifndef SIMD_H
+#define SIMD_H
+#include <stdint.h>
+#include <stddef.h>
+#include "bmp.h"
+
+/*
+ * Invierte rojo, verde y azul de "cant" píxeles, dejando el alpha.
+ */
+void negar_pixels( bmpcolor_t *pixels, size_t cant );
+
+/*
+ * Expande "cant" píxeles BGR de 3 bytes (como están en un archivo de
+ * 24BPP) a bmpcolor_t, con alpha en 0.
+ */
+void expandir_bgr( const uint8_t *origen, bmpcolor_t *destino, size_t cant );
+
+/*
+ * Empaqueta "cant" píxeles a BGR de 3 bytes, descartando el alpha.
+ */
+void empaquetar_bgr( const bmpcolor_t *origen, uint8_t *destino, size_t cant );
+
+/*
+ * Bits de la parte fraccionaria de los pesos de los filtros, que van en
+ * punto fijo: UNO_PESO es un peso de 1.0.
+ */
+#define BITS_PESO 14
+#define UNO_PESO ( 1 << BITS_PESO )
+
+/*
+ * Suma a cada uno de los "cant" acumuladores el byte correspondiente de
+ * "fila" multiplicado por "peso".
+ */
+void acumular_fila( int32_t *suma, const uint8_t *fila, int16_t peso, size_t cant );
+
+/*
+ * Pasa "cant" acumuladores de punto fijo a bytes, redondeando y
+ * recortando a [0, 255].
+ */
+void saturar_fila( const int32_t *suma, uint8_t *destino, size_t cant );
+
+/*
+ * Filtra una fila en horizontal: el píxel x de destino es la suma de
+ * los "taps" píxeles desde origen[inicio[x]], con los pesos
+ * pesos[x * taps ...], en punto fijo. El alpha se filtra como los
+ * demás canales.
+ */
+void filtrar_fila( const bmpcolor_t *origen, bmpcolor_t *destino, size_t cant,
+                   const int32_t *inicio, const int16_t *pesos, uint32_t taps );
+
+#endif
@@ -0,0 +1,45 @@
+/***********************************************************************
+ *
+ * Módulo: Header del traza.c, traza de eventos en el formato JSON de
+ *         Chrome (chrome://tracing, Perfetto) para ver cómo se solapan
+ *         las etapas y los hilos (opción -x).
+ * Autor:  Martín Aguilar
+ *
+ **********************************************************************/
+
+#ifndef TRAZA_H
+#define TRAZA_H
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Es true mientras se está trazando. Cada punto medido lo mira antes
+ * de leer el reloj, así que sin -x la traza no cuesta nada. Es atómico
+ * porque lo leen los hilos del pool mientras el principal lo cambia.
+ */
+extern _Atomic bool traza_activa;
+
+/*
+ * Empieza a guardar eventos. El hilo que llama queda como hilo 1.
+ */
+bool iniciar_traza( void );
+
+/*
+ * Nanosegundos desde que empezó la traza, para el inicio de un evento.
+ */
+uint64_t traza_ahora( void );
+
+/*
+ * Guarda un evento "nombre" que empezó en "inicio" (de traza_ahora) y
+ * termina ahora, en el hilo que llama. Si "desde" es menor que "hasta"
+ * se agregan como argumentos del evento (el rango de una banda).
+ */
+void traza_evento( const char *nombre, uint64_t inicio,
+                   uint32_t desde, uint32_t hasta );
+
+/*
+ * Graba los eventos en "archivo" y termina la traza.
+ */
+bool grabar_traza( const char *archivo );
+
+#endif
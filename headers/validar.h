@@ -8,6 +8,7 @@
 
 #ifndef _val_h
 #define _val_h
+#include <stdio.h>
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -23,9 +24,21 @@ typedef struct
     uint32_t lineas_ver_espacio;
     bmpcolor_t lineas_ver_color;
     uint32_t blur_rate;
+    uint32_t hilos;
+    uint32_t profundidad;
     char *entrada;
+    char *lote;
+    char *servidor;
     char *salida;
     bool ayuda;
+    bool verbose;
+    bool perfil;
+    char *perfil_json;
+    char *traza;
+    bool paginas_grandes;
+    bool rle;
+    bool inventario;
+    bool inventario_json;
     bool no_parametros;
 } datix;
 
@@ -40,10 +53,23 @@ void ayuda();
  * devuelve false. Recibe el arreglo de parametros, la cantidad
  *   y una variable tipo datix donde se guardan los valores de las
  * opciones de cada parámetro para aplicarlas luego al procesar.
+ * Los mensajes de error se escriben en "mensajes".
  */
-bool parametros_correctos( char *argv[], int argc, datix *datos );
+bool parametros_correctos( char *argv[], int argc, datix *datos, FILE *mensajes );
 
 
+/*
+ * Deja en datos los valores por defecto, antes de leer los parámetros.
+ */
+void datos_por_defecto( datix *datos );
+
+/*
+ * Arma el plan con los parámetros y lo aplica a la entrada (o al lote),
+ * con el pool de hilos ya iniciado. Los headers (-s) y el inventario
+ * (-S) se escriben en "salida".
+ */
+bool procesar_plan( char *argv[], int argc, datix *datos, FILE *salida );
+
 /* Recibe los valores de los parámetros recolectados en
  * parametros_correctos y los emplea para llamar a la función
  * correspondiente en cada caso.
@@ -51,13 +77,20 @@ bool parametros_correctos( char *argv[], int argc, datix *datos );
  */
 bool procesar( char *argv[], int argc, datix *datos );
 
+/*
+ * Busca el filtro por su nombre (cercano, caja, bilineal o lanczos).
+ * Devuelve false si no existe.
+ */
+bool filtro_desde_nombre( const char *nombre, filtro_escala *filtro );
+
+/*
+ * Devuelve el nombre de un filtro.
+ */
+const char *nombre_filtro( const filtro_escala filtro );
+
 /*
  * Transforma un long en un color, y retorna un tipo color.
  */
 bmpcolor_t colordesdeint(const long color_int);
 
-bool leer_pixels_1bpp(   FILE *fbmp,
-                         bmp_t *imagen,
-                         uint32_t fila_alineada );
-
 #endif
@@ -0,0 +1,25 @@
+/***********************************************************************
+ *
+ * Módulo: Implementación del destino de los errores de cada hilo. Los
+ *         hilos del pool toman el del hilo que les reparte el trabajo.
+ * Autor:  Martín Aguilar
+ *
+ **********************************************************************/
+
+#include "../headers/errores.h"
+
+/* Salida de errores del hilo; NULL es stderr */
+static _Thread_local FILE *errores = NULL;
+
+FILE *salida_errores( void )
+{
+    return errores != NULL ? errores : stderr;
+}
+
+FILE *desviar_errores( FILE *salida )
+{
+    FILE *anterior = errores;
+
+    errores = salida;
+    return anterior;
+}
@@ -0,0 +1,31 @@
+/***********************************************************************
+ *
+ * Módulo: Funciones comunes a las mediciones y a las salidas en JSON.
+ * Autor:  Martín Aguilar
+ *
+ **********************************************************************/
+
+#include "../headers/medicion.h"
+
+uint64_t reloj_ns( clockid_t reloj )
+{
+    struct timespec t;
+
+    clock_gettime( reloj, &t );
+    return ( uint64_t ) t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+void escribir_json_texto( FILE *salida, const char *texto )
+{
+    fputc( '"', salida );
+    for ( ; *texto; texto++ )
+    {
+        if ( *texto == '"' || *texto == '\\' )
+            fprintf( salida, "\\%c", *texto );
+        else if ( ( unsigned char ) *texto < 0x20 )
+            fprintf( salida, "\\u%04x", *texto );
+        else
+            fputc( *texto, salida );
+    }
+    fputc( '"', salida );
+}
@@ -0,0 +1,267 @@
+/***********************************************************************
+ *
+ * Módulo: Implementación del pool de hilos. Los trabajadores quedan
+ *         dormidos entre trabajos, y cada trabajo se reparte en bandas
+ *         que los hilos van tomando de un contador compartido.
+ * Autor:  Martín Aguilar
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "../headers/pool.h"
+#include "../headers/traza.h"
+#include "../headers/errores.h"
+
+/*
+ * Tipo para el trabajo que se está repartiendo. "siguiente" es la
+ * próxima banda libre; "pendientes" la cantidad de hilos que todavía
+ * no terminaron con el trabajo actual. "errores" es la salida de
+ * errores del hilo que lo reparte, que usan también los trabajadores.
+ */
+typedef struct
+{
+    tarea_banda tarea;
+    void       *ctx;
+    FILE       *errores;
+    uint32_t    total;
+    uint32_t    grano;
+    uint32_t    siguiente;
+    uint32_t    pendientes;
+} trabajo_pool;
+
+/*
+ * Tipo del pool. "generacion" se incrementa con cada trabajo nuevo,
+ * para que los trabajadores sepan cuándo despertarse.
+ */
+typedef struct
+{
+    pthread_t      *hilos;
+    uint32_t        nhilos;
+    pthread_mutex_t mutex;
+    pthread_cond_t  hay_trabajo;
+    pthread_cond_t  termino;
+    pthread_mutex_t exclusivo;
+    uint64_t        generacion;
+    bool            salir;
+    trabajo_pool    trabajo;
+} pool_t;
+
+static pool_t *pool = NULL;
+
+/*
+ * Es true en los hilos que están procesando una banda. Si una banda
+ * llama otra vez a pool_paralelo (por ejemplo, el blur de una imágen
+ * de un lote), ese trabajo se hace en el mismo hilo: el pool ya está
+ * ocupado con el trabajo de afuera.
+ */
+static _Thread_local bool en_banda = false;
+
+/*
+ * Toma bandas del trabajo actual hasta que no queden más.
+ */
+static void procesar_bandas( trabajo_pool *trabajo )
+{
+    uint64_t banda, desde, hasta, inicio = 0;
+    FILE *anterior;
+
+    anterior = desviar_errores( trabajo->errores );
+    for ( ;; )
+    {
+        banda = __atomic_fetch_add( &trabajo->siguiente, 1, __ATOMIC_RELAXED );
+        desde = banda * trabajo->grano;
+        if ( desde >= trabajo->total )
+            break;
+
+        hasta = desde + trabajo->grano;
+        if ( hasta > trabajo->total )
+            hasta = trabajo->total;
+        if ( traza_activa )
+            inicio = traza_ahora();
+        en_banda = true;
+        trabajo->tarea( trabajo->ctx, ( uint32_t ) desde, ( uint32_t ) hasta );
+        en_banda = false;
+        if ( traza_activa )
+            traza_evento( "banda", inicio, ( uint32_t ) desde, ( uint32_t ) hasta );
+    }
+    desviar_errores( anterior );
+}
+
+/*
+ * Bucle de cada trabajador: espera un trabajo nuevo, lo procesa y
+ * avisa cuando terminó.
+ */
+static void *trabajador( void *arg )
+{
+    pool_t *p = ( pool_t * ) arg;
+    uint64_t vista = 0;
+
+    pthread_mutex_lock( &p->mutex );
+    for ( ;; )
+    {
+        while ( !p->salir && p->generacion == vista )
+            pthread_cond_wait( &p->hay_trabajo, &p->mutex );
+        if ( p->salir )
+            break;
+        vista = p->generacion;
+        pthread_mutex_unlock( &p->mutex );
+
+        procesar_bandas( &p->trabajo );
+
+        pthread_mutex_lock( &p->mutex );
+        if ( --p->trabajo.pendientes == 0 )
+            pthread_cond_signal( &p->termino );
+    }
+    pthread_mutex_unlock( &p->mutex );
+
+    return NULL;
+}
+
+/*
+ * Inicia el pool global con nhilos trabajadores (contando al hilo que
+ * llama). Si nhilos es 0 se usa la cantidad de procesadores en línea.
+ */
+bool pool_iniciar( uint32_t nhilos )
+{
+    uint32_t i;
+
+    if ( pool != NULL )
+        pool_destruir();
+
+    if ( nhilos == 0 )
+    {
+        long ncpu = sysconf( _SC_NPROCESSORS_ONLN );
+        nhilos = ncpu > 0 ? ( uint32_t ) ncpu : 1;
+    }
+
+    pool = ( pool_t * ) calloc( 1, sizeof( pool_t ) );
+    if ( pool == NULL )
+    {
+        fprintf( stderr, "Error alocando el pool de hilos\n" );
+        return false;
+    }
+
+    pool->nhilos = nhilos;
+    pthread_mutex_init( &pool->mutex, NULL );
+    pthread_mutex_init( &pool->exclusivo, NULL );
+    pthread_cond_init( &pool->hay_trabajo, NULL );
+    pthread_cond_init( &pool->termino, NULL );
+
+    /* el hilo que llama también trabaja, por eso se crean nhilos - 1 */
+    if ( nhilos > 1 )
+    {
+        pool->hilos = ( pthread_t * ) malloc( sizeof( pthread_t ) * ( nhilos - 1 ) );
+        if ( pool->hilos == NULL )
+        {
+            fprintf( stderr, "Error alocando el pool de hilos\n" );
+            pool->nhilos = 1;
+            return true;
+        }
+
+        for ( i = 0; i < nhilos - 1; i++ )
+        {
+            if ( pthread_create( &pool->hilos[i], NULL, trabajador, pool ) )
+            {
+                fprintf( stderr, "Error creando el hilo %u\n", i );
+                break;
+            }
+        }
+        pool->nhilos = i + 1;
+    }
+
+    return true;
+}
+
+/*
+ * Detiene los trabajadores y libera el pool global.
+ */
+void pool_destruir( void )
+{
+    uint32_t i;
+
+    if ( pool == NULL )
+        return;
+
+    pthread_mutex_lock( &pool->mutex );
+    pool->salir = true;
+    pthread_cond_broadcast( &pool->hay_trabajo );
+    pthread_mutex_unlock( &pool->mutex );
+
+    for ( i = 0; i + 1 < pool->nhilos; i++ )
+        pthread_join( pool->hilos[i], NULL );
+
+    pthread_mutex_destroy( &pool->mutex );
+    pthread_mutex_destroy( &pool->exclusivo );
+    pthread_cond_destroy( &pool->hay_trabajo );
+    pthread_cond_destroy( &pool->termino );
+    free( pool->hilos );
+    free( pool );
+    pool = NULL;
+}
+
+/*
+ * Devuelve la cantidad de hilos del pool global (1 si no fue iniciado).
+ */
+uint32_t pool_hilos( void )
+{
+    return pool == NULL ? 1 : pool->nhilos;
+}
+
+/*
+ * Divide [0, total) en bandas de "grano" elementos y las reparte entre
+ * los hilos del pool. Vuelve cuando todas las bandas fueron procesadas.
+ * Si el pool no está iniciado, o si se llama desde una banda, se
+ * ejecuta todo en el hilo que llama.
+ */
+void pool_paralelo( uint32_t total, uint32_t grano,
+                    tarea_banda tarea, void *ctx )
+{
+    uint64_t inicio = 0;
+
+    if ( !total )
+        return;
+    if ( !grano )
+        grano = 1;
+
+    /* sin pool, o con una sola banda, no vale la pena despertar a nadie */
+    if ( pool == NULL || pool->nhilos < 2 || total <= grano || en_banda )
+    {
+        if ( traza_activa )
+            inicio = traza_ahora();
+        tarea( ctx, 0, total );
+        if ( traza_activa )
+            traza_evento( "banda", inicio, 0, total );
+        return;
+    }
+
+    /* un solo trabajo a la vez en el pool */
+    pthread_mutex_lock( &pool->exclusivo );
+
+    pthread_mutex_lock( &pool->mutex );
+    pool->trabajo.tarea = tarea;
+    pool->trabajo.ctx = ctx;
+    pool->trabajo.errores = salida_errores();
+    pool->trabajo.total = total;
+    pool->trabajo.grano = grano;
+    pool->trabajo.siguiente = 0;
+    pool->trabajo.pendientes = pool->nhilos - 1;
+    pool->generacion++;
+    pthread_cond_broadcast( &pool->hay_trabajo );
+    pthread_mutex_unlock( &pool->mutex );
+
+    procesar_bandas( &pool->trabajo );
+
+    /* lo que el hilo que llama espera a los demás es el desbalance */
+    if ( traza_activa )
+        inicio = traza_ahora();
+    pthread_mutex_lock( &pool->mutex );
+    while ( pool->trabajo.pendientes )
+        pthread_cond_wait( &pool->termino, &pool->mutex );
+    pthread_mutex_unlock( &pool->mutex );
+    if ( traza_activa )
+        traza_evento( "esperar bandas", inicio, 0, 0 );
+
+    pthread_mutex_unlock( &pool->exclusivo );
+}
@@ -0,0 +1,163 @@
+/***********************************************************************
+ *
+ * Módulo: Implementación de la traza de eventos. Los eventos se guardan
+ *         en memoria, de todos los hilos, y se graban juntos al final
+ *         como eventos completos ("ph": "X") de Chrome.
+ * Autor:  Martín Aguilar
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "../headers/traza.h"
+#include "../headers/medicion.h"
+
+/*
+ * Un evento ya terminado. Los tiempos son nanosegundos desde el inicio
+ * de la traza.
+ */
+typedef struct
+{
+    char     nombre[64];
+    uint64_t inicio;
+    uint64_t duracion;
+    uint32_t hilo;
+    uint32_t desde;
+    uint32_t hasta;
+} evento_traza;
+
+_Atomic bool traza_activa = false;
+
+static evento_traza   *eventos = NULL;
+static uint32_t        cant_eventos = 0;
+static uint32_t        capacidad_eventos = 0;
+static uint64_t        origen = 0;
+static uint32_t        proximo_hilo = 0;
+static pthread_mutex_t mutex_traza = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Número de hilo en la traza; 0 hasta que el hilo guarda su primer evento.
+ */
+static _Thread_local uint32_t hilo_traza = 0;
+
+// ENCABEZADOS FUNCIONES
+
+uint32_t numero_hilo( void );
+
+// FIN ENCABEZADOS
+
+
+uint32_t numero_hilo( void )
+{
+    if ( hilo_traza == 0 )
+        hilo_traza = __atomic_add_fetch( &proximo_hilo, 1, __ATOMIC_RELAXED );
+    return hilo_traza;
+}
+
+bool iniciar_traza( void )
+{
+    pthread_mutex_lock( &mutex_traza );
+    cant_eventos = 0;
+    /* los hilos conservan su número de una traza a la siguiente */
+    numero_hilo();
+    origen = reloj_ns( CLOCK_MONOTONIC );
+    traza_activa = true;
+    pthread_mutex_unlock( &mutex_traza );
+    return true;
+}
+
+uint64_t traza_ahora( void )
+{
+    return reloj_ns( CLOCK_MONOTONIC ) - origen;
+}
+
+void traza_evento( const char *nombre, uint64_t inicio,
+                   uint32_t desde, uint32_t hasta )
+{
+    uint64_t fin = traza_ahora();
+    uint32_t hilo = numero_hilo();
+    evento_traza *evento;
+
+    pthread_mutex_lock( &mutex_traza );
+    if ( cant_eventos == capacidad_eventos )
+    {
+        uint32_t capacidad = capacidad_eventos ? capacidad_eventos * 2 : 256;
+        evento = ( evento_traza * ) realloc( eventos, sizeof( evento_traza ) * capacidad );
+        if ( evento == NULL )
+        {
+            /* sin memoria el evento se pierde, pero se sigue */
+            pthread_mutex_unlock( &mutex_traza );
+            return;
+        }
+        eventos = evento;
+        capacidad_eventos = capacidad;
+    }
+
+    evento = &eventos[cant_eventos++];
+    snprintf( evento->nombre, sizeof( evento->nombre ), "%s", nombre );
+    evento->inicio = inicio;
+    evento->duracion = fin - inicio;
+    evento->hilo = hilo;
+    evento->desde = desde;
+    evento->hasta = hasta;
+    pthread_mutex_unlock( &mutex_traza );
+}
+
+bool grabar_traza( const char *archivo )
+{
+    const evento_traza *evento;
+    uint32_t i;
+    FILE *f;
+    bool ok = true;
+
+    pthread_mutex_lock( &mutex_traza );
+    traza_activa = false;
+
+    if ( ( f = fopen( archivo, "w" ) ) == NULL )
+    {
+        fprintf( stderr, "Error al abrir %s para escribir\n", archivo );
+        ok = false;
+    }
+    else
+    {
+        fprintf( f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [" );
+        /* nombres de los hilos, para que el visor los muestre en orden */
+        for ( i = 1; i <= proximo_hilo; i++ )
+        {
+            fprintf( f, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+                     "\"tid\": %u, \"args\": {\"name\": ", i > 1 ? "," : "", i );
+            if ( i == 1 )
+                fprintf( f, "\"principal\"}}" );
+            else
+                fprintf( f, "\"hilo %u\"}}", i );
+        }
+        for ( i = 0; i < cant_eventos; i++ )
+        {
+            evento = &eventos[i];
+            fprintf( f, ",\n{\"name\": " );
+            escribir_json_texto( f, evento->nombre );
+            fprintf( f, ", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": %u",
+                     evento->inicio / 1e3, evento->duracion / 1e3, evento->hilo );
+            if ( evento->desde < evento->hasta )
+                fprintf( f, ", \"args\": {\"desde\": %u, \"hasta\": %u}",
+                         evento->desde, evento->hasta );
+            fprintf( f, "}" );
+        }
+        fprintf( f, "\n]}\n" );
+
+        if ( fclose( f ) )
+        {
+            fprintf( stderr, "Error grabando %s\n", archivo );
+            ok = false;
+        }
+    }
+
+    free( eventos );
+    eventos = NULL;
+    cant_eventos = capacidad_eventos = 0;
+    pthread_mutex_unlock( &mutex_traza );
+    return ok;
+}
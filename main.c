@@ -13,11 +13,9 @@
 int main( int argc, char *argv[] )
 {
     datix datos;
-    datos.ayuda = false;
-    datos.entrada = NULL;
-    datos.salida = NULL;
+    datos_por_defecto( &datos );
     // Si los parámetros son incorrectos, error, si no, sigue.
-    if ( ( !parametros_correctos( argv, argc, &datos ) ) )
+    if ( ( !parametros_correctos( argv, argc, &datos, stdout ) ) )
     {
         printf( "Error en los parámetros\n" );
         return( EXIT_FAILURE );
@@ -0,0 +1,178 @@
+/***********************************************************************
+ *
+ * Módulo: Implementación del inventario de headers (opción -S). De
+ *         cada archivo se leen sólo los headers, sin mapearlo ni tocar
+ *         los píxeles; los archivos se reparten de a bloques entre los
+ *         hilos del pool y cada bloque se escribe en orden.
+ * Autor:  Martín Aguilar
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../headers/inventario.h"
+#include "../headers/bmp.h"
+#include "../headers/lote.h"
+#include "../headers/pool.h"
+#include "../headers/medicion.h"
+#include "../headers/errores.h"
+
+/*
+ * Archivos que se leen antes de escribir sus filas: acota la memoria
+ * de un inventario muy grande sin dejar a los hilos sin trabajo.
+ */
+#define BLOQUE_INVENTARIO 1024
+
+/*
+ * Nombres de los tipos de compresión, por su valor en el info header.
+ */
+static const char *const nombres_compresion[] =
+{
+    "BI_RGB", "BI_RLE8", "BI_RLE4", "BI_BITFIELDS", "BI_JPEG", "BI_PNG", "BI_ALPHABITFIELDS"
+};
+
+/*
+ * Contexto que comparten los hilos de un bloque: los nombres del
+ * bloque, y por cada uno su resumen y si se pudo leer.
+ */
+typedef struct
+{
+    char *const    *nombres;
+    resumen_header *resumenes;
+    bool           *leidos;
+} contexto_inventario;
+
+// ENCABEZADOS FUNCIONES
+
+void inventario_banda( void *ctx, uint32_t desde, uint32_t hasta );
+
+void escribir_fila( FILE *salida, bool json, bool primera, const char *nombre,
+                    const resumen_header *resumen, bool leido );
+
+// FIN ENCABEZADOS
+
+
+/*
+ * Lee los headers de los archivos [desde, hasta) del bloque.
+ */
+void inventario_banda( void *ctx, uint32_t desde, uint32_t hasta )
+{
+    contexto_inventario *c = ( contexto_inventario * ) ctx;
+    bmp_t *imagen;
+    uint32_t i;
+
+    for ( i = desde; i < hasta; i++ )
+    {
+        c->leidos[i] = false;
+        if ( ( imagen = leer_header_archivo( c->nombres[i] ) ) == NULL )
+            continue;
+        resumir_header( imagen, &c->resumenes[i] );
+        c->leidos[i] = true;
+        destruir_bmp( imagen );
+    }
+}
+
+/*
+ * Escribe la fila de un archivo. Si no se pudo leer, en la tabla van
+ * sólo el nombre y "error", y en JSON el campo "error".
+ */
+void escribir_fila( FILE *salida, bool json, bool primera, const char *nombre,
+                    const resumen_header *resumen, bool leido )
+{
+    const char *compresion = "?";
+
+    if ( leido && resumen->compresion < sizeof( nombres_compresion ) / sizeof( nombres_compresion[0] ) )
+        compresion = nombres_compresion[resumen->compresion];
+
+    if ( !json )
+    {
+        if ( leido )
+            fprintf( salida, "%s\t%d\t%d\t%u\t%s\t%u\t%u\t%u\t%u\n", nombre,
+                     resumen->ancho, resumen->alto, resumen->bpp, compresion,
+                     resumen->colores, resumen->tam_header, resumen->offset,
+                     resumen->tam_archivo );
+        else
+            fprintf( salida, "%s\terror\n", nombre );
+        return;
+    }
+
+    fprintf( salida, "%s\n  { \"archivo\": ", primera ? "" : "," );
+    escribir_json_texto( salida, nombre );
+    if ( leido )
+        fprintf( salida, ", \"ancho\": %d, \"alto\": %d, \"bpp\": %u, \"compresion\": \"%s\", "
+                 "\"colores\": %u, \"header\": %u, \"offset\": %u, \"tamanio\": %u }",
+                 resumen->ancho, resumen->alto, resumen->bpp, compresion,
+                 resumen->colores, resumen->tam_header, resumen->offset, resumen->tam_archivo );
+    else
+        fprintf( salida, ", \"error\": true }" );
+}
+
+bool inventariar( const char *entrada, const char *entradas, bool json, FILE *salida )
+{
+    lista_archivos lista;
+    contexto_inventario ctx;
+    resumen_header *resumenes;
+    bool *leidos;
+    uint32_t inicio, cant, i, fallidos = 0;
+    char *unico[1];
+
+    if ( entradas != NULL )
+    {
+        if ( !listar_entradas( entradas, &lista ) )
+            return false;
+    }
+    else
+    {
+        unico[0] = ( char * ) entrada;
+        lista.nombres = unico;
+        lista.cant = 1;
+    }
+
+    resumenes = ( resumen_header * ) malloc( sizeof( resumen_header ) * BLOQUE_INVENTARIO );
+    leidos = ( bool * ) malloc( sizeof( bool ) * BLOQUE_INVENTARIO );
+    if ( resumenes == NULL || leidos == NULL )
+    {
+        fprintf( salida_errores(), "Error alocando el inventario\n" );
+        free( resumenes );
+        free( leidos );
+        if ( entradas != NULL )
+            liberar_lista( &lista );
+        return false;
+    }
+
+    if ( json )
+        fputc( '[', salida );
+    else
+        fprintf( salida, "archivo\tancho\talto\tbpp\tcompresion\tcolores\theader\toffset\ttamanio\n" );
+
+    for ( inicio = 0; inicio < lista.cant; inicio += cant )
+    {
+        cant = lista.cant - inicio < BLOQUE_INVENTARIO ? lista.cant - inicio : BLOQUE_INVENTARIO;
+        ctx.nombres = lista.nombres + inicio;
+        ctx.resumenes = resumenes;
+        ctx.leidos = leidos;
+
+        /* los headers son chicos: de a varios archivos por banda */
+        pool_paralelo( cant, 16, inventario_banda, &ctx );
+
+        for ( i = 0; i < cant; i++ )
+        {
+            escribir_fila( salida, json, inicio + i == 0, lista.nombres[inicio + i],
+                           &resumenes[i], leidos[i] );
+            if ( !leidos[i] )
+                fallidos++;
+        }
+    }
+
+    if ( json )
+        fprintf( salida, "\n]\n" );
+    if ( fallidos )
+        fprintf( salida_errores(), "Inventario: %u de %u archivos con errores\n", fallidos, lista.cant );
+
+    free( resumenes );
+    free( leidos );
+    if ( entradas != NULL )
+        liberar_lista( &lista );
+    return fallidos == 0;
+}
@@ -0,0 +1,358 @@
+/***********************************************************************
+ *
+ * Módulo: Implementación del procesamiento por lotes. El plan se arma
+ *         una sola vez, y cada hilo del pool toma el próximo archivo
+ *         de la lista hasta que no queden.
+ * Autor:  Martín Aguilar
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <dirent.h>
+#include <glob.h>
+#include <sys/stat.h>
+#include "../headers/lote.h"
+#include "../headers/pool.h"
+#include "../headers/traza.h"
+#include "../headers/errores.h"
+
+/* Largo máximo de un nombre de archivo de salida */
+#define LARGO_SALIDA 4096
+
+/*
+ * Contexto que comparten los hilos del lote.
+ */
+typedef struct
+{
+    const plan_t         *plan;
+    const lista_archivos *lista;
+    char                **salidas;
+    uint32_t              fallidos;
+} contexto_lote;
+
+// ENCABEZADOS FUNCIONES
+
+bool agregar_archivo( lista_archivos *lista, const char *nombre, size_t largo );
+
+bool leer_manifiesto( const char *manifiesto, lista_archivos *lista );
+
+bool leer_directorio( const char *directorio, lista_archivos *lista );
+
+bool expandir_patron( const char *patron, lista_archivos *lista );
+
+int comparar_nombres( const void *a, const void *b );
+
+char **armar_salidas( const lista_archivos *lista, const char *patron );
+
+void liberar_salidas( char **salidas, uint32_t cant );
+
+void lote_banda( void *ctx, uint32_t desde, uint32_t hasta );
+
+// FIN ENCABEZADOS
+
+
+/*
+ * Agrega a la lista una copia de los primeros "largo" caracteres de
+ * "nombre".
+ */
+bool agregar_archivo( lista_archivos *lista, const char *nombre, size_t largo )
+{
+    char **nombres, *copia;
+
+    if ( lista->cant == lista->capacidad )
+    {
+        uint32_t capacidad = lista->capacidad ? lista->capacidad * 2 : 64;
+        nombres = ( char ** ) realloc( lista->nombres, sizeof( char * ) * capacidad );
+        if ( nombres == NULL )
+        {
+            fprintf( salida_errores(), "Error alocando la lista de archivos\n" );
+            return false;
+        }
+        lista->nombres = nombres;
+        lista->capacidad = capacidad;
+    }
+
+    if ( ( copia = ( char * ) malloc( largo + 1 ) ) == NULL )
+    {
+        fprintf( salida_errores(), "Error alocando la lista de archivos\n" );
+        return false;
+    }
+    memcpy( copia, nombre, largo );
+    copia[largo] = '\0';
+    lista->nombres[lista->cant++] = copia;
+    return true;
+}
+
+/*
+ * Lee un archivo con un nombre por línea. Se ignoran las líneas vacías
+ * y las que empiezan con '#'.
+ */
+bool leer_manifiesto( const char *manifiesto, lista_archivos *lista )
+{
+    FILE *f;
+    char linea[LARGO_SALIDA];
+    size_t largo;
+    bool ok = true;
+
+    if ( ( f = fopen( manifiesto, "r" ) ) == NULL )
+    {
+        fprintf( salida_errores(), "Error al abrir la lista %s\n", manifiesto );
+        return false;
+    }
+
+    while ( ok && fgets( linea, sizeof( linea ), f ) != NULL )
+    {
+        largo = strcspn( linea, "\r\n" );
+        if ( largo == 0 || linea[0] == '#' )
+            continue;
+        ok = agregar_archivo( lista, linea, largo );
+    }
+
+    fclose( f );
+    return ok;
+}
+
+/*
+ * Agrega todos los .bmp de un directorio.
+ */
+bool leer_directorio( const char *directorio, lista_archivos *lista )
+{
+    DIR *dir;
+    struct dirent *entrada;
+    char nombre[LARGO_SALIDA];
+    size_t largo;
+    bool ok = true;
+
+    if ( ( dir = opendir( directorio ) ) == NULL )
+    {
+        fprintf( salida_errores(), "Error al abrir el directorio %s\n", directorio );
+        return false;
+    }
+
+    while ( ok && ( entrada = readdir( dir ) ) != NULL )
+    {
+        largo = strlen( entrada->d_name );
+        if ( largo < 4 || strcasecmp( entrada->d_name + largo - 4, ".bmp" ) )
+            continue;
+
+        largo = snprintf( nombre, sizeof( nombre ), "%s/%s", directorio, entrada->d_name );
+        if ( largo >= sizeof( nombre ) )
+        {
+            fprintf( salida_errores(), "Nombre demasiado largo en %s\n", directorio );
+            continue;
+        }
+        ok = agregar_archivo( lista, nombre, largo );
+    }
+
+    closedir( dir );
+    return ok;
+}
+
+/*
+ * Agrega los archivos que coinciden con un patrón como "*.bmp".
+ */
+bool expandir_patron( const char *patron, lista_archivos *lista )
+{
+    glob_t g;
+    size_t i;
+    bool ok = true;
+
+    switch ( glob( patron, 0, NULL, &g ) )
+    {
+    case 0:
+        break;
+    case GLOB_NOMATCH:
+        return true;
+    default:
+        fprintf( salida_errores(), "Error al buscar los archivos de %s\n", patron );
+        return false;
+    }
+
+    for ( i = 0; ok && i < g.gl_pathc; i++ )
+        ok = agregar_archivo( lista, g.gl_pathv[i], strlen( g.gl_pathv[i] ) );
+
+    globfree( &g );
+    return ok;
+}
+
+int comparar_nombres( const void *a, const void *b )
+{
+    return strcmp( *( char * const * ) a, *( char * const * ) b );
+}
+
+bool listar_entradas( const char *entradas, lista_archivos *lista )
+{
+    struct stat info;
+    bool ok;
+
+    memset( lista, 0, sizeof( lista_archivos ) );
+
+    if ( entradas[0] == '@' )
+        ok = leer_manifiesto( entradas + 1, lista );
+    else if ( stat( entradas, &info ) == 0 && S_ISDIR( info.st_mode ) )
+    {
+        ok = leer_directorio( entradas, lista );
+        /* readdir no devuelve los nombres en ningún orden */
+        if ( ok && lista->cant )
+            qsort( lista->nombres, lista->cant, sizeof( char * ), comparar_nombres );
+    }
+    else
+        ok = expandir_patron( entradas, lista );
+
+    if ( ok && lista->cant == 0 )
+    {
+        fprintf( salida_errores(), "No hay archivos para procesar en %s\n", entradas );
+        ok = false;
+    }
+    if ( !ok )
+        liberar_lista( lista );
+    return ok;
+}
+
+void liberar_lista( lista_archivos *lista )
+{
+    uint32_t i;
+
+    for ( i = 0; i < lista->cant; i++ )
+        free( lista->nombres[i] );
+    free( lista->nombres );
+    memset( lista, 0, sizeof( lista_archivos ) );
+}
+
+bool armar_salida( const char *patron, const char *entrada,
+                   char *destino, size_t tam )
+{
+    const char *base, *punto, *marca;
+    size_t largo_base;
+    int escrito;
+
+    if ( ( marca = strstr( patron, "%s" ) ) == NULL )
+        return false;
+
+    base = strrchr( entrada, '/' );
+    base = base == NULL ? entrada : base + 1;
+    punto = strrchr( base, '.' );
+    largo_base = punto == NULL || punto == base ? strlen( base ) : ( size_t ) ( punto - base );
+
+    escrito = snprintf( destino, tam, "%.*s%.*s%s",
+                        ( int ) ( marca - patron ), patron,
+                        ( int ) largo_base, base,
+                        marca + 2 );
+    return escrito >= 0 && ( size_t ) escrito < tam;
+}
+
+/*
+ * Arma el nombre de salida de cada archivo de la lista. Como el %s no
+ * lleva la carpeta, dos entradas de carpetas distintas pueden ir a la
+ * misma salida y pisarse entre sí: esos nombres quedan vacíos, y sus
+ * archivos fallan. Los que no se pueden armar quedan en NULL.
+ * Devuelve NULL si no hay memoria.
+ */
+char **armar_salidas( const lista_archivos *lista, const char *patron )
+{
+    char **salidas, **orden, salida[LARGO_SALIDA];
+    uint32_t i, j, k;
+
+    salidas = ( char ** ) calloc( lista->cant, sizeof( char * ) );
+    orden = ( char ** ) malloc( sizeof( char * ) * lista->cant );
+    if ( salidas == NULL || orden == NULL )
+    {
+        fprintf( salida_errores(), "Error alocando la lista de archivos\n" );
+        free( salidas );
+        free( orden );
+        return NULL;
+    }
+
+    for ( i = 0, k = 0; i < lista->cant; i++ )
+    {
+        if ( armar_salida( patron, lista->nombres[i], salida, sizeof( salida ) ) &&
+                ( salidas[i] = strdup( salida ) ) != NULL )
+            orden[k++] = salidas[i];
+    }
+
+    /* ordenadas, las repetidas quedan juntas */
+    qsort( orden, k, sizeof( char * ), comparar_nombres );
+    for ( i = 0; i < k; i = j )
+    {
+        for ( j = i + 1; j < k && strcmp( orden[i], orden[j] ) == 0; j++ )
+            ;
+        if ( j - i > 1 )
+        {
+            fprintf( salida_errores(), "Lote: %u archivos irían a %s\n", j - i, orden[i] );
+            while ( i < j )
+                orden[i++][0] = '\0';
+        }
+    }
+
+    free( orden );
+    return salidas;
+}
+
+void liberar_salidas( char **salidas, uint32_t cant )
+{
+    uint32_t i;
+
+    for ( i = 0; i < cant; i++ )
+        free( salidas[i] );
+    free( salidas );
+}
+
+/*
+ * Procesa los archivos [desde, hasta) de la lista. Dentro de una banda
+ * el pool ya está ocupado, así que cada imágen se procesa en un solo
+ * hilo.
+ */
+void lote_banda( void *ctx, uint32_t desde, uint32_t hasta )
+{
+    contexto_lote *c = ( contexto_lote * ) ctx;
+    const char *entrada, *salida;
+    uint64_t inicio = 0;
+    uint32_t i;
+
+    for ( i = desde; i < hasta; i++ )
+    {
+        entrada = c->lista->nombres[i];
+        salida = c->salidas[i];
+        if ( traza_activa )
+            inicio = traza_ahora();
+        if ( salida == NULL || salida[0] == '\0' ||
+                !ejecutar_plan( c->plan, entrada, salida ) )
+        {
+            fprintf( salida_errores(), "%s: no se pudo procesar\n", entrada );
+            __atomic_fetch_add( &c->fallidos, 1, __ATOMIC_RELAXED );
+        }
+        if ( traza_activa )
+            traza_evento( entrada, inicio, 0, 0 );
+    }
+}
+
+bool procesar_lote( const plan_t *plan, const char *entradas, const char *patron )
+{
+    lista_archivos lista;
+    contexto_lote ctx;
+
+    if ( !listar_entradas( entradas, &lista ) )
+        return false;
+
+    if ( ( ctx.salidas = armar_salidas( &lista, patron ) ) == NULL )
+    {
+        liberar_lista( &lista );
+        return false;
+    }
+    ctx.plan = plan;
+    ctx.lista = &lista;
+    ctx.fallidos = 0;
+
+    /* un archivo por banda: los hilos toman el próximo al terminar */
+    pool_paralelo( lista.cant, 1, lote_banda, &ctx );
+
+    if ( ctx.fallidos )
+        fprintf( salida_errores(), "Lote: %u de %u archivos con errores\n", ctx.fallidos, lista.cant );
+
+    liberar_salidas( ctx.salidas, lista.cant );
+    liberar_lista( &lista );
+    return ctx.fallidos == 0;
+}
@@ -0,0 +1,142 @@
+/***********************************************************************
+ *
+ * Módulo: Implementación del perfil de pasos. Sólo se mide si se pidió
+ *         con -t: sin la opción, el plan no tiene perfil y no se llama
+ *         a ninguna de estas funciones.
+ * Autor:  Martín Aguilar
+ *
+ **********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <malloc.h>
+#include <sys/resource.h>
+#include "../headers/perfil.h"
+#include "../headers/reserva.h"
+#include "../headers/medicion.h"
+
+// ENCABEZADOS FUNCIONES
+
+int64_t heap_en_uso( void );
+
+// FIN ENCABEZADOS
+
+
+/*
+ * Bytes en uso del heap, sumando los bloques grandes que malloc pide
+ * aparte con mmap.
+ */
+int64_t heap_en_uso( void )
+{
+    struct mallinfo2 info = mallinfo2();
+
+    return ( int64_t ) info.uordblks + ( int64_t ) info.hblkhd;
+}
+
+void iniciar_perfil( perfil_t *perfil )
+{
+    memset( perfil, 0, sizeof( perfil_t ) );
+}
+
+void empezar_paso( perfil_t *perfil )
+{
+    perfil->heap = heap_en_uso();
+    perfil->pedido = bytes_pedidos();
+    perfil->cpu = reloj_ns( CLOCK_PROCESS_CPUTIME_ID );
+    perfil->pared = reloj_ns( CLOCK_MONOTONIC );
+}
+
+void terminar_paso( perfil_t *perfil, const char *nombre )
+{
+    uint64_t pared, cpu;
+    struct rusage uso;
+    paso_perfil *paso;
+
+    pared = reloj_ns( CLOCK_MONOTONIC );
+    cpu = reloj_ns( CLOCK_PROCESS_CPUTIME_ID );
+
+    if ( perfil->cant == perfil->capacidad )
+    {
+        uint32_t capacidad = perfil->capacidad ? perfil->capacidad * 2 : 16;
+        paso = ( paso_perfil * ) realloc( perfil->pasos, sizeof( paso_perfil ) * capacidad );
+        if ( paso == NULL )
+            return; /* sin memoria el paso no se registra, pero se sigue */
+        perfil->pasos = paso;
+        perfil->capacidad = capacidad;
+    }
+
+    paso = &perfil->pasos[perfil->cant++];
+    snprintf( paso->nombre, sizeof( paso->nombre ), "%s", nombre );
+    paso->pared_ms = ( pared - perfil->pared ) / 1e6;
+    paso->cpu_ms = ( cpu - perfil->cpu ) / 1e6;
+    paso->pedido = bytes_pedidos() - perfil->pedido;
+    paso->heap = heap_en_uso() - perfil->heap;
+    paso->pico_rss_kb = getrusage( RUSAGE_SELF, &uso ) == 0 ? uso.ru_maxrss : 0;
+}
+
+void mostrar_perfil( const perfil_t *perfil, FILE *salida )
+{
+    double pared = 0, cpu = 0;
+    uint64_t pedido = 0;
+    int64_t heap = 0;
+    const paso_perfil *paso;
+    uint32_t i;
+
+    fprintf( salida, "%-40s %10s %10s %10s %10s %10s\n",
+             "paso", "real ms", "cpu ms", "pedido MB", "heap MB", "pico MB" );
+    for ( i = 0; i < perfil->cant; i++ )
+    {
+        paso = &perfil->pasos[i];
+        fprintf( salida, "%-40.40s %10.2f %10.2f %10.2f %10.2f %10.2f\n",
+                 paso->nombre, paso->pared_ms, paso->cpu_ms,
+                 paso->pedido / 1048576.0, paso->heap / 1048576.0,
+                 paso->pico_rss_kb / 1024.0 );
+        pared += paso->pared_ms;
+        cpu += paso->cpu_ms;
+        pedido += paso->pedido;
+        heap += paso->heap;
+    }
+    fprintf( salida, "%-40s %10.2f %10.2f %10.2f %10.2f %10.2f\n",
+             "total", pared, cpu, pedido / 1048576.0, heap / 1048576.0,
+             perfil->cant ? perfil->pasos[perfil->cant - 1].pico_rss_kb / 1024.0 : 0.0 );
+}
+
+bool grabar_perfil_json( const perfil_t *perfil, const char *archivo )
+{
+    const paso_perfil *paso;
+    uint32_t i;
+    FILE *f;
+
+    if ( ( f = fopen( archivo, "w" ) ) == NULL )
+    {
+        fprintf( stderr, "Error al abrir %s para escribir\n", archivo );
+        return false;
+    }
+
+    fprintf( f, "{\n  \"pasos\": [" );
+    for ( i = 0; i < perfil->cant; i++ )
+    {
+        paso = &perfil->pasos[i];
+        fprintf( f, "%s\n    { \"paso\": ", i ? "," : "" );
+        escribir_json_texto( f, paso->nombre );
+        fprintf( f, ", \"real_ms\": %.3f, \"cpu_ms\": %.3f, \"pedido\": %llu, "
+                 "\"heap\": %lld, \"pico_rss_kb\": %ld }",
+                 paso->pared_ms, paso->cpu_ms, ( unsigned long long ) paso->pedido,
+                 ( long long ) paso->heap, paso->pico_rss_kb );
+    }
+    fprintf( f, "\n  ]\n}\n" );
+
+    if ( fclose( f ) )
+    {
+        fprintf( stderr, "Error grabando %s\n", archivo );
+        return false;
+    }
+    return true;
+}
+
+void liberar_perfil( perfil_t *perfil )
+{
+    free( perfil->pasos );
+    memset( perfil, 0, sizeof( perfil_t ) );
+}
@@ -0,0 +1,640 @@
+/***********************************************************************
+ *
+ * Módulo: Implementación del plan de operaciones: se arma a partir de
+ *         los parámetros, se optimiza y se ejecuta sobre la imágen.
+ * Autor:  Martín Aguilar
+ *
+ **********************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../headers/plan.h"
+#include "../headers/traza.h"
+#include "../headers/errores.h"
+
+// ENCABEZADOS FUNCIONES
+
+bool es_op_fila( const tipo_operacion tipo );
+
+bool se_anulan( const operacion *a, const operacion *b );
+
+bool fusionar_filas( plan_t *plan );
+
+void mostrar_op_fila( const op_fila *op, FILE *salida );
+
+void describir_operacion( const operacion *op, FILE *salida );
+
+void nombrar_operacion( const operacion *op, char *nombre, size_t tam );
+
+void terminar_paso_op( perfil_t *perfil, const operacion *op );
+
+bool ejecutar_por_filas( const plan_t *plan, const char *entrada, const char *salida );
+
+bool ejecutar_en_memoria( const plan_t *plan, const char *entrada, const char *salida );
+
+// FIN ENCABEZADOS
+
+
+/*
+ * Devuelve true si la operación trabaja sobre cada fila por separado y
+ * se puede fusionar con otras en una sola pasada.
+ */
+bool es_op_fila( const tipo_operacion tipo )
+{
+    return tipo == OP_NEGATIVO || tipo == OP_LINEAS_H || tipo == OP_LINEAS_V;
+}
+
+/*
+ * Devuelve true si aplicar "a" y después "b" deja la imágen igual.
+ */
+bool se_anulan( const operacion *a, const operacion *b )
+{
+    if ( a->tipo != b->tipo )
+        return false;
+    return a->tipo == OP_FLIP || a->tipo == OP_NEGATIVO;
+}
+
+bool armar_plan( char *argv[], int argc, const datix *datos, plan_t *plan )
+{
+    int i = 1;
+    operacion *op;
+
+    plan->cant = 0;
+    plan->original = 0;
+    plan->guardar = false;
+    plan->comprimir = datos->rle;
+    plan->profundidad = datos->profundidad;
+    plan->textos = stdout;
+    plan->perfil = NULL;
+    plan->ops = ( operacion * ) calloc( argc, sizeof( operacion ) );
+    if ( plan->ops == NULL )
+    {
+        fprintf( salida_errores(), "No hay memoria para el plan de operaciones\n" );
+        return false;
+    }
+
+    while ( i < argc )
+    {
+        op = &plan->ops[plan->cant];
+        switch ( argv[i][1] )
+        {
+        case 's':
+            op->tipo = OP_HEADER;
+            plan->cant++;
+            if ( datos->salida != NULL ) plan->guardar = true;
+            break;
+        case 'p':
+            op->tipo = OP_FLIP;
+            op->fila.tipo = FILA_FLIP;
+            plan->cant++;
+            plan->guardar = true;
+            break;
+        case 'r':
+            op->tipo = OP_ROTAR;
+            op->veces = 1;
+            plan->cant++;
+            plan->guardar = true;
+            break;
+        case 'n':
+            op->tipo = OP_NEGATIVO;
+            op->fila.tipo = FILA_NEGATIVO;
+            plan->cant++;
+            plan->guardar = true;
+            break;
+        case 'd':
+            op->tipo = OP_DOBLE;
+            plan->cant++;
+            plan->guardar = true;
+            break;
+        case 'f':
+            op->tipo = OP_MITAD;
+            plan->cant++;
+            plan->guardar = true;
+            break;
+        case 'z':
+            /* cada -z tiene su tamaño: se lee de los parámetros, ya validados */
+            op->tipo = OP_ESCALAR;
+            op->ancho = strtoul( argv[i + 1], NULL, 10 );
+            op->alto = strtoul( argv[i + 2], NULL, 10 );
+            filtro_desde_nombre( argv[i + 3], &op->filtro );
+            plan->cant++;
+            plan->guardar = true;
+            i += 3;
+            break;
+        case 'C':
+            op->tipo = OP_RECORTE;
+            op->x = strtoul( argv[i + 1], NULL, 10 );
+            op->y = strtoul( argv[i + 2], NULL, 10 );
+            op->ancho = strtoul( argv[i + 3], NULL, 10 );
+            op->alto = strtoul( argv[i + 4], NULL, 10 );
+            plan->cant++;
+            plan->guardar = true;
+            i += 4;
+            break;
+        case 'b':
+            op->tipo = OP_BLUR;
+            op->rate = datos->blur_rate;
+            plan->cant++;
+            plan->guardar = true;
+            i++;
+            break;
+        case 'l':
+            if ( argv[i][2] == 'h' ) {
+                op->tipo = OP_LINEAS_H;
+                op->fila.tipo = FILA_LINEAS_H;
+                op->fila.ancho = datos->lineas_hor_ancho;
+                op->fila.espacio = datos->lineas_hor_espacio;
+                op->fila.color = datos->lineas_hor_color;
+            }
+            else {
+                op->tipo = OP_LINEAS_V;
+                op->fila.tipo = FILA_LINEAS_V;
+                op->fila.ancho = datos->lineas_ver_ancho;
+                op->fila.espacio = datos->lineas_ver_espacio;
+                op->fila.color = datos->lineas_ver_color;
+            }
+            plan->cant++;
+            plan->guardar = true;
+            i += 3;
+            break;
+        case 'o':
+            plan->guardar = true;
+            i++;
+            break;
+        case 'c':
+            plan->guardar = true;
+            break;
+        case 'B':
+            plan->guardar = true;
+            i++;
+            break;
+        case 'i':
+        case 'e':
+        case 'j':
+        case 'T':
+        case 'x':
+        case 'S':
+            i++;
+            break;
+        }
+        i++;
+    }
+    plan->original = plan->cant;
+    return true;
+}
+
+/*
+ * Reemplaza cada tramo de dos o más operaciones por filas seguidas por
+ * una sola operación OP_FILAS. Devuelve false si no hay memoria, y en
+ * ese caso el plan queda como estaba.
+ */
+bool fusionar_filas( plan_t *plan )
+{
+    uint32_t i, j, k, n = 0;
+    op_fila *filas;
+
+    for ( i = 0; i < plan->cant; i = j )
+    {
+        for ( j = i; j < plan->cant && es_op_fila( plan->ops[j].tipo ); j++ )
+            ;
+        if ( j - i < 2 )
+        {
+            plan->ops[n++] = plan->ops[i];
+            if ( j == i ) j++;
+            continue;
+        }
+
+        filas = ( op_fila * ) malloc( sizeof( op_fila ) * ( j - i ) );
+        if ( filas == NULL )
+        {
+            while ( i < plan->cant )
+                plan->ops[n++] = plan->ops[i++];
+            plan->cant = n;
+            return false;
+        }
+        for ( k = i; k < j; k++ )
+            filas[k - i] = plan->ops[k].fila;
+
+        memset( &plan->ops[n], 0, sizeof( operacion ) );
+        plan->ops[n].tipo = OP_FILAS;
+        plan->ops[n].filas = filas;
+        plan->ops[n].nfilas = j - i;
+        n++;
+    }
+    plan->cant = n;
+    return true;
+}
+
+void optimizar_plan( plan_t *plan )
+{
+    uint32_t i, n = 0;
+    operacion *tope;
+
+    /*
+     * Se recorre el plan como una pila: cada operación que anula a la
+     * anterior la saca, así "-p -n -n -p" desaparece entero.
+     */
+    for ( i = 0; i < plan->cant; i++ )
+    {
+        tope = n > 0 ? &plan->ops[n - 1] : NULL;
+        if ( tope != NULL && se_anulan( tope, &plan->ops[i] ) )
+        {
+            n--;
+            continue;
+        }
+        if ( tope != NULL && tope->tipo == OP_ROTAR && plan->ops[i].tipo == OP_ROTAR )
+        {
+            tope->veces = ( tope->veces + plan->ops[i].veces ) % 4;
+            if ( tope->veces == 0 )
+                n--;
+            continue;
+        }
+        plan->ops[n++] = plan->ops[i];
+    }
+    plan->cant = n;
+
+    fusionar_filas( plan );
+}
+
+bool plan_por_filas( const plan_t *plan )
+{
+    uint32_t i;
+
+    /* la salida comprimida o con otros BPP no se arma de a una fila */
+    if ( plan->comprimir || plan->profundidad )
+        return false;
+
+    for ( i = 0; i < plan->cant; i++ )
+    {
+        switch ( plan->ops[i].tipo )
+        {
+        case OP_HEADER:
+        case OP_FLIP:
+        case OP_NEGATIVO:
+        case OP_LINEAS_H:
+        case OP_LINEAS_V:
+        case OP_FILAS:
+            break;
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+uint32_t aplanar_plan( const plan_t *plan, op_fila *ops, uint32_t *mostrar )
+{
+    uint32_t i, k, n = 0;
+
+    *mostrar = 0;
+    for ( i = 0; i < plan->cant; i++ )
+    {
+        switch ( plan->ops[i].tipo )
+        {
+        case OP_HEADER:
+            ( *mostrar )++;
+            break;
+        case OP_FILAS:
+            for ( k = 0; k < plan->ops[i].nfilas; k++ )
+                ops[n++] = plan->ops[i].filas[k];
+            break;
+        default:
+            ops[n++] = plan->ops[i].fila;
+            break;
+        }
+    }
+    return n;
+}
+
+bool ejecutar_operacion( const operacion *op, bmp_t *imagen, FILE *textos )
+{
+    switch ( op->tipo )
+    {
+    case OP_HEADER:
+        /* en un lote, los headers de distintas imágenes no se mezclan */
+        flockfile( textos );
+        mostrar_header( imagen, textos );
+        funlockfile( textos );
+        break;
+    case OP_FLIP:
+        flip_vertical( imagen );
+        break;
+    case OP_ROTAR:
+        rotar( op->veces, imagen );
+        break;
+    case OP_NEGATIVO:
+        negativo( imagen );
+        break;
+    case OP_LINEAS_H:
+        addlineash( op->fila.ancho, op->fila.espacio, op->fila.color, imagen );
+        break;
+    case OP_LINEAS_V:
+        addlineasv( op->fila.ancho, op->fila.espacio, op->fila.color, imagen );
+        break;
+    case OP_DOBLE:
+        redimensionar2x( imagen );
+        break;
+    case OP_MITAD:
+        redimensionar1_2x( imagen );
+        break;
+    case OP_BLUR:
+        blur( op->rate, imagen );
+        break;
+    case OP_ESCALAR:
+        redimensionar( imagen, op->ancho, op->alto, op->filtro );
+        break;
+    case OP_RECORTE:
+        return recortar( imagen, op->x, op->y, op->ancho, op->alto );
+    case OP_FILAS:
+        aplicar_ops_filas( imagen, op->filas, op->nfilas );
+        break;
+    }
+    return true;
+}
+
+/*
+ * Procesa la imágen de a una fila, cuando todas las operaciones lo
+ * permiten: la memoria usada depende sólo del ancho de la imágen.
+ */
+bool ejecutar_por_filas( const plan_t *plan, const char *entrada, const char *salida )
+{
+    bmp_t *bmpfile;
+    op_fila *ops;
+    uint32_t nops, mostrar;
+    uint64_t inicio = 0;
+    bool ok = true;
+
+    /* al aplanar el plan nunca quedan más operaciones que al principio */
+    ops = ( op_fila * ) malloc( sizeof( op_fila ) * ( plan->original ? plan->original : 1 ) );
+    if ( ops == NULL )
+    {
+        fprintf( salida_errores(), "No hay memoria para el plan de operaciones\n" );
+        return false;
+    }
+    nops = aplanar_plan( plan, ops, &mostrar );
+
+    if ( plan->perfil != NULL )
+        empezar_paso( plan->perfil );
+    if ( traza_activa )
+        inicio = traza_ahora();
+    /* si no se graba (sólo -s) alcanza con los headers: no se mapea el archivo */
+    if ( plan->guardar )
+        bmpfile = abrir_imagen_archivo( entrada );
+    else
+        bmpfile = leer_header_archivo( entrada );
+    if ( bmpfile == NULL )
+    {
+        free( ops );
+        return false;
+    }
+    if ( traza_activa )
+        traza_evento( plan->guardar ? "abrir_imagen_archivo" : "leer_header_archivo", inicio, 0, 0 );
+    if ( plan->perfil != NULL )
+        terminar_paso( plan->perfil, "abrir" );
+
+    /* una entrada comprimida no se puede leer de a una fila */
+    if ( plan->guardar && !legible_por_filas( bmpfile ) )
+    {
+        destruir_bmp( bmpfile );
+        free( ops );
+        return ejecutar_en_memoria( plan, entrada, salida );
+    }
+
+    flockfile( plan->textos );
+    while ( mostrar-- )
+        mostrar_header( bmpfile, plan->textos );
+    funlockfile( plan->textos );
+
+    /* leer, aplicar y grabar van juntos: se miden como un solo paso */
+    if ( plan->perfil != NULL )
+        empezar_paso( plan->perfil );
+    if ( traza_activa )
+        inicio = traza_ahora();
+    if ( plan->guardar && !procesar_por_filas( bmpfile, ops, nops, salida ) ) {
+        fprintf( salida_errores(), "Error al grabar el archivo en el disco\n" );
+        ok = false;
+    }
+    if ( traza_activa && plan->guardar )
+        traza_evento( "procesar_por_filas", inicio, 0, 0 );
+    if ( plan->perfil != NULL && plan->guardar )
+        terminar_paso( plan->perfil, "leer, aplicar y grabar por filas" );
+
+    destruir_bmp( bmpfile );
+    free( ops );
+    return ok;
+}
+
+/*
+ * Carga la imágen entera, le aplica el plan y la graba. Si la primera
+ * operación es un recorte, se carga sólo el rectángulo.
+ */
+bool ejecutar_en_memoria( const plan_t *plan, const char *entrada, const char *salida )
+{
+    char nombre[64];
+    bmp_t *bmpfile;
+    const operacion *recorte = NULL;
+    uint32_t i;
+    uint64_t inicio = 0;
+    bool ok = true;
+
+    if ( plan->cant && plan->ops[0].tipo == OP_RECORTE )
+        recorte = &plan->ops[0];
+
+    if ( plan->perfil != NULL )
+        empezar_paso( plan->perfil );
+    if ( traza_activa )
+        inicio = traza_ahora();
+    if ( recorte != NULL )
+        bmpfile = crear_recorte_archivo( entrada, recorte->x, recorte->y,
+                                         recorte->ancho, recorte->alto );
+    else
+        bmpfile = crear_imagen_archivo( entrada );
+    if ( bmpfile == NULL )
+        return false;
+    if ( traza_activa )
+        traza_evento( recorte != NULL ? "crear_recorte_archivo" : "crear_imagen_archivo", inicio, 0, 0 );
+    if ( plan->perfil != NULL )
+        terminar_paso( plan->perfil, recorte != NULL ? "cargar recorte" : "cargar" );
+
+    for ( i = recorte != NULL ? 1 : 0; ok && i < plan->cant; i++ )
+    {
+        if ( plan->perfil != NULL )
+            empezar_paso( plan->perfil );
+        if ( traza_activa )
+            inicio = traza_ahora();
+        ok = ejecutar_operacion( &plan->ops[i], bmpfile, plan->textos );
+        if ( traza_activa )
+        {
+            nombrar_operacion( &plan->ops[i], nombre, sizeof( nombre ) );
+            traza_evento( nombre, inicio, 0, 0 );
+        }
+        if ( plan->perfil != NULL )
+            terminar_paso_op( plan->perfil, &plan->ops[i] );
+    }
+
+    // volcar el bmp de memoria a un archivo, con los BPP y la compresión pedidos
+    if ( plan->perfil != NULL )
+        empezar_paso( plan->perfil );
+    if ( traza_activa )
+        inicio = traza_ahora();
+    /* sin -c ni -B se conserva la compresión de la entrada; un -B solo la quita */
+    if ( plan->comprimir )
+        usar_rle( bmpfile, true );
+    else if ( plan->profundidad )
+        usar_rle( bmpfile, false );
+    /* si falló una operación no se graba */
+    if ( ok && plan->guardar && plan->profundidad && !cambiar_profundidad( bmpfile, plan->profundidad ) )
+        ok = false;
+    else if ( ok && plan->guardar && !grabar_archivo( bmpfile, salida ) ) {
+        fprintf( salida_errores(), "Error al grabar el archivo en el disco\n" );
+        ok = false;
+    }
+    if ( traza_activa && plan->guardar && ok )
+        traza_evento( "grabar_archivo", inicio, 0, 0 );
+    if ( plan->perfil != NULL && plan->guardar && ok )
+        terminar_paso( plan->perfil, "grabar" );
+    //destruir el archivo de la memoria
+    if ( !destruir_bmp( bmpfile ) ) {
+        fprintf( salida_errores(), "Error al liberar la memoria de la imagen\n" );
+        ok = false;
+    }
+    return ok;
+}
+
+bool ejecutar_plan( const plan_t *plan, const char *entrada, const char *salida )
+{
+    // Si todas las operaciones son por filas, no se carga la imágen entera
+    if ( plan_por_filas( plan ) )
+        return ejecutar_por_filas( plan, entrada, salida );
+    return ejecutar_en_memoria( plan, entrada, salida );
+}
+
+/*
+ * Imprime una operación por filas, sin salto de línea.
+ */
+void mostrar_op_fila( const op_fila *op, FILE *salida )
+{
+    switch ( op->tipo )
+    {
+    case FILA_NEGATIVO:
+        fprintf( salida, "negativo" );
+        break;
+    case FILA_LINEAS_H:
+        fprintf( salida, "lineas horizontales (%X %X %02X%02X%02X)",
+                 op->ancho, op->espacio,
+                 op->color.red, op->color.green, op->color.blue );
+        break;
+    case FILA_LINEAS_V:
+        fprintf( salida, "lineas verticales (%X %X %02X%02X%02X)",
+                 op->ancho, op->espacio,
+                 op->color.red, op->color.green, op->color.blue );
+        break;
+    case FILA_FLIP:
+        fprintf( salida, "flip vertical" );
+        break;
+    }
+}
+
+/*
+ * Imprime una operación del plan, sin salto de línea.
+ */
+void describir_operacion( const operacion *op, FILE *salida )
+{
+    uint32_t k;
+
+    switch ( op->tipo )
+    {
+    case OP_HEADER:
+        fprintf( salida, "mostrar header" );
+        break;
+    case OP_ROTAR:
+        fprintf( salida, "rotar %u grados", op->veces * 90 );
+        break;
+    case OP_DOBLE:
+        fprintf( salida, "duplicar tamanio" );
+        break;
+    case OP_MITAD:
+        fprintf( salida, "reducir a la mitad" );
+        break;
+    case OP_BLUR:
+        fprintf( salida, "blur (%X)", op->rate );
+        break;
+    case OP_ESCALAR:
+        fprintf( salida, "redimensionar a %ux%u (%s)", op->ancho, op->alto,
+                 nombre_filtro( op->filtro ) );
+        break;
+    case OP_RECORTE:
+        fprintf( salida, "recortar %ux%u desde (%u, %u)", op->ancho, op->alto, op->x, op->y );
+        break;
+    case OP_FILAS:
+        fprintf( salida, "una pasada: " );
+        for ( k = 0; k < op->nfilas; k++ )
+        {
+            if ( k ) fprintf( salida, ", " );
+            mostrar_op_fila( &op->filas[k], salida );
+        }
+        break;
+    default:
+        mostrar_op_fila( &op->fila, salida );
+        break;
+    }
+}
+
+/*
+ * Deja en "nombre" la descripción de una operación, cortada a "tam"
+ * bytes, para el perfil y la traza.
+ */
+void nombrar_operacion( const operacion *op, char *nombre, size_t tam )
+{
+    FILE *texto;
+
+    memset( nombre, 0, tam );
+    /* el último byte queda siempre en cero */
+    if ( ( texto = fmemopen( nombre, tam - 1, "w" ) ) != NULL )
+    {
+        describir_operacion( op, texto );
+        fclose( texto );
+    }
+}
+
+/*
+ * Cierra el paso del perfil de una operación, con su descripción como
+ * nombre.
+ */
+void terminar_paso_op( perfil_t *perfil, const operacion *op )
+{
+    char nombre[sizeof( ( ( paso_perfil * ) 0 )->nombre )];
+
+    nombrar_operacion( op, nombre, sizeof( nombre ) );
+    terminar_paso( perfil, nombre );
+}
+
+void mostrar_plan( const plan_t *plan, FILE *salida )
+{
+    uint32_t i;
+
+    fprintf( salida, "Plan: %u operaciones, %u despues de optimizar\n",
+             plan->original, plan->cant );
+    for ( i = 0; i < plan->cant; i++ )
+    {
+        fprintf( salida, "  %u. ", i + 1 );
+        describir_operacion( &plan->ops[i], salida );
+        fprintf( salida, "\n" );
+    }
+    if ( plan_por_filas( plan ) )
+        fprintf( salida, "  (se procesa de a una fila)\n" );
+}
+
+void liberar_plan( plan_t *plan )
+{
+    uint32_t i;
+
+    for ( i = 0; i < plan->cant; i++ )
+        if ( plan->ops[i].tipo == OP_FILAS )
+            free( plan->ops[i].filas );
+    free( plan->ops );
+    plan->ops = NULL;
+    plan->cant = 0;
+}
@@ -0,0 +1,483 @@
+/***********************************************************************
+ *
+ * Módulo: Implementación del modo servidor. Cada conexión es un trabajo
+ *         que se atiende en un hilo propio; los trabajos comparten el
+ *         pool de hilos para las operaciones y la reserva de bloques.
+ * Autor:  Martín Aguilar
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "../headers/servidor.h"
+#include "../headers/reserva.h"
+#include "../headers/errores.h"
+
+/* Cantidad máxima de opciones en un trabajo */
+#define MAX_OPCIONES 1024
+
+/* Bytes que se copian de una vez entre el socket y los temporales */
+#define BLOQUE_DATOS 65536
+
+/* Nombre del temporal de las imágenes que pasan por el socket */
+#define TEMPORAL_MEMORIA "/dev/shm/wat.XXXXXX"
+#define TEMPORAL_DISCO "/tmp/wat.XXXXXX"
+
+/*
+ * Cantidad de trabajos en curso, para no pasar de MAX_TRABAJOS y para
+ * esperarlos al terminar.
+ */
+static uint32_t trabajos = 0;
+static pthread_mutex_t mutex_trabajos = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cambio_trabajos = PTHREAD_COND_INITIALIZER;
+
+/* Se pone en 1 al recibir SIGINT o SIGTERM */
+static volatile sig_atomic_t terminar = 0;
+
+// ENCABEZADOS FUNCIONES
+
+void pedir_terminar( int senial );
+
+bool leer_pedido( int fd, char *pedido, size_t tam, size_t *largo );
+
+int separar_opciones( char *pedido, size_t largo, char **argv );
+
+bool enviar( int fd, const void *datos, size_t largo );
+
+void responder( int fd, const char *respuesta );
+
+const char *opcion_global( const datix *datos );
+
+bool es_archivo( const char *nombre );
+
+bool crear_temporal( char *ruta, size_t tam );
+
+bool recibir_imagen( int fd, const char *resto, size_t largo_resto, const char *ruta );
+
+bool enviar_imagen( int fd, const char *ruta );
+
+void *atender( void *arg );
+
+// FIN ENCABEZADOS
+
+
+void pedir_terminar( int senial )
+{
+    ( void ) senial;
+    terminar = 1;
+}
+
+/*
+ * Lee el pedido hasta la línea vacía que lo termina. Devuelve false si
+ * la conexión se cerró antes o el pedido no entra en el buffer.
+ */
+bool leer_pedido( int fd, char *pedido, size_t tam, size_t *largo )
+{
+    ssize_t leido;
+
+    *largo = 0;
+    while ( *largo < tam - 1 )
+    {
+        leido = read( fd, pedido + *largo, tam - 1 - *largo );
+        if ( leido < 0 && errno == EINTR )
+            continue;
+        if ( leido <= 0 )
+            return false;
+        *largo += leido;
+        pedido[*largo] = '\0';
+
+        if ( ( *largo == 1 && pedido[0] == '\n' ) || strstr( pedido, "\n\n" ) != NULL )
+            return true;
+    }
+    return false;
+}
+
+/*
+ * Separa el pedido en opciones, una por línea, como un argv: argv[0] es
+ * el nombre del programa y el arreglo termina en NULL. Devuelve argc.
+ */
+int separar_opciones( char *pedido, size_t largo, char **argv )
+{
+    char *linea = pedido, *fin;
+    int argc = 0;
+
+    argv[argc++] = "wat";
+    while ( linea < pedido + largo && argc < MAX_OPCIONES - 1 )
+    {
+        if ( ( fin = strchr( linea, '\n' ) ) == NULL )
+            break;
+        *fin = '\0';
+        if ( fin > linea && fin[-1] == '\r' )
+            fin[-1] = '\0';
+        if ( *linea == '\0' )
+            break;
+        argv[argc++] = linea;
+        linea = fin + 1;
+    }
+    argv[argc] = NULL;
+    return argc;
+}
+
+/*
+ * Escribe los "largo" bytes en el descriptor. Devuelve false si no se
+ * pudo (por ejemplo, el cliente cerró la conexión).
+ */
+bool enviar( int fd, const void *datos, size_t largo )
+{
+    const uint8_t *p = ( const uint8_t * ) datos;
+    ssize_t n;
+
+    while ( largo > 0 )
+    {
+        n = write( fd, p, largo );
+        if ( n < 0 && errno == EINTR )
+            continue;
+        if ( n <= 0 )
+            return false;
+        p += n;
+        largo -= n;
+    }
+    return true;
+}
+
+void responder( int fd, const char *respuesta )
+{
+    enviar( fd, respuesta, strlen( respuesta ) );
+}
+
+/*
+ * Devuelve la opción del trabajo que cambiaría el estado de todo el
+ * proceso, y con eso el de los otros trabajos en curso (la traza, las
+ * páginas grandes, el perfil, los hilos del pool o el propio servidor),
+ * o NULL si no tiene ninguna.
+ */
+const char *opcion_global( const datix *datos )
+{
+    if ( datos->traza != NULL )
+        return "-x";
+    if ( datos->paginas_grandes )
+        return "-H";
+    if ( datos->perfil )
+        return "-t";
+    if ( datos->hilos )
+        return "-j";
+    if ( datos->servidor != NULL )
+        return "-D";
+    return NULL;
+}
+
+/*
+ * Devuelve true si "nombre" no existe o es un archivo regular. Un
+ * enlace como /dev/stdout o /proc/self/fd/N llevaría a los descriptores
+ * del propio servidor, y un fifo o un dispositivo a algo fuera del
+ * trabajo.
+ */
+bool es_archivo( const char *nombre )
+{
+    struct stat info;
+
+    return lstat( nombre, &info ) != 0 || S_ISREG( info.st_mode );
+}
+
+/*
+ * Crea un archivo temporal vacío para una imágen que pasa por el
+ * socket, en memoria compartida si se puede, y deja su nombre en
+ * "ruta".
+ */
+bool crear_temporal( char *ruta, size_t tam )
+{
+    int fd;
+
+    snprintf( ruta, tam, "%s", TEMPORAL_MEMORIA );
+    if ( ( fd = mkstemp( ruta ) ) < 0 )
+    {
+        snprintf( ruta, tam, "%s", TEMPORAL_DISCO );
+        if ( ( fd = mkstemp( ruta ) ) < 0 )
+        {
+            ruta[0] = '\0';
+            return false;
+        }
+    }
+    close( fd );
+    return true;
+}
+
+/*
+ * Recibe la imágen de "-i -": una línea "DATOS BYTES" y los bytes, y
+ * la graba en "ruta". Lo que llegó junto con el pedido, después de la
+ * línea vacía, viene en "resto".
+ */
+bool recibir_imagen( int fd, const char *resto, size_t largo_resto, const char *ruta )
+{
+    char linea[64], *bloque;
+    unsigned long long bytes;
+    size_t n = 0, parte;
+    ssize_t leido;
+    FILE *archivo;
+    bool ok = true;
+
+    /* la línea del largo, de lo que ya llegó o de a un byte del socket */
+    while ( n < sizeof( linea ) - 1 )
+    {
+        if ( largo_resto )
+        {
+            linea[n] = *resto++;
+            largo_resto--;
+        }
+        else if ( ( leido = read( fd, &linea[n], 1 ) ) != 1 )
+        {
+            if ( leido < 0 && errno == EINTR )
+                continue;
+            return false;
+        }
+        if ( linea[n] == '\n' )
+            break;
+        n++;
+    }
+    linea[n] = '\0';
+    if ( sscanf( linea, "DATOS %llu", &bytes ) != 1 || bytes > MAX_DATOS ||
+            largo_resto > bytes )
+        return false;
+
+    if ( ( bloque = ( char * ) malloc( BLOQUE_DATOS ) ) == NULL ||
+            ( archivo = fopen( ruta, "w" ) ) == NULL )
+    {
+        free( bloque );
+        return false;
+    }
+
+    ok = fwrite( resto, 1, largo_resto, archivo ) == largo_resto;
+    bytes -= largo_resto;
+    while ( ok && bytes > 0 )
+    {
+        parte = bytes < BLOQUE_DATOS ? bytes : BLOQUE_DATOS;
+        leido = read( fd, bloque, parte );
+        if ( leido < 0 && errno == EINTR )
+            continue;
+        ok = leido > 0 && fwrite( bloque, 1, leido, archivo ) == ( size_t ) leido;
+        bytes -= ok ? ( size_t ) leido : 0;
+    }
+
+    ok = fclose( archivo ) == 0 && ok;
+    free( bloque );
+    return ok;
+}
+
+/*
+ * Manda la imágen de "-o -": una línea "DATOS BYTES" y los bytes del
+ * archivo "ruta".
+ */
+bool enviar_imagen( int fd, const char *ruta )
+{
+    char linea[64], *bloque;
+    struct stat info;
+    size_t leido;
+    FILE *archivo;
+    bool ok;
+
+    if ( ( archivo = fopen( ruta, "r" ) ) == NULL )
+        return false;
+    if ( fstat( fileno( archivo ), &info ) || ( bloque = ( char * ) malloc( BLOQUE_DATOS ) ) == NULL )
+    {
+        fclose( archivo );
+        return false;
+    }
+
+    snprintf( linea, sizeof( linea ), "DATOS %llu\n", ( unsigned long long ) info.st_size );
+    ok = enviar( fd, linea, strlen( linea ) );
+    while ( ok && ( leido = fread( bloque, 1, BLOQUE_DATOS, archivo ) ) > 0 )
+        ok = enviar( fd, bloque, leido );
+
+    free( bloque );
+    fclose( archivo );
+    return ok;
+}
+
+/*
+ * Atiende una conexión: lee el pedido, lo procesa igual que la línea de
+ * comandos y responde con lo que escribió el trabajo (headers,
+ * inventario y errores), la imágen si se pidió con "-o -", y una última
+ * línea con el resultado y el tiempo que llevó.
+ */
+void *atender( void *arg )
+{
+    int fd = ( int ) ( intptr_t ) arg;
+    char *pedido, *argv[MAX_OPCIONES], respuesta[128], *texto = NULL, *fin_pedido;
+    char entrada[sizeof( TEMPORAL_DISCO )] = "", salida[sizeof( TEMPORAL_DISCO )] = "";
+    const char *opcion;
+    struct timespec inicio, fin;
+    size_t largo, largo_texto = 0;
+    FILE *textos = NULL, *errores;
+    bool ok = false;
+    datix datos;
+    int argc;
+
+    if ( ( pedido = ( char * ) malloc( MAX_PEDIDO ) ) == NULL )
+        responder( fd, "ERROR sin memoria\n" );
+    else if ( !leer_pedido( fd, pedido, MAX_PEDIDO, &largo ) )
+        responder( fd, "ERROR pedido incompleto\n" );
+    else if ( ( textos = open_memstream( &texto, &largo_texto ) ) == NULL )
+        responder( fd, "ERROR sin memoria\n" );
+    else
+    {
+        clock_gettime( CLOCK_MONOTONIC, &inicio );
+        /* lo que sigue a la línea vacía es la imágen de "-i -" */
+        fin_pedido = pedido[0] == '\n' ? pedido + 1 : strstr( pedido, "\n\n" ) + 2;
+        argc = separar_opciones( pedido, largo, argv );
+        datos_por_defecto( &datos );
+
+        if ( !parametros_correctos( argv, argc, &datos, textos ) || datos.ayuda )
+            snprintf( respuesta, sizeof( respuesta ), "ERROR parametros incorrectos\n" );
+        else if ( ( opcion = opcion_global( &datos ) ) != NULL )
+            snprintf( respuesta, sizeof( respuesta ),
+                      "ERROR la opcion %s no se puede usar en el servidor\n", opcion );
+        else if ( datos.entrada != NULL && strcmp( datos.entrada, "-" ) &&
+                  !es_archivo( datos.entrada ) )
+            snprintf( respuesta, sizeof( respuesta ), "ERROR la entrada no es un archivo\n" );
+        else if ( datos.lote == NULL && datos.salida != NULL && strcmp( datos.salida, "-" ) &&
+                  !es_archivo( datos.salida ) )
+            snprintf( respuesta, sizeof( respuesta ), "ERROR la salida no es un archivo\n" );
+        else if ( datos.entrada != NULL && strcmp( datos.entrada, "-" ) == 0 &&
+                  ( !crear_temporal( entrada, sizeof( entrada ) ) ||
+                    !recibir_imagen( fd, fin_pedido, pedido + largo - fin_pedido, entrada ) ) )
+            snprintf( respuesta, sizeof( respuesta ), "ERROR no se pudo recibir la imagen\n" );
+        else if ( datos.salida != NULL && strcmp( datos.salida, "-" ) == 0 &&
+                  !crear_temporal( salida, sizeof( salida ) ) )
+            snprintf( respuesta, sizeof( respuesta ), "ERROR sin espacio para la imagen\n" );
+        else
+        {
+            if ( entrada[0] )
+                datos.entrada = entrada;
+            if ( salida[0] )
+                datos.salida = salida;
+
+            /* los errores del trabajo van al cliente, no al servidor */
+            errores = desviar_errores( textos );
+            ok = procesar_plan( argv, argc, &datos, textos );
+            desviar_errores( errores );
+
+            clock_gettime( CLOCK_MONOTONIC, &fin );
+            if ( ok )
+                snprintf( respuesta, sizeof( respuesta ), "OK %.3f\n",
+                          ( fin.tv_sec - inicio.tv_sec ) * 1e3 +
+                          ( fin.tv_nsec - inicio.tv_nsec ) / 1e6 );
+            else
+                snprintf( respuesta, sizeof( respuesta ), "ERROR no se pudo procesar\n" );
+        }
+
+        /* la línea del resultado va siempre sola, al final */
+        fclose( textos );
+        if ( largo_texto )
+        {
+            responder( fd, texto );
+            if ( texto[largo_texto - 1] != '\n' )
+                responder( fd, "\n" );
+        }
+        if ( ok && salida[0] && !enviar_imagen( fd, salida ) )
+            snprintf( respuesta, sizeof( respuesta ), "ERROR no se pudo enviar la imagen\n" );
+        responder( fd, respuesta );
+    }
+
+    if ( entrada[0] )
+        unlink( entrada );
+    if ( salida[0] )
+        unlink( salida );
+    free( texto );
+    free( pedido );
+    close( fd );
+
+    /* sin trabajos en curso, los bloques guardados se devuelven al sistema */
+    pthread_mutex_lock( &mutex_trabajos );
+    if ( --trabajos == 0 )
+        vaciar_reserva();
+    pthread_cond_broadcast( &cambio_trabajos );
+    pthread_mutex_unlock( &mutex_trabajos );
+    return NULL;
+}
+
+bool servir( const char *ruta )
+{
+    struct sockaddr_un direccion;
+    struct sigaction accion;
+    pthread_attr_t atributos;
+    pthread_t hilo;
+    int fd, cliente;
+
+    if ( strlen( ruta ) >= sizeof( direccion.sun_path ) )
+    {
+        fprintf( stderr, "La ruta del socket es demasiado larga\n" );
+        return false;
+    }
+
+    if ( ( fd = socket( AF_UNIX, SOCK_STREAM, 0 ) ) < 0 )
+    {
+        fprintf( stderr, "Error creando el socket\n" );
+        return false;
+    }
+
+    memset( &direccion, 0, sizeof( direccion ) );
+    direccion.sun_family = AF_UNIX;
+    strcpy( direccion.sun_path, ruta );
+    unlink( ruta );
+    if ( bind( fd, ( struct sockaddr * ) &direccion, sizeof( direccion ) ) ||
+            listen( fd, MAX_TRABAJOS ) )
+    {
+        fprintf( stderr, "Error escuchando en %s\n", ruta );
+        close( fd );
+        return false;
+    }
+
+    /* sin SA_RESTART, para que accept vuelva al recibir la señal */
+    memset( &accion, 0, sizeof( accion ) );
+    accion.sa_handler = pedir_terminar;
+    sigaction( SIGINT, &accion, NULL );
+    sigaction( SIGTERM, &accion, NULL );
+    /* un cliente que se va antes de la respuesta no debe matar al servidor */
+    signal( SIGPIPE, SIG_IGN );
+
+    pthread_attr_init( &atributos );
+    pthread_attr_setdetachstate( &atributos, PTHREAD_CREATE_DETACHED );
+
+    fprintf( stderr, "Esperando trabajos en %s\n", ruta );
+    while ( !terminar )
+    {
+        if ( ( cliente = accept( fd, NULL, NULL ) ) < 0 )
+            continue;
+
+        pthread_mutex_lock( &mutex_trabajos );
+        while ( trabajos >= MAX_TRABAJOS )
+            pthread_cond_wait( &cambio_trabajos, &mutex_trabajos );
+        trabajos++;
+        pthread_mutex_unlock( &mutex_trabajos );
+
+        if ( pthread_create( &hilo, &atributos, atender, ( void * ) ( intptr_t ) cliente ) )
+        {
+            responder( cliente, "ERROR servidor ocupado\n" );
+            close( cliente );
+            pthread_mutex_lock( &mutex_trabajos );
+            trabajos--;
+            pthread_mutex_unlock( &mutex_trabajos );
+        }
+    }
+
+    /* esperar a los trabajos en curso antes de liberar el pool */
+    pthread_mutex_lock( &mutex_trabajos );
+    while ( trabajos > 0 )
+        pthread_cond_wait( &cambio_trabajos, &mutex_trabajos );
+    pthread_mutex_unlock( &mutex_trabajos );
+
+    pthread_attr_destroy( &atributos );
+    close( fd );
+    unlink( ruta );
+    return true;
+}
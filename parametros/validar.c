@@ -14,6 +14,15 @@
 #include <string.h>
 #include "../headers/validar.h"
 #include "../headers/bmp.h"
+#include "../headers/pool.h"
+#include "../headers/plan.h"
+#include "../headers/lote.h"
+#include "../headers/reserva.h"
+#include "../headers/servidor.h"
+#include "../headers/perfil.h"
+#include "../headers/traza.h"
+#include "../headers/inventario.h"
+#include "../headers/errores.h"
 
 void ayuda()
 {
@@ -21,12 +30,38 @@ void ayuda()
             "• -? o -h: muestra un texto explicativo de cómo invocar a la aplicación\n"
             "• -s: muestra información sobre el header del archivo BMP. Si no especifica\n"
             "ninguna otra opción (salvo -i) entonces no guarda un archivo de salida.\n"
+            "Lee sólo los headers, no los píxeles.\n"
+            "• -S FORMATO: inventario de los headers de la entrada o del lote (-e),\n"
+            "sin leer los píxeles ni grabar nada. FORMATO es tabla (separada por\n"
+            "tabs) o json.\n"
             "• -p: flip vertical\n"
             "• -r: rota la imagen 90º\n"
             "• -n: genera el negativo de la imagen\n"
             "• -d: duplica el tamaño de la imagen\n"
             "• -f: reduce a la mitad el tamaño de la imagen\n"
+            "• -z ANCHO ALTO FILTRO: redimensiona la imagen a ANCHO x ALTO pixels\n"
+            "(en decimal; si uno es 0 se mantiene la proporción). FILTRO puede ser\n"
+            "cercano, caja, bilineal o lanczos.\n"
+            "• -C X Y ANCHO ALTO: recorta el rectángulo de ANCHO x ALTO pixels que\n"
+            "empieza en la columna X y la fila Y, contando desde arriba (en decimal).\n"
+            "Si es la primera opción, del archivo se leen sólo esas filas y columnas.\n"
             "• -b RATIO: produce el efecto “blur” (enfocar/desenfocar) con RATIO pixels\n"
+            "• -v: muestra en la salida de error el plan de operaciones, ya optimizado\n"
+            "• -t o --profile: muestra en la salida de error el tiempo (real y de CPU)\n"
+            "y la memoria de cada paso: cargar, cada operación y grabar.\n"
+            "• -T ARCHIVO: igual que -t, pero graba la medición en ARCHIVO, en JSON.\n"
+            "• -x ARCHIVO: graba en ARCHIVO una traza de eventos (cargar, cada\n"
+            "operación, cada banda de cada hilo y grabar) para abrir con\n"
+            "chrome://tracing o ui.perfetto.dev.\n"
+            "• -H: pide las matrices de píxeles grandes en páginas grandes (huge\n"
+            "pages), que se reusan entre operaciones y entre imágenes de un lote.\n"
+            "• -c: graba la imagen comprimida con RLE, si es de 4 u 8 BPP (las que\n"
+            "ya venían comprimidas se graban así si no se pide -B).\n"
+            "• -B BPP: graba la imagen con BPP bits por pixel: 1, 4, 8, 16 (RGB565),\n"
+            "15 (RGB555, en 16 BPP), 24 o 32. Con 8 o menos, si los colores no entran\n"
+            "en la paleta se usa una fija. Sin -c se graba sin comprimir.\n"
+            "• -j N: cantidad de hilos a usar (en decimal). Por defecto se usan\n"
+            "todos los procesadores.\n"
             "• -lh WIDTH SPACE COLOR: dibuja líneas de COLOR horizontales de WIDTH\n"
             "pixels, separadas por SPACE pixels. Color debe ir en hexadecimal: "
             "FF0000 RED, 00FF00 GREEN, 0000FF BLUE. Cada color varía desde 00 hasta FF.\n"
@@ -35,7 +70,17 @@ void ayuda()
             "FF0000 RED, 00FF00 GREEN, 0000FF BLUE. Cada color varía desde 00 hasta FF.\n"
             "• -o OUTPUT: especifica el nombre de archivo en el cual se almacenará la\n"
             "imagen resultante. En caso de no ser ingresado, se utilizará out.bmp .\n"
-            "• -i INTPUT: el nombre del archivo con la imagen a procesar.\n");
+            "• -i INTPUT: el nombre del archivo con la imagen a procesar.\n"
+            "• -e ENTRADAS: procesa un lote de imágenes con las mismas opciones.\n"
+            "ENTRADAS puede ser un directorio (se toman sus .bmp), un patrón entre\n"
+            "comillas como \"fotos/*.bmp\", o @LISTA, un archivo con un nombre por línea.\n"
+            "En un lote, OUTPUT es un patrón donde %%s se reemplaza por el nombre de\n"
+            "cada imagen sin extensión (por defecto %%s_out.bmp).\n"
+            "• -D SOCKET: queda esperando trabajos en el socket Unix SOCKET. Cada\n"
+            "trabajo son las mismas opciones, una por línea, terminadas con una línea\n"
+            "vacía; la respuesta es lo que escribe el trabajo (como con -s) y una\n"
+            "última línea, \"OK MILISEGUNDOS\" o \"ERROR\". En un trabajo no se\n"
+            "aceptan -x, -H, -t, -T ni -j. Ver cliente/cliente.c.\n");
 }
 
 // Funcion para transformar string a long, ya que atoi no sirve.
@@ -45,6 +90,14 @@ bool string_a_long(const char *str, long *convertir) {
     return ( errno != ERANGE && *ptr == '\0' );
 }
 
+// Igual que string_a_long, pero para números en decimal.
+bool string_a_entero(const char *str, long *convertir) {
+    char *ptr;
+    errno = 0;
+    *convertir = strtol( str, &ptr, 10);
+    return ( errno != ERANGE && *str != '\0' && *ptr == '\0' );
+}
+
 /*
  * Transforma un LONG en un COLOR, para luego usarlo en el
  * "AgregarLineas".
@@ -59,15 +112,43 @@ bmpcolor_t colordesdeint(const long color_int)
     return color;
 }
 
+/* Nombres de los filtros, en el orden de filtro_escala */
+static const char *nombres_filtros[] = { "cercano", "caja", "bilineal", "lanczos" };
+
+bool filtro_desde_nombre( const char *nombre, filtro_escala *filtro )
+{
+    uint32_t i;
+
+    for ( i = 0; i < sizeof( nombres_filtros ) / sizeof( nombres_filtros[0] ); i++ )
+        if ( strcmp( nombre, nombres_filtros[i] ) == 0 )
+        {
+            *filtro = ( filtro_escala ) i;
+            return true;
+        }
+    return false;
+}
+
+const char *nombre_filtro( const filtro_escala filtro )
+{
+    return nombres_filtros[filtro];
+}
+
+/* Deja en datos los valores por defecto, antes de leer los parámetros */
+void datos_por_defecto( datix *datos )
+{
+    memset( datos, 0, sizeof( datix ) );
+    datos->hilos = 0; // 0: tantos hilos como procesadores
+}
+
 /* Procesa los parametros que recibe el programa, si hay alguno mal, devuelve false. Recibe el arreglo de parametros, la cantidad
-y una variable con datix para guardar los datos que se lean en los parametros */
+y una variable con datix para guardar los datos que se lean en los parametros. Los errores se escriben en mensajes */
 
-bool parametros_correctos( char *argv[], int argc, datix *datos )
+bool parametros_correctos( char *argv[], int argc, datix *datos, FILE *mensajes )
 {
     int i = 1;
     bool error = false;
     if(argc<2) {
-        printf("Se debe enviar al menos un parámetro\n");
+        fprintf( mensajes, "Se debe enviar al menos un parámetro\n");
         datos->ayuda = true;
         return true;
     }
@@ -109,10 +190,38 @@ bool parametros_correctos( char *argv[], int argc, datix *datos )
                 if( (argv[i][2]) != '\0')return false;
                 break;
             }
+            case 'v': {
+                if( (argv[i][2]) != '\0')return false;
+                datos->verbose = true;
+                break;
+            }
             case 'f': {
                 if( (argv[i][2]) != '\0')return false;
                 break;
             }
+            case 't': {
+                if( (argv[i][2]) != '\0')return false;
+                datos->perfil = true;
+                break;
+            }
+            case 'H': {
+                if( (argv[i][2]) != '\0')return false;
+                datos->paginas_grandes = true;
+                break;
+            }
+            case 'c': {
+                if( (argv[i][2]) != '\0')return false;
+                datos->rle = true;
+                break;
+            }
+            case '-': { // única opción larga
+                if( strcmp( argv[i], "--profile" ) != 0 ) {
+                    fprintf( mensajes, "Parametro incorrecto ... use -h para ayuda.\n" );
+                    return false;
+                }
+                datos->perfil = true;
+                break;
+            }
             case 'b':      //guardo el ratio del blur
             {
                 if( (argv[i][2]) != '\0')return false;
@@ -120,11 +229,11 @@ bool parametros_correctos( char *argv[], int argc, datix *datos )
                 {
                     long aux_long;
                     if (!(string_a_long(argv[i+1],&aux_long))) {
-                        printf("Error al convertir la cadena a un entero");
+                        fprintf( mensajes, "Error al convertir la cadena a un entero");
                         return false;
                     }
                     if(!( aux_long>0 && aux_long <= 0xFFFFFF )) {
-                        printf("Valor incorrecto del blur");
+                        fprintf( mensajes, "Valor incorrecto del blur");
                         return false;
                     }
                     datos->blur_rate=aux_long;
@@ -133,7 +242,114 @@ bool parametros_correctos( char *argv[], int argc, datix *datos )
                 }
                 else
                 {
-                    printf( "Error, opcion -b debe tener un RATIO ... use -h para ayuda.\n" );
+                    fprintf( mensajes, "Error, opcion -b debe tener un RATIO ... use -h para ayuda.\n" );
+                    error = true;
+                    break;
+                }
+            }
+            case 'z':      //guardo el tamaño y el filtro para redimensionar
+            {
+                if( (argv[i][2]) != '\0')return false;
+                if ( ( argv[i + 1] ) && ( argv[i + 2] ) && ( argv[i + 3] ) )
+                {
+                    long ancho, alto;
+                    if (!(string_a_entero(argv[i+1],&ancho)) || !(string_a_entero(argv[i+2],&alto))) {
+                        fprintf( mensajes, "Error al convertir la cadena a un entero\n");
+                        return false;
+                    }
+                    if(!( ancho >= 0 && ancho <= 0xFFFF && alto >= 0 && alto <= 0xFFFF &&
+                            ( ancho || alto ) )) {
+                        fprintf( mensajes, "Tamaño incorrecto para redimensionar\n");
+                        return false;
+                    }
+                    filtro_escala filtro;
+                    if (!filtro_desde_nombre(argv[i+3],&filtro)) {
+                        fprintf( mensajes, "Filtro incorrecto, use cercano, caja, bilineal o lanczos\n");
+                        return false;
+                    }
+                    i += 3;
+                    break;
+                }
+                else
+                {
+                    fprintf( mensajes, "Error, -z debe tener 3 opciones ... use -h para ayuda.\n" );
+                    error = true;
+                    break;
+                }
+            }
+            case 'C':      //controlo el rectángulo del recorte
+            {
+                if( (argv[i][2]) != '\0')return false;
+                if ( ( argv[i + 1] ) && ( argv[i + 2] ) && ( argv[i + 3] ) && ( argv[i + 4] ) )
+                {
+                    long x, y, ancho, alto;
+                    if (!(string_a_entero(argv[i+1],&x)) || !(string_a_entero(argv[i+2],&y)) ||
+                            !(string_a_entero(argv[i+3],&ancho)) || !(string_a_entero(argv[i+4],&alto))) {
+                        fprintf( mensajes, "Error al convertir la cadena a un entero\n");
+                        return false;
+                    }
+                    if(!( x >= 0 && x <= 0x7FFFFFFF && y >= 0 && y <= 0x7FFFFFFF &&
+                            ancho > 0 && ancho <= 0x7FFFFFFF && alto > 0 && alto <= 0x7FFFFFFF )) {
+                        fprintf( mensajes, "Rectángulo incorrecto para recortar\n");
+                        return false;
+                    }
+                    i += 4;
+                    break;
+                }
+                else
+                {
+                    fprintf( mensajes, "Error, -C debe tener 4 opciones ... use -h para ayuda.\n" );
+                    error = true;
+                    break;
+                }
+            }
+            case 'B':      //guardo los BPP de la salida
+            {
+                if( (argv[i][2]) != '\0')return false;
+                if ( argv[i + 1] )
+                {
+                    long aux_long;
+                    if (!(string_a_entero(argv[i+1],&aux_long))) {
+                        fprintf( mensajes, "Error al convertir la cadena a un entero");
+                        return false;
+                    }
+                    if( aux_long != 1 && aux_long != 4 && aux_long != 8 && aux_long != 15 &&
+                            aux_long != 16 && aux_long != 24 && aux_long != 32 ) {
+                        fprintf( mensajes, "BPP de salida incorrectos");
+                        return false;
+                    }
+                    datos->profundidad=aux_long;
+                    i++;
+                    break;
+                }
+                else
+                {
+                    fprintf( mensajes, "Error, opcion -B debe tener los BPP ... use -h para ayuda.\n" );
+                    error = true;
+                    break;
+                }
+            }
+            case 'j':      //guardo la cantidad de hilos
+            {
+                if( (argv[i][2]) != '\0')return false;
+                if ( argv[i + 1] )
+                {
+                    long aux_long;
+                    if (!(string_a_entero(argv[i+1],&aux_long))) {
+                        fprintf( mensajes, "Error al convertir la cadena a un entero");
+                        return false;
+                    }
+                    if(!( aux_long>0 && aux_long <= 1024 )) {
+                        fprintf( mensajes, "Cantidad de hilos incorrecta\n" );
+                        return false;
+                    }
+                    datos->hilos=aux_long;
+                    i++;
+                    break;
+                }
+                else
+                {
+                    fprintf( mensajes, "Error, opcion -j debe tener una cantidad ... use -h para ayuda.\n" );
                     error = true;
                     break;
                 }
@@ -147,26 +363,26 @@ bool parametros_correctos( char *argv[], int argc, datix *datos )
                     {
                         long aux_long2;
                         if (!(string_a_long(argv[i+1],&aux_long2))) {
-                            printf("Error al convertir la cadena a un entero");
+                            fprintf( mensajes, "Error al convertir la cadena a un entero");
                             return false;
                         }
                         datos->lineas_hor_ancho = aux_long2;
 
                         aux_long2 = 0;
                         if (!(string_a_long(argv[i+2],&aux_long2))) {
-                            printf("Error al convertir la cadena a un entero");
+                            fprintf( mensajes, "Error al convertir la cadena a un entero");
                             return false;
                         }
                         datos->lineas_hor_espacio = aux_long2;
 
                         aux_long2 = 0;
                         if (!(string_a_long(argv[i+3],&aux_long2))) {
-                            printf("Error al convertir la cadena a un entero");
+                            fprintf( mensajes, "Error al convertir la cadena a un entero");
                             return false;
                         }
                         if( ! ( aux_long2 > 0 &&
                                 aux_long2 <= 0xFFFFFF ) ) {
-                            printf( "Color incorrecto para las lineas\n" );
+                            fprintf( mensajes, "Color incorrecto para las lineas\n" );
                             return false;
                         }
 
@@ -177,7 +393,7 @@ bool parametros_correctos( char *argv[], int argc, datix *datos )
                     }
                     else
                     {
-                        printf( "Error, -LH debe tener 3 opciones ... use -h para ayuda.\n" );
+                        fprintf( mensajes, "Error, -LH debe tener 3 opciones ... use -h para ayuda.\n" );
                         error = true;
                         break;
                     }
@@ -188,25 +404,25 @@ bool parametros_correctos( char *argv[], int argc, datix *datos )
                     {
                         long aux_long2;
                         if (!(string_a_long(argv[i+1],&aux_long2))) {
-                            printf("Error al convertir la cadena a un entero\n");
+                            fprintf( mensajes, "Error al convertir la cadena a un entero\n");
                             return false;
                         }
                         datos->lineas_ver_ancho = aux_long2;
                         aux_long2 = 0;
                         if (!(string_a_long(argv[i+2],&aux_long2))) {
-                            printf("Error al convertir la cadena a un entero\n");
+                            fprintf( mensajes, "Error al convertir la cadena a un entero\n");
                             return false;
                         }
                         datos->lineas_ver_espacio = aux_long2;
                         aux_long2 = 0;
                         if (!(string_a_long(argv[i+3],&aux_long2))) {
-                            printf("Error al convertir la cadena a un entero\n");
+                            fprintf( mensajes, "Error al convertir la cadena a un entero\n");
                             return false;
                         }
 
                         if( ! ( aux_long2 > 0 &&
                                 aux_long2 <= 0xFFFFFF ) ) {
-                            printf( "Color incorrecto para las lineas\n" );
+                            fprintf( mensajes, "Color incorrecto para las lineas\n" );
                             return false;
                         }
 
@@ -216,13 +432,13 @@ bool parametros_correctos( char *argv[], int argc, datix *datos )
                     }
                     else
                     {
-                        printf( "Error, -LV debe tener 3 opciones ... use -h para ayuda.\n" );
+                        fprintf( mensajes, "Error, -LV debe tener 3 opciones ... use -h para ayuda.\n" );
                         error = true;
                         break;
                     }
                 }
                 default:
-                    printf("Parametro incorrecto ... use -h para ayuda.\n");
+                    fprintf( mensajes, "Parametro incorrecto ... use -h para ayuda.\n");
                     break;
                 }//switch LH LV
                 break; //del switch de LH LV
@@ -237,7 +453,83 @@ bool parametros_correctos( char *argv[], int argc, datix *datos )
                 }
                 else
                 {
-                    printf( "la opcion -o debe tener un parametro ... use -h para ayuda.\n" );
+                    fprintf( mensajes, "la opcion -o debe tener un parametro ... use -h para ayuda.\n" );
+                    error = true;
+                    break;
+                }
+            case 'T': //guardo el archivo del perfil
+                if( argv[i][2] != '\0')return false;
+                if ( argv[i + 1] )
+                {
+                    datos->perfil = true;
+                    datos->perfil_json = argv[i + 1];
+                    i++;
+                    break;
+                }
+                else
+                {
+                    fprintf( mensajes, "la opcion -T debe tener un parametro ... use -h para ayuda.\n" );
+                    error = true;
+                    break;
+                }
+            case 'S': //guardo el formato del inventario
+                if( argv[i][2] != '\0')return false;
+                if ( argv[i + 1] )
+                {
+                    if ( strcmp( argv[i + 1], "tabla" ) && strcmp( argv[i + 1], "json" ) ) {
+                        fprintf( mensajes, "Formato de inventario incorrecto: use tabla o json.\n" );
+                        return false;
+                    }
+                    datos->inventario = true;
+                    datos->inventario_json = strcmp( argv[i + 1], "json" ) == 0;
+                    i++;
+                    break;
+                }
+                else
+                {
+                    fprintf( mensajes, "la opcion -S debe tener un parametro ... use -h para ayuda.\n" );
+                    error = true;
+                    break;
+                }
+            case 'x': //guardo el archivo de la traza
+                if( argv[i][2] != '\0')return false;
+                if ( argv[i + 1] )
+                {
+                    datos->traza = argv[i + 1];
+                    i++;
+                    break;
+                }
+                else
+                {
+                    fprintf( mensajes, "la opcion -x debe tener un parametro ... use -h para ayuda.\n" );
+                    error = true;
+                    break;
+                }
+            case 'D': //guardo el socket del servidor
+                if( argv[i][2] != '\0')return false;
+                if ( argv[i + 1] )
+                {
+                    datos->servidor = argv[i + 1];
+                    i++;
+                    break;
+                }
+                else
+                {
+                    fprintf( mensajes, "la opcion -D debe tener un parametro ... use -h para ayuda.\n" );
+                    error = true;
+                    break;
+                }
+            case 'e': //guardo las entradas del lote
+                if( argv[i][2] != '\0')return false;
+                if ( argv[i + 1] )
+                {
+                    datos->lote = argv[i + 1];
+                    i++;
+                    break;
+                }
+                else
+                {
+                    fprintf( mensajes, "la opcion -e debe tener un parametro ... use -h para ayuda.\n" );
                     error = true;
                     break;
                 }
@@ -251,13 +543,13 @@ bool parametros_correctos( char *argv[], int argc, datix *datos )
                 }
                 else
                 {
-                    printf( "la opcion -i debe tener un parametro ... use -h para ayuda.\n" );
+                    fprintf( mensajes, "la opcion -i debe tener un parametro ... use -h para ayuda.\n" );
                     error = true;
                     break;
                 }
             default:
             {
-                printf( "Parametro incorrecto ... use -h para ayuda.\n" );
+                fprintf( mensajes, "Parametro incorrecto ... use -h para ayuda.\n" );
                 error = true;
                 break;
             }
@@ -265,14 +557,24 @@ bool parametros_correctos( char *argv[], int argc, datix *datos )
         } //if
         else // Si el par   am no es "-algo"
         {
-            printf( "Cada parametro debe comenzar con \"-\" ... use -h para ayuda.\n" );
+            fprintf( mensajes, "Cada parametro debe comenzar con \"-\" ... use -h para ayuda.\n" );
             error = true;
         }
         i++;
     } //while
-    if ( datos->entrada == NULL ) //si no se ingreso archivo para abrir, error
+    if ( datos->entrada == NULL && datos->lote == NULL && datos->servidor == NULL ) //si no se ingreso archivo para abrir, error
+    {
+        fprintf( mensajes, "Error, no se ingreso archivo de entrada\n" );
+        error = true;
+    }
+    if ( datos->entrada != NULL && datos->lote != NULL )
     {
-        printf( "Error, no se ingreso archivo de entrada\n" );
+        fprintf( mensajes, "Error, use -i o -e, pero no los dos\n" );
+        error = true;
+    }
+    if ( datos->lote != NULL && datos->salida != NULL && !datos->inventario && strstr( datos->salida, "%s" ) == NULL )
+    {
+        fprintf( mensajes, "Error, en un lote la salida debe tener %%s ... use -h para ayuda.\n" );
         error = true;
     }
     if ( error ) return false;
@@ -280,116 +582,88 @@ bool parametros_correctos( char *argv[], int argc, datix *datos )
 } //funcion
 
 
-/* Recibe los valores de los parámetros recolectados en parametros_correctos y los emplea para llamar a la función correspondiente en cada caso.
- * Recibe también los parámetros al programa, y la cantidad que son */
-bool procesar( char *argv[], int argc, datix *datos )
+/* Arma el plan con los parámetros y lo aplica a la entrada (o al lote).
+ * El pool de hilos ya tiene que estar iniciado. Los headers (-s) y el
+ * inventario (-S) se escriben en salida. */
+bool procesar_plan( char *argv[], int argc, datix *datos, FILE *salida )
 {
-    int i = 1;
-    bool guardar=false;
-    bmp_t *bmpfile;
-    bmpfile = crear_imagen_archivo( datos->entrada );
-    while ( i < argc )
+    bool ok;
+    plan_t plan;
+    perfil_t perfil;
+
+    if ( !armar_plan( argv, argc, datos, &plan ) )
+        return false;
+    plan.textos = salida;
+    optimizar_plan( &plan );
+    if ( datos->verbose )
+        mostrar_plan( &plan, salida_errores() );
+
+    /* sin -t el plan no tiene perfil y no se mide nada */
+    if ( datos->perfil )
+        iniciar_perfil( &perfil );
+    if ( datos->traza != NULL )
+        iniciar_traza();
+
+    if ( datos->inventario )
     {
-        switch ( argv[i][1] )
-        {
-        case '?':
-        {
-            ayuda();
-            break;
-        }
-        case 'h':
-        {
-            ayuda();
-            break;
-        }
-        case 's':
-        {
-            mostrar_header( bmpfile );
-            if(datos->salida != NULL )guardar=true;
-            break;
-        }
-        case 'p':
-        {
-            flip_vertical( bmpfile );
-            guardar=true;
-            break;
-        }
-        case 'r':
-        {
-            rotar( bmpfile );
-            guardar=true;
-            break;
-        }
-        case 'n':
-        {
-            negativo( bmpfile );
-            guardar=true;
-            break;
-        }
-        case 'd':
-        {
-            redimensionar2x( bmpfile );
-            guardar=true;
-            break;
-        }
-        case 'f':
-        {
-            redimensionar1_2x( bmpfile );
-            guardar=true;
-            break;
-        }
-        case 'b':
-        {
-            blur( datos->blur_rate, bmpfile );    //saltea porque ya se guardo anteriormente
-            i++;
-            guardar=true;
-            break;
-        }
-        case 'l': {
-            switch ( argv[i][2] )
-            {
-            case 'h':
-            {
-                addlineash( datos->lineas_hor_ancho, datos->lineas_hor_espacio, datos->lineas_hor_color, bmpfile );
-                i += 3;
-                guardar=true;
-                break;
-            }
-            case 'v':
-            {
-                addlineasv( datos->lineas_ver_ancho, datos->lineas_ver_espacio, datos->lineas_ver_color, bmpfile );    //< se saltea porque ya se guardo
-                i += 3;
-                guardar=true;
-                break;
-            }
-            }
-            break;
-        }
-        case 'o': {
-            i++;    //se saltea ya que ya se guardo anteriormente
-            guardar=true;
-            break;
-        }
-        case 'i': {
-            i++;    //mismo^
-            break;
-        }
-        } //switch
-        i++;
-    } //while
-    // volcar el bmp de memoria a un archivo
-    if(guardar)
-        if(!grabar_archivo( bmpfile, datos->salida == NULL? "out.bmp" : datos->salida )) {
-            fprintf( stderr, "Error al grabar el archivo en el disco");
-            return false;
-        }
-    //destruir el archivo de la memoria
-    if(datos->entrada != NULL) {
-        if(!destruir_bmp( bmpfile )) {
-            fprintf( stderr, "Error al liberar la memoria de la imagen");
-            return false;
-        }
+        /* sólo headers: el resto de las opciones no se aplica */
+        if ( datos->perfil )
+            empezar_paso( &perfil );
+        ok = inventariar( datos->entrada, datos->lote, datos->inventario_json, salida );
+        if ( datos->perfil )
+            terminar_paso( &perfil, "inventario" );
     }
-    return true;
-} //funcion
+    else if ( datos->lote != NULL )
+    {
+        /* las imágenes del lote van en paralelo: se mide el lote entero */
+        if ( datos->perfil )
+            empezar_paso( &perfil );
+        ok = procesar_lote( &plan, datos->lote,
+                            datos->salida == NULL? "%s_out.bmp" : datos->salida );
+        if ( datos->perfil )
+            terminar_paso( &perfil, "lote" );
+    }
+    else
+    {
+        if ( datos->perfil )
+            plan.perfil = &perfil;
+        ok = ejecutar_plan( &plan, datos->entrada,
+                            datos->salida == NULL? "out.bmp" : datos->salida );
+    }
+
+    if ( datos->perfil )
+    {
+        if ( datos->perfil_json != NULL )
+            ok = grabar_perfil_json( &perfil, datos->perfil_json ) && ok;
+        else
+            mostrar_perfil( &perfil, stderr );
+        liberar_perfil( &perfil );
+    }
+    if ( datos->traza != NULL )
+        ok = grabar_traza( datos->traza ) && ok;
 
+    liberar_plan( &plan );
+    return ok;
+}
+
+/* Recibe los valores de los parámetros recolectados en parametros_correctos y los emplea para llamar a la función correspondiente en cada caso.
+ * Recibe también los parámetros al programa, y la cantidad que son.
+ * Las operaciones se arman primero en un plan, que se optimiza antes de
+ * tocar la imágen */
+bool procesar( char *argv[], int argc, datix *datos )
+{
+    bool ok;
+
+    if ( !pool_iniciar( datos->hilos ) )
+        return false;
+    usar_paginas_grandes( datos->paginas_grandes );
+
+    if ( datos->servidor != NULL )
+        ok = servir( datos->servidor );
+    else
+        ok = procesar_plan( argv, argc, datos, stdout );
+
+    pool_destruir();
+    vaciar_reserva();
+    return ok;
+} //funcion